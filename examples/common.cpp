@@ -1,9 +1,6 @@
 #include <epa/proton.hpp>
 
 #include <iostream>
-#include <list>
-#include <mutex>
-#include <thread>
 
 #include <string.h>
 
@@ -48,42 +45,22 @@ epa::Function1d make_function1d(
 
 epa::Function1d make_function1d_async(
     const std::function<std::function<double (double)> ()>& generator,
-    std::vector<std::pair<double, double>> grid,
+    const std::vector<std::pair<double, double>>& grid,
     const std::string& verbose = std::string()
 ) {
-  epa::Function1d F(std::move(grid));
-  std::mutex m_queue;
-  std::mutex m_output;
-  std::list<std::thread> threads;
-  size_t i = 0;
-  int nprocs = get_nprocs();
-  if (!verbose.empty()) std::cerr << "Using " << nprocs << " threads.\n";
-  auto& points = *F.points;
-  for (int t = 0; t < nprocs; ++t)
-    threads.emplace_back(
-        [&]() {
-          auto f = generator();
-          while (true) {
-            size_t j;
-            {
-              std::unique_lock lock(m_queue);
-              j = i++;
-            };
-            if (j >= points.size()) break;
-            points[j].second = f(points[j].first);
-            if (!verbose.empty()) {
-              std::unique_lock lock(m_output);
-              std::cerr
-                << verbose
-                << points[j].first << " => " << points[j].second
-                << '\n';
-            };
-          };
-        }
-    );
+  std::vector<double> xs;
+  xs.reserve(grid.size());
+  for (auto& point: grid) xs.push_back(point.first);
 
-  for (auto& t: threads) t.join();
-  return F;
+  epa::tabulate_keys keys;
+  keys.threads = get_nprocs();
+  if (!verbose.empty()) {
+    std::cerr << "Using " << keys.threads << " threads.\n";
+    keys.progress = [&](size_t, size_t, double x, double y) {
+      std::cerr << verbose << x << " => " << y << '\n';
+    };
+  };
+  return epa::tabulate(generator, std::move(xs), keys);
 };
 
 double parse_energy(const char* arg, const char* value) {
@@ -20,23 +20,48 @@ void usage(const char* argv0) {
        "  -p or --polarization parallel|perpendicular: assume polarized photons (no argument). Implies -S.\n";
 };
 
+// All the points are computed at once by luminosity_b_scan, which shares the
+// spectra and the survival probability kernel between them
 epa::Function1d pp_luminosity_b(
     double collision_energy,
     epa::Polarization polarization,
     std::vector<std::pair<double, double>> grid,
-    const std::string& verbose = std::string()
+    unsigned nthreads,
+    bool verbose
 ) {
-  return make_function1d_async(
-      [&]() -> std::function<double (double)> {
-        return [=, l = epa::pp_luminosity_b(collision_energy)](
-            double rs
-        ) -> double {
-          return l(rs, polarization);
-        };
-      },
-      std::move(grid),
-      verbose
+  double energy = 0.5 * collision_energy;
+  auto n = epa::proton_dipole_spectrum_b_Dirac(energy);
+
+  std::vector<double> rs;
+  rs.reserve(grid.size());
+  for (auto& point: grid) rs.push_back(point.first);
+
+  // the spectra vanish for the photons energies above the proton energy
+  double y = log(2 * energy / *std::min_element(rs.begin(), rs.end()));
+
+  epa::luminosity_b_scan_keys keys;
+  keys.threads = nthreads;
+  auto luminosity = epa::luminosity_b_scan(
+      n,
+      n,
+      epa::upc_probability_angular(
+        epa::pp_upc_probability_Gaussians(collision_energy)
+      ),
+      rs,
+      polarization,
+      -y,
+      y,
+      keys
   );
+
+  for (size_t i = 0; i < grid.size(); ++i) {
+    grid[i].second = luminosity[i].result;
+    if (verbose)
+      std::cerr
+        << "luminosity_b " << grid[i].first << " => " << luminosity[i].result
+        << " +- " << luminosity[i].abserr << '\n';
+  };
+  return epa::Function1d(std::move(grid));
 };
 
 int main(int argc, char** argv) {
@@ -162,10 +187,7 @@ int main(int argc, char** argv) {
 
   auto luminosity = survival
                   ? pp_luminosity_b(
-                      collision_energy,
-                      polarization,
-                      grid,
-                      verbose ? "luminosity_b " : nullptr
+                      collision_energy, polarization, grid, nthreads, verbose
                     )
                   : make_function1d(epa::pp_luminosity(collision_energy), grid);
   luminosity.dump(std::cout);
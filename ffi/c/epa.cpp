@@ -71,6 +71,19 @@ epa_qag_integrator(
   } FFI_CATCH;
 };
 
+extern "C"
+Function*
+epa_gk_integrator(
+    double absolute_error,
+    double relative_error,
+    gsl::integration::QAGMethod method,
+    size_t limit
+) {
+  try {
+    return lift(gk_integrator(absolute_error, relative_error, method, limit));
+  } FFI_CATCH;
+};
+
 extern "C"
 std::shared_ptr<gsl::integration::CQuadWorkspace>*
 epa_make_cquad_integration_workspace(size_t limit) {
@@ -103,6 +116,102 @@ epa_cquad_integrator(
   } FFI_CATCH;
 };
 
+extern "C"
+std::shared_ptr<IntegrationProfile>*
+epa_make_integration_profile() {
+  try {
+    return new std::shared_ptr<IntegrationProfile>(
+        std::make_shared<IntegrationProfile>()
+    );
+  } FFI_CATCH;
+};
+
+extern "C"
+void
+epa_destroy_integration_profile(std::shared_ptr<IntegrationProfile>* profile) {
+  delete profile;
+};
+
+extern "C"
+void
+epa_clear_integration_profile(std::shared_ptr<IntegrationProfile>* profile) {
+  (*profile)->clear();
+};
+
+extern "C"
+Function*
+epa_profiled_integrator(
+    Function* integrator,
+    unsigned level,
+    std::shared_ptr<IntegrationProfile>* profile
+) {
+  try {
+    return lift(
+        profiled_integrator(lower<Integrator>(integrator), level, *profile)
+    );
+  } FFI_CATCH;
+};
+
+extern "C"
+Function*
+epa_profiled_integrator_generator(
+    Function* integrator_generator,
+    std::shared_ptr<IntegrationProfile>* profile
+) {
+  try {
+    return lift(
+        profiled_integrator_generator(
+          lower<Integrator (unsigned)>(integrator_generator), *profile
+        )
+    );
+  } FFI_CATCH;
+};
+
+extern "C"
+std::vector<IntegrationProfile::Entry>*
+epa_integration_profile_entries(std::shared_ptr<IntegrationProfile>* profile) {
+  try {
+    return new std::vector<IntegrationProfile::Entry>((*profile)->entries());
+  } FFI_CATCH;
+};
+
+extern "C"
+void
+epa_destroy_integration_report(std::vector<IntegrationProfile::Entry>* report) {
+  delete report;
+};
+
+extern "C"
+size_t
+epa_integration_report_size(std::vector<IntegrationProfile::Entry>* report) {
+  return report->size();
+};
+
+extern "C"
+const char*
+epa_integration_report_site(
+    std::vector<IntegrationProfile::Entry>* report, size_t i
+) {
+  return (*report)[i].site.c_str();
+};
+
+extern "C"
+unsigned
+epa_integration_report_level(
+    std::vector<IntegrationProfile::Entry>* report, size_t i
+) {
+  return (*report)[i].level;
+};
+
+// IntegrationStats has the layout of epa_integration_stats
+extern "C"
+IntegrationStats
+epa_integration_report_stats(
+    std::vector<IntegrationProfile::Entry>* report, size_t i
+) {
+  return (*report)[i].stats;
+};
+
 
 extern "C" int epa_get_default_integration_method() {
   return default_integration_method;
@@ -157,18 +266,33 @@ epa_spectrum_dipole(unsigned Z, double gamma, double lambda2) {
   } FFI_CATCH;
 };
 
+extern "C"
+Function*
+epa_spectrum_monopole_batch(unsigned Z, double gamma, double lambda2) {
+  try {
+    return lift(spectrum_monopole_batch(Z, gamma, lambda2));
+  } FFI_CATCH;
+};
+
+extern "C"
+Function*
+epa_spectrum_dipole_batch(unsigned Z, double gamma, double lambda2) {
+  try {
+    return lift(spectrum_dipole_batch(Z, gamma, lambda2));
+  } FFI_CATCH;
+};
+
 extern "C"
 Function* epa_spectrum_b(
     unsigned Z, double gamma, Function* form_factor, Function* integrator
 ) {
   try {
     return lift(
-        spectrum_b(
-          Z,
-          gamma,
-          lower<FormFactor>(form_factor),
-          integrator ? lower<Integrator>(integrator) : default_integrator(0)
-        )
+        integrator
+        ? spectrum_b(
+            Z, gamma, lower<FormFactor>(form_factor), lower<Integrator>(integrator)
+          )
+        : spectrum_b(Z, gamma, lower<FormFactor>(form_factor))
     );
   } FFI_CATCH;
 };
@@ -197,6 +321,30 @@ epa_spectrum_b_dipole(unsigned Z, double gamma, double lambda2) {
   } FFI_CATCH;
 };
 
+extern "C"
+Function*
+epa_spectrum_b_point_batch(unsigned Z, double gamma) {
+  try {
+    return lift(spectrum_b_point_batch(Z, gamma));
+  } FFI_CATCH;
+};
+
+extern "C"
+Function*
+epa_spectrum_b_monopole_batch(unsigned Z, double gamma, double lambda2) {
+  try {
+    return lift(spectrum_b_monopole_batch(Z, gamma, lambda2));
+  } FFI_CATCH;
+};
+
+extern "C"
+Function*
+epa_spectrum_b_dipole_batch(unsigned Z, double gamma, double lambda2) {
+  try {
+    return lift(spectrum_b_dipole_batch(Z, gamma, lambda2));
+  } FFI_CATCH;
+};
+
 template <typename Luminosity>
 static inline Function* epa_luminosity_(
     Luminosity (*luminosity1)(Spectrum, Integrator),
@@ -6,11 +6,24 @@
 typedef struct epa_qag_workspace   epa_qag_workspace;
 typedef struct epa_cquad_workspace epa_cquad_workspace;
 
+typedef struct epa_integration_profile epa_integration_profile;
+typedef struct epa_integration_report  epa_integration_report;
+
 typedef struct epa_polarization {
   double parallel;
   double perpendicular;
 } epa_polarization;
 
+typedef struct epa_integration_stats {
+  size_t calls;
+  size_t nevals;
+  size_t failures;
+  size_t limit_hits;
+  double max_abserr;
+  double max_relerr;
+  double time;
+} epa_integration_stats;
+
 #define defun(name, result, ...) \
   typedef struct name { \
     result (*function)(__VA_ARGS__ __VA_OPT__(,) void*); \
@@ -32,6 +45,9 @@ defun(epa_luminosity_fid_b_f, double, double, epa_polarization, double, double);
 defun(epa_xsection_b_f,  epa_polarization, double);
 defun(epa_xsection_pT_b, epa_polarization, double, double);
 
+defun(epa_spectrum_batch_f,   void, size_t, const double*, double*);
+defun(epa_spectrum_b_batch_f, void, size_t, const double*, const double*, double*);
+
 #undef defun
 
 #define defconst(type, name) type epa_ ## name()
@@ -61,6 +77,14 @@ epa_qag_integrator(
     epa_qag_workspace*
 );
 
+epa_integrator*
+epa_gk_integrator(
+    double absolute_error,
+    double relative_error,
+    int method,
+    size_t limit
+);
+
 epa_cquad_workspace* epa_make_cquad_integration_workspace(size_t limit);
 void epa_destroy_cquad_integration_workspace(epa_cquad_workspace*);
 
@@ -71,6 +95,32 @@ epa_cquad_integrator(
     epa_cquad_workspace*
 );
 
+epa_integration_profile* epa_make_integration_profile(void);
+void epa_destroy_integration_profile(epa_integration_profile*);
+void epa_clear_integration_profile(epa_integration_profile*);
+
+epa_integrator*
+epa_profiled_integrator(
+    epa_integrator*, unsigned level, epa_integration_profile*
+);
+
+epa_integrator_generator*
+epa_profiled_integrator_generator(
+    epa_integrator_generator*, epa_integration_profile*
+);
+
+// Snapshot of the entries of a profile
+epa_integration_report*
+epa_integration_profile_entries(epa_integration_profile*);
+
+void epa_destroy_integration_report(epa_integration_report*);
+size_t epa_integration_report_size(epa_integration_report*);
+const char* epa_integration_report_site(epa_integration_report*, size_t);
+unsigned epa_integration_report_level(epa_integration_report*, size_t);
+
+epa_integration_stats
+epa_integration_report_stats(epa_integration_report*, size_t);
+
 epa_function1d* epa_form_factor_monopole(double lambda2);
 epa_function1d* epa_form_factor_dipole  (double lambda2);
 
@@ -82,6 +132,12 @@ epa_spectrum(
 epa_function1d* epa_spectrum_monopole(unsigned Z, double gamma, double lambda2);
 epa_function1d* epa_spectrum_dipole  (unsigned Z, double gamma, double lambda2);
 
+epa_spectrum_batch_f*
+epa_spectrum_monopole_batch(unsigned Z, double gamma, double lambda2);
+
+epa_spectrum_batch_f*
+epa_spectrum_dipole_batch(unsigned Z, double gamma, double lambda2);
+
 epa_function2d*
 epa_spectrum_b(
     unsigned Z, double gamma, epa_function1d* form_factor, epa_integrator*
@@ -95,6 +151,14 @@ epa_spectrum_b_monopole(unsigned Z, double gamma, double lambda2);
 epa_function2d*
 epa_spectrum_b_dipole(unsigned Z, double gamma, double lambda2);
 
+epa_spectrum_b_batch_f* epa_spectrum_b_point_batch(unsigned Z, double gamma);
+
+epa_spectrum_b_batch_f*
+epa_spectrum_b_monopole_batch(unsigned Z, double gamma, double lambda2);
+
+epa_spectrum_b_batch_f*
+epa_spectrum_b_dipole_batch(unsigned Z, double gamma, double lambda2);
+
 epa_function1d*
 epa_luminosity(
     epa_function1d* spectrum1,
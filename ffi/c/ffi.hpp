@@ -172,7 +172,10 @@ template <typename Result, typename... Args>
 lower_t<Result>
 trampoline(lower_t<Args>... args, std::function<Result (Args...)>* f) {
   try {
-    return lift((*f)(lower<remove_cvref_t<Args>>(args)...));
+    if constexpr (std::is_void_v<Result>)
+      (*f)(lower<remove_cvref_t<Args>>(args)...);
+    else
+      return lift((*f)(lower<remove_cvref_t<Args>>(args)...));
   } catch (ForeignError& e) {
     error = e.error();
     return lower_t<Result>();
@@ -195,12 +198,20 @@ struct lower_<Result (Args...)> {
     if (reinterpret_cast<T>(f->function) == &trampoline<Result, Args...>)
       return *reinterpret_cast<F*>(f->data);
     return [f = f](Args... args) -> Result {
-      lower_t<Result> result = reinterpret_cast<T>(f->function)(
-          lift_on_stack_<Args>(args)...,
-          static_cast<F*>(f->data)
-      );
-      if (error.error) throw ForeignError();
-      return lower<Result>(result);
+      if constexpr (std::is_void_v<Result>) {
+        reinterpret_cast<T>(f->function)(
+            lift_on_stack_<Args>(args)...,
+            static_cast<F*>(f->data)
+        );
+        if (error.error) throw ForeignError();
+      } else {
+        lower_t<Result> result = reinterpret_cast<T>(f->function)(
+            lift_on_stack_<Args>(args)...,
+            static_cast<F*>(f->data)
+        );
+        if (error.error) throw ForeignError();
+        return lower<Result>(result);
+      };
     };
   };
 };
@@ -45,6 +45,30 @@ epa_proton_dipole_spectrum_b_Dirac(double energy, double lambda2) {
   } FFI_CATCH;
 };
 
+extern "C"
+Function*
+epa_proton_dipole_spectrum_batch(double energy, double lambda2) {
+  try {
+    return lift(proton_dipole_spectrum_batch(energy, lambda2));
+  } FFI_CATCH;
+};
+
+extern "C"
+Function*
+epa_proton_dipole_spectrum_Dirac_batch(double energy, double lambda2) {
+  try {
+    return lift(proton_dipole_spectrum_Dirac_batch(energy, lambda2));
+  } FFI_CATCH;
+};
+
+extern "C"
+Function*
+epa_proton_dipole_spectrum_b_Dirac_batch(double energy, double lambda2) {
+  try {
+    return lift(proton_dipole_spectrum_b_Dirac_batch(energy, lambda2));
+  } FFI_CATCH;
+};
+
 extern "C" double epa_pp_elastic_slope(double collision_energy) {
   try {
     return pp_elastic_slope(collision_energy);
@@ -15,6 +15,15 @@ epa_function1d* epa_proton_dipole_spectrum_Dirac(double energy, double lambda2);
 epa_function2d*
 epa_proton_dipole_spectrum_b_Dirac(double energy, double lambda2);
 
+epa_spectrum_batch_f*
+epa_proton_dipole_spectrum_batch(double energy, double lambda2);
+
+epa_spectrum_batch_f*
+epa_proton_dipole_spectrum_Dirac_batch(double energy, double lambda2);
+
+epa_spectrum_b_batch_f*
+epa_proton_dipole_spectrum_b_Dirac_batch(double energy, double lambda2);
+
 double epa_pp_elastic_slope(double collision_energy);
 
 epa_function1d* epa_pp_upc_probability(double collision_energy);
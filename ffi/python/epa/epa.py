@@ -190,6 +190,41 @@ class Function:
     def _destroy_function(epa_function):
         lib.epa_destroy_function(ffi.cast('epa_function*', epa_function))
 
+def _doubles(x):
+    # contiguous buffers of doubles (array.array('d'), numpy arrays of float64)
+    # are passed to the library as is, anything else is copied
+    try:
+        view = memoryview(x)
+        if view.format == 'd' and view.c_contiguous:
+            return ffi.from_buffer('double[]', x)
+    except TypeError:
+        pass
+    return ffi.new('double[]', [ float(v) for v in x ])
+
+# A function evaluated on arrays of points, such as spectrum_monopole_batch.
+# Called with one array per argument of the scalar function; returns the list of
+# the values, or fills `out` (a writable buffer of doubles) and returns it.
+class BatchFunction:
+    def __init__(self, function):
+        self.function = Function(function)
+
+    def __call__(self, *args, out = None):
+        args = [ _doubles(x) for x in args ]
+        size = len(args[0])
+        for x in args:
+            if len(x) != size:
+                raise ValueError('epa.BatchFunction: arrays of different sizes')
+        if out is None:
+            result = ffi.new('double[]', size)
+        else:
+            result = ffi.from_buffer('double[]', out, require_writable = True)
+            if len(result) != size:
+                raise ValueError('epa.BatchFunction: wrong size of out')
+        self.function(size, *args, result)
+        if out is None:
+            return ffi.unpack(result, size)
+        return out
+
 def _lower(type, arg, handles):
     if isinstance(arg, Function):
         handles.append(arg)
@@ -249,6 +284,27 @@ def qag_integrator(
 def qag_integrator_generator(level):
     return _integrator_generator(qag_integrator, level)
 
+def gk_integrator(
+        absolute_error = None,
+        relative_error = None,
+        method         = None,
+        limit          = None
+):
+    if absolute_error is None:
+        absolute_error = get_default_absolute_error()
+    if relative_error is None:
+        relative_error = get_default_relative_error()
+    if method is None:
+        method = get_default_integration_method()
+    if limit is None:
+        limit = get_default_integration_limit()
+    return Function(
+            lib.epa_gk_integrator(absolute_error, relative_error, method, limit)
+    )
+
+def gk_integrator_generator(level):
+    return _integrator_generator(gk_integrator, level)
+
 def cquad_integrator(
         absolute_error = None,
         relative_error = None,
@@ -269,6 +325,56 @@ def cquad_integrator_generator(level):
 
 default_integrator = qag_integrator_generator
 
+class IntegrationProfile:
+    def __init__(self):
+        self.profile = ffi.gc(
+                lib.epa_make_integration_profile(),
+                lib.epa_destroy_integration_profile
+        )
+        if self.profile == ffi.NULL:
+            _fail()
+
+    def clear(self):
+        lib.epa_clear_integration_profile(self.profile)
+
+    # List of dicts with the keys site, level, calls, nevals, failures,
+    # limit_hits, max_abserr, max_relerr and time sorted by site and level
+    def entries(self):
+        report = lib.epa_integration_profile_entries(self.profile)
+        if report == ffi.NULL:
+            _fail()
+        report = ffi.gc(report, lib.epa_destroy_integration_report)
+        result = []
+        for i in range(lib.epa_integration_report_size(report)):
+            stats = lib.epa_integration_report_stats(report, i)
+            result.append({
+                'site':       ffi.string(
+                                  lib.epa_integration_report_site(report, i)
+                              ).decode(),
+                'level':      lib.epa_integration_report_level(report, i),
+                'calls':      stats.calls,
+                'nevals':     stats.nevals,
+                'failures':   stats.failures,
+                'limit_hits': stats.limit_hits,
+                'max_abserr': stats.max_abserr,
+                'max_relerr': stats.max_relerr,
+                'time':       stats.time
+            })
+        return result
+
+def profiled_integrator(integrator, level, profile):
+    handles = []
+    integrator = _lower('epa_integrator*', integrator, handles)
+    return Function(
+            lib.epa_profiled_integrator(integrator, level, profile.profile),
+            handles = handles
+    )
+
+def profiled_integrator_generator(generator, profile):
+    def generate(level):
+        return profiled_integrator(generator(level), level, profile)
+    return generate
+
 def form_factor_monopole(lambda2):
     return Function(lib.epa_form_factor_monopole(lambda2))
 
@@ -293,6 +399,12 @@ def spectrum_monopole(Z, gamma, lambda2):
 def spectrum_dipole(Z, gamma, lambda2):
     return Function(lib.epa_spectrum_dipole(Z, gamma, lambda2))
 
+def spectrum_monopole_batch(Z, gamma, lambda2):
+    return BatchFunction(lib.epa_spectrum_monopole_batch(Z, gamma, lambda2))
+
+def spectrum_dipole_batch(Z, gamma, lambda2):
+    return BatchFunction(lib.epa_spectrum_dipole_batch(Z, gamma, lambda2))
+
 def spectrum_b(Z, gamma, form_factor, integrator = None):
     return _spectrum(lib.epa_spectrum_b, Z, gamma, form_factor, integrator)
 
@@ -305,6 +417,15 @@ def spectrum_b_monopole(Z, gamma, lambda2):
 def spectrum_b_dipole(Z, gamma, lambda2):
     return Function(lib.epa_spectrum_b_dipole(Z, gamma, lambda2))
 
+def spectrum_b_point_batch(Z, gamma):
+    return BatchFunction(lib.epa_spectrum_b_point_batch(Z, gamma))
+
+def spectrum_b_monopole_batch(Z, gamma, lambda2):
+    return BatchFunction(lib.epa_spectrum_b_monopole_batch(Z, gamma, lambda2))
+
+def spectrum_b_dipole_batch(Z, gamma, lambda2):
+    return BatchFunction(lib.epa_spectrum_b_dipole_batch(Z, gamma, lambda2))
+
 def _luminosity(epa_luminosity, spectrum1, spectrum2, integrator):
     handles = []
     spectrum1, spectrum2 = _lower_spectra(
@@ -518,6 +639,25 @@ def proton_dipole_spectrum_b_Dirac(
 ):
     return Function(lib.epa_proton_dipole_spectrum_b_Dirac(energy, lambda2))
 
+def proton_dipole_spectrum_batch(
+        energy, lambda2 = proton_dipole_form_factor_lambda2
+):
+    return BatchFunction(lib.epa_proton_dipole_spectrum_batch(energy, lambda2))
+
+def proton_dipole_spectrum_Dirac_batch(
+        energy, lambda2 = proton_dipole_form_factor_lambda2
+):
+    return BatchFunction(
+            lib.epa_proton_dipole_spectrum_Dirac_batch(energy, lambda2)
+    )
+
+def proton_dipole_spectrum_b_Dirac_batch(
+        energy, lambda2 = proton_dipole_form_factor_lambda2
+):
+    return BatchFunction(
+            lib.epa_proton_dipole_spectrum_b_Dirac_batch(energy, lambda2)
+    )
+
 def pp_upc_probability(collision_energy):
     return Function(lib.epa_pp_upc_probability(collision_energy))
 
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
 #include <memory>
 #include <ostream>
 #include <stdexcept>
@@ -43,4 +47,160 @@ struct Function1d {
   void save(const std::filesystem::path&) const;
 };
 
+// Calls f(i) for i = 0 ... n-1 on `threads' threads (0 means
+// std::thread::hardware_concurrency()). The calling thread is one of the
+// workers. Each thread claims the next index with an atomic counter.
+// `generator' is called once in each thread to create f. If f throws, no more
+// indices are started, and the first exception is rethrown.
+void parallel_for(
+    size_t n,
+    unsigned threads,
+    const std::function<std::function<void (size_t)> ()>& generator
+);
+
+// Same with one function shared by all threads
+void parallel_for(
+    size_t n,
+    unsigned threads,
+    const std::function<void (size_t)>& f
+);
+
+// Counter-based random number generator Philox4x32-10 (J. K. Salmon, M. A.
+// Moraes, R. O. Dror, D. E. Shaw, SC '11): four random 32-bit words that
+// depend only on the counter and the key. Any point of a random stream can be
+// computed independently, so parallel calculations are reproducible
+// regardless of the number of threads.
+std::array<uint32_t, 4> philox(
+    std::array<uint32_t, 4> counter, std::array<uint32_t, 2> key
+);
+
+// Uniform random number in (0, 1) from two random 32-bit words
+inline double uniform(uint32_t high, uint32_t low) {
+  return ((uint64_t(high) << 21 | low >> 11) + 0.5) * 0x1p-53;
+};
+
+struct tabulate_keys {
+  // Number of threads to use. 0 means std::thread::hardware_concurrency().
+  unsigned threads = 0;
+
+  // Estimate of the time it takes to compute the function at x (in arbitrary
+  // units). Points are computed in the order of decreasing cost so that the
+  // expensive ones are not left for the end of the scan. If not provided,
+  // points are computed in the order of the grid.
+  std::function<double (double /* x */)> cost;
+
+  // Called after each point is computed. Calls are serialized.
+  std::function<
+    void (size_t /* done */, size_t /* total */, double /* x */, double /* f(x) */)
+  > progress;
+
+  // When set to true, no more points are started. The points being computed
+  // at that moment are finished.
+  const std::atomic<bool>* cancel = nullptr;
+};
+
+// Computes a function on a grid in parallel (see parallel_for) and returns
+// the result as Function1d. `generator' is called once in each thread to
+// create the function; use this variant when the function cannot be shared
+// between threads.
+//
+// If the calculation is cancelled, the result contains only the points that
+// were computed. If the function throws, the calculation is stopped and the
+// first exception is rethrown.
+Function1d tabulate(
+    const std::function<std::function<double (double)> ()>& generator,
+    std::vector<double> grid,
+    const tabulate_keys& = tabulate_keys()
+);
+
+// Same with one function shared by all threads
+Function1d tabulate(
+    const std::function<double (double)>&,
+    std::vector<double> grid,
+    const tabulate_keys& = tabulate_keys()
+);
+
+struct chebyshev_keys {
+  // Degree of the polynomials on each patch, from 2 to 24
+  unsigned degree = 8;
+
+  // Maximum number of times the range may be halved
+  unsigned max_depth = 20;
+
+  // Number of threads evaluating the function (see parallel_for). Unless it
+  // is 1, the function must be safe to call from several threads at once.
+  unsigned threads = 0;
+};
+
+// Piecewise approximation of a function of one variable on a segment by
+// Chebyshev polynomials. The segment is halved until the sum of the absolute
+// values of the two highest coefficients on each piece (the error estimate)
+// drops below `tolerance' or max_depth is reached. The pieces of each round of
+// halving are evaluated in parallel.
+//
+// Copies of the object share the coefficients.
+class Chebyshev1d {
+  public:
+    Chebyshev1d(
+        const std::function<double (double)>& f,
+        std::pair<double, double> range,
+        double tolerance,
+        const chebyshev_keys& = chebyshev_keys()
+    );
+
+    // Throws std::out_of_range outside of the segment
+    double operator()(double x) const;
+
+    bool contains(double x) const;
+
+    // The largest error estimate among the pieces
+    double error() const;
+
+    size_t patches() const;
+
+    // The number of evaluations of the function made by the constructor
+    size_t evaluations() const;
+
+  private:
+    struct Data;
+    std::shared_ptr<const Data> data;
+};
+
+// Piecewise approximation of a function of two variables on a rectangle by
+// tensor products of Chebyshev polynomials. The function is evaluated at the
+// Chebyshev nodes of a patch, and the patch is halved along the direction
+// where the polynomial converges worse until the sum of the absolute values of
+// the coefficients of the two highest orders (the error estimate) drops below
+// `tolerance' or max_depth is reached. The patches of each round of splitting
+// are evaluated in parallel.
+//
+// Copies of the object share the coefficients.
+class Chebyshev2d {
+  public:
+    Chebyshev2d(
+        const std::function<double (double, double)>& f,
+        std::pair<double, double> x_range,
+        std::pair<double, double> y_range,
+        double tolerance,
+        const chebyshev_keys& = chebyshev_keys()
+    );
+
+    // Throws std::out_of_range outside of the rectangle
+    double operator()(double x, double y) const;
+
+    bool contains(double x, double y) const;
+
+    // The largest error estimate among the patches
+    double error() const;
+
+    size_t patches() const;
+
+    // The number of evaluations of the function made by the constructor
+    size_t evaluations() const;
+
+  private:
+    struct Data;
+    std::shared_ptr<const Data> data;
+};
+
 }; // namespace epa
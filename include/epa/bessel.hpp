@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+
+// Modified Bessel functions used in the equivalent photon spectra. These are
+// faster replacements for the corresponding GSL functions (gsl.hpp): there is
+// no error handling, and the batch variants are written so that the compiler
+// can vectorize them (see the Makefile for the flags).
+//
+// K0, K1, I0 and I1 use the rational and polynomial approximations of
+// Boost.Math (Boost Software License 1.0,
+// https://www.boost.org/LICENSE_1_0.txt) for double precision.
+
+namespace epa {
+
+// The relative error is below 5e-16 for 0 < x <= 700. For x > 700 the
+// functions return 0 (as gsl::bessel_K0 and gsl::bessel_K1 do).
+double bessel_K0(double x);
+double bessel_K1(double x);
+
+struct BesselK01 {
+  double K0;
+  double K1;
+};
+
+// K0(x) and K1(x) at roughly the cost of one of them
+BesselK01 bessel_K01(double x);
+
+// Batch variants: y[i] = K(x[i]) for i = 0 .. n - 1
+void bessel_K0(size_t n, const double* x, double* y);
+void bessel_K1(size_t n, const double* x, double* y);
+
+// K0 and K1 at the same points at once, sharing the logarithm or the
+// exponent between the two
+void bessel_K01(size_t n, const double* x, double* k0, double* k1);
+
+// Scaled modified Bessel functions of the first kind exp(-x) I_n(x), x >= 0.
+// The relative error is below 1e-15.
+double bessel_I0_scaled(double x);
+double bessel_I1_scaled(double x);
+double bessel_I2_scaled(double x);
+
+struct BesselI012 {
+  double I0;
+  double I1;
+  double I2;
+};
+
+// exp(-x) I_n(x) for n = 0, 1, 2. I2 is obtained from I0 and I1 by the
+// recurrence except for small x, where it has its own series.
+BesselI012 bessel_I012_scaled(double x);
+
+// Scaled I0, I1, I2 at x and at 2x. 1 / x, sqrt(x) and exp(-x) are shared
+// between the two arguments.
+std::pair<BesselI012, BesselI012> bessel_I012_scaled_2x(double x);
+
+// Batch variant of bessel_I012_scaled
+void bessel_I012_scaled(
+    size_t n, const double* x, double* i0, double* i1, double* i2
+);
+
+}; // namespace epa
@@ -0,0 +1,490 @@
+#pragma once
+
+#include <epa/proton.hpp>
+#include <epa/quadpack.hpp>
+
+// Header-only counterparts of the built-in spectra, survival probabilities,
+// integrators and luminosities of epa.hpp and proton.hpp. The functions here
+// return closures of concrete types instead of std::function, and the
+// luminosities are templates over the types of the spectra and the
+// integrators, so that a whole chain such as
+//
+//   auto l = compose::luminosity_fid(
+//       compose::proton_dipole_spectrum(6500), compose::gk_integrator(0)
+//   );
+//
+// compiles into one integrand with the spectra inlined into it. The
+// std::function API is a thin wrapper around these templates, and the two can
+// be mixed: any Spectrum, Spectrum_b or Integrator may be passed where a
+// closure from this file is expected.
+
+namespace epa {
+namespace compose {
+
+// Integrators: integrate(f, a, b) for f of any type
+
+// GSL adaptive integrator (see epa::qag_integrator). f is passed to GSL
+// through a trampoline specialized for its type.
+inline auto qag_integrator(
+    double absolute_error,
+    double relative_error,
+    gsl::integration::QAGMethod method = default_integration_method,
+    size_t limit = default_integration_limit
+) {
+  return [=](const auto& f, double a, double b) -> double {
+    return gsl::integration::qag(
+        gsl::integration::make_function(f),
+        a,
+        b,
+        absolute_error,
+        relative_error,
+        limit,
+        method
+    ).result;
+  };
+};
+
+// Same with relative_error = default_relative_error * default_error_step **
+// level
+inline auto qag_integrator(unsigned level) {
+  return qag_integrator(
+      default_absolute_error,
+      default_relative_error * pow(default_error_step, level)
+  );
+};
+
+// Adaptive Gauss-Kronrod integrator of libepa (see epa::gk_integrator). f
+// is called directly by quadpack::qag.
+inline auto gk_integrator(
+    double absolute_error,
+    double relative_error,
+    gsl::integration::QAGMethod method = default_integration_method,
+    size_t limit = default_integration_limit
+) {
+  return [=](const auto& f, double a, double b) -> double {
+    return quadpack::qag(
+        f, a, b, absolute_error, relative_error, limit, method
+    ).result;
+  };
+};
+
+// Same with relative_error = default_relative_error * default_error_step **
+// level
+inline auto gk_integrator(unsigned level) {
+  return gk_integrator(
+      default_absolute_error,
+      default_relative_error * pow(default_error_step, level)
+  );
+};
+
+// Spectra
+
+// See epa::spectrum_monopole
+inline auto spectrum_monopole(unsigned Z, double gamma, double lambda2) {
+  double c = sqr(Z) * alpha / pi;
+  return [=](double w) -> double {
+    double x = sqr(w / gamma) / lambda2;
+//    if (x > 1.4e4) return 0; // prevent roundoff errors
+    return c / w * ((1 + 2 * x) * log(1 + 1. / x) - 2);
+  };
+};
+
+// See epa::spectrum_dipole
+inline auto spectrum_dipole(unsigned Z, double gamma, double lambda2) {
+  double c = sqr(Z) * alpha / pi;
+  return [=](double w) -> double {
+    double x = sqr(w / gamma) / lambda2;
+//    if (x > 200) return 0; // prevent roundoff errors
+    return c / w * (
+       (1 + 4 * x) * log(1 + 1. / x)
+       - ((24 * x + 42) * x + 17) / (6 * sqr(x + 1))
+    );
+  };
+};
+
+// See epa::spectrum_b_point
+inline auto spectrum_b_point(unsigned Z, double gamma) {
+  double c = alpha * sqr(Z / pi / gamma);
+  return [=](double b, double w) -> double {
+    EPA_TRY
+      return c * w * sqr(bessel_K1(b * w / gamma));
+    EPA_BACKTRACE(
+        "lambda (b, w) %e, %e\n  defined in epa::spectrum_b_point(%u, %e)",
+        b, w, Z, gamma
+    );
+  };
+};
+
+// x * K1(x) - 1 for small x
+// x K1(x) - 1 = (x/2)^2 (2 ln(x/2) + 2γ - 1) + (x/2)^4 (ln(x/2) + γ - 5/4)
+// where γ is the Euler constant
+inline double xk1_1(double x) {
+  const double euler = 0.5772156649015329;
+  double le = log(0.5 * x) + euler;
+  double x2 = x * x;
+  return x2 * (0.5 * (le - 0.5) + (0.0625 * x2 * (le - 1.25)));
+};
+
+// See epa::spectrum_b_monopole
+inline auto spectrum_b_monopole(unsigned Z, double gamma, double lambda2) {
+  double c = alpha * sqr(Z / pi);
+  return [=](double b, double w) -> double {
+    EPA_TRY
+      double wg = w / gamma;
+      double u = b * wg;
+      double a = lambda2 / sqr(wg);
+      double d;
+      if (a < 1e-6)
+        d = 0.5 * b * lambda2 * bessel_K0(u);
+      else {
+        double v = sqrt(b * b * lambda2 + sqr(u));
+        if (v < 1e-2)
+          d = xk1_1(u) - xk1_1(v);
+        else
+          d = u * bessel_K1(u) - v * bessel_K1(v);
+        d /= b;
+      };
+      return c / w * sqr(d);
+    EPA_BACKTRACE(
+        "lambda (b, w) %e, %e\n  defined in epa::spectrum_b_monopole(%u, %e, %e)",
+        b, w, Z, gamma, lambda2
+    );
+  };
+};
+
+// See epa::spectrum_b_dipole
+inline auto spectrum_b_dipole(unsigned Z, double gamma, double lambda2) {
+  double c = alpha * sqr(Z / pi);
+  return [=](double b, double w) -> double {
+    EPA_TRY
+      double wg = w / gamma;
+      double r = sqrt(lambda2 + sqr(wg));
+      auto k = bessel_K01(b*r);
+      return c / w * sqr(
+            wg * bessel_K1(b*wg)
+          - r * k.K1
+          - 0.5 * b * lambda2 * k.K0
+      );
+    EPA_BACKTRACE(
+        "lambda (b, w) %e, %e\n  defined in epa::spectrum_b_dipole(%u, %e, %e)",
+        b, w, Z, gamma, lambda2
+    );
+  };
+};
+
+// See epa::proton_dipole_spectrum
+inline auto proton_dipole_spectrum(
+    double energy, double lambda2 = proton_dipole_form_factor_lambda2
+) {
+  const double mu2m1 = sqr(proton_magnetic_moment) - 1;
+  double b = sqr(2 * proton_mass) / lambda2;
+
+  double b1 = b - 1;
+  double x  = mu2m1 / (b1 * b1 * b1);
+
+  double l0 = 4 - mu2m1 / b;
+  double l1 = x / b1;
+  double c0 = x * (11 + b * (-7   + 2   * b)) / 6 - 17. / 6;
+  double c1 = x * (5  + b * (-4.5 + 1.5 * b)) - 7;
+  double c2 = x * (3  + b * (-3   + b)) - 4;
+
+  double lg2 = lambda2 * sqr(energy / proton_mass);
+  return [=](double w) -> double {
+    double a = sqr(w) / lg2;
+    return (alpha / pi) / w * (
+          (1 + l0 * a) * log(1 + 1. / a)
+        - l1 * (1 + a / b) * log((a + b) / (a + 1))
+        + (c0 + a * (c1 + c2 * a)) / sqr(a + 1)
+    );
+  };
+};
+
+// See epa::proton_dipole_spectrum_Dirac
+inline auto proton_dipole_spectrum_Dirac(
+    double energy, double lambda2 = proton_dipole_form_factor_lambda2
+) {
+  double c = alpha / pi;
+  double b = sqr(2 * proton_mass) / lambda2;
+  const double mu = proton_magnetic_moment;
+  double l01 = 4 - 2 * (mu - 1) / b;
+  double l10;
+  double l11;
+  {
+    double c1 = (mu - 1) / pow(b - 1, 4);
+    double c2 = (mu - 1) / (b - 1);
+    l10 = c1 * (c2 * (1 + 3 * b) - 2);
+    l11 = c1 * (c2 * 4 - 2 / b);
+  };
+  double a0 = -17. / 6
+            + (mu - 1) * (2 * b * b - 7 * b + 11) / (3 * pow(b - 1, 3))
+            + sqr(mu - 1) * (b * b - 8 * b - 17) / (6 * pow(b - 1, 4));
+  double a1 = -7
+            + (mu - 1) * (3 * b * b - 9 * b + 10) / pow(b - 1, 3)
+            - sqr(mu - 1) * (b + 7) / pow(b - 1, 4);
+  double a2 = -4
+            + (mu - 1) * 2 * (b * b - 3 * b + 3) / pow(b - 1, 3)
+            - 4 * sqr(mu - 1) / pow(b - 1, 4);
+  double lg2 = lambda2 * sqr(energy / proton_mass);
+  return [=](double w) -> double {
+    double a = sqr(w) / lg2;
+    double n1 = (1 + l01 * a) * log(1 + 1. / a)
+              + (l10 + l11 * a) * log((a + b) / (a + 1));
+    double n2 = (a0 + a1 * a + a2 * a * a) / sqr(a + 1);
+    double n = n1 + n2;
+//    if (abs(n / n1) < 1e3 * a * std::numeric_limits<double>().epsilon()) return 0;
+    return c / w * n;
+  };
+};
+
+// See epa::proton_dipole_spectrum_b_Dirac
+inline auto proton_dipole_spectrum_b_Dirac(
+    double energy, double lambda2 = proton_dipole_form_factor_lambda2
+) {
+  double c = alpha / sqr(pi);
+  double m2 = sqr(2 * proton_mass);
+  double gamma = energy / proton_mass;
+  const double mu = proton_magnetic_moment;
+  double x = lambda2 / m2;
+  double k12 = (mu - 1) * sqr(x / (1 - x));
+  double k11 = 1 + k12;
+  double k00 = (1 - mu * x) / (1 - x) * lambda2 / 2;
+  return [=](double b, double w) -> double {
+    EPA_TRY
+      double wg = w / gamma;
+      double wg2 = sqr(wg);
+      double rl = sqrt(lambda2 + wg2);
+      double rm = sqrt(m2      + wg2);
+      auto kl = bessel_K01(b * rl);
+      return c / w * sqr(
+            wg * bessel_K1(b * wg)
+          - k11 * rl * kl.K1
+          + k12 * rm * bessel_K1(b * rm)
+          - k00 * b  * kl.K0
+      );
+    EPA_BACKTRACE(
+        "lambda (b, w) %e, %e\n  defined in proton_dipole_spectrum_b(%e, %e)",
+        b, w, energy, lambda2
+    );
+  };
+};
+
+// Survival probabilities
+
+// See epa::pp_upc_probability
+inline auto pp_upc_probability(double collision_energy) {
+  // see hep-ph/0608271
+  double B = 2 * pp_elastic_slope(collision_energy);
+  return [B](double b) -> double {
+    return sqr(1 - exp(-sqr(b) / B));
+  };
+};
+
+// Integral over the angle between b1 and b2 of the survival probability
+// weighted by the photons polarizations:
+//   \int_0^{2 pi} dphi upc(b) (parallel cos^2 phi + perpendicular sin^2 phi),
+//   b^2 = b1^2 + b2^2 - 2 b1 b2 cos phi
+template <typename UPC, typename Integrate>
+auto angular_integral(UPC upc, Integrate integrate) {
+  return [upc = std::move(upc), integrate = std::move(integrate)](
+      double b1, double b2, const Polarization& polarization
+  ) -> double {
+    IntegrationSite site("fphi");
+    return integrate(
+        [&](double phi) -> double {
+          EPA_TRY
+            double c = cos(phi);
+            double s = sin(phi);
+            return upc(sqrt(sqr(b1) + sqr(b2) - 2 * b1 * b2 * c))
+                 * (
+                     polarization.parallel * sqr(c)
+                   + polarization.perpendicular * sqr(s)
+                   );
+          EPA_BACKTRACE("lambda (phi) %e", phi);
+        },
+        0,
+        2 * pi
+    );
+  };
+};
+
+// Same in closed form for a sum of Gaussians. For upc = c exp(-a b^2) the
+// integrand is c exp(-a (b1^2 + b2^2)) exp(z cos phi) times the polarization
+// weights, z = 2 a b1 b2, and
+//   \int_0^{2 pi} dphi exp(z cos phi) cos^2 phi = pi (I0(z) + I2(z)),
+//   \int_0^{2 pi} dphi exp(z cos phi) sin^2 phi = pi (I0(z) - I2(z)).
+// The scaled Bessel functions absorb exp(z), leaving exp(-a (b1 - b2)^2).
+inline auto angular_integral(UPCProbability_Gaussians upc) {
+  for (auto& g: upc)
+    if (!(g.a >= 0))
+      throw std::invalid_argument(
+          "epa::luminosity_b: the exponents of UPCProbability_Gaussians must "
+          "be non-negative"
+      );
+
+  return [upc = std::move(upc)](
+      double b1, double b2, const Polarization& polarization
+  ) -> double {
+    double sum        = polarization.parallel + polarization.perpendicular;
+    double difference = polarization.parallel - polarization.perpendicular;
+    double result = 0;
+    for (auto& g: upc) {
+      if (g.a == 0) {
+        result += g.c * sum;
+        continue;
+      };
+      auto i = bessel_I012_scaled(2 * g.a * b1 * b2);
+      result += g.c * exp(-g.a * sqr(b1 - b2)) * (sum * i.I0 + difference * i.I2);
+    };
+    return pi * result;
+  };
+};
+
+// Luminosities
+
+// See epa::luminosity_y
+template <typename SpectrumA, typename SpectrumB>
+auto luminosity_y(SpectrumA nA, SpectrumB nB) {
+  return [nA = std::move(nA), nB = std::move(nB)]
+         (double rs, double y) -> double {
+    EPA_TRY
+      double E = 0.5 * rs;
+      double x = exp(y);
+      return E * nA(E * x) * nB(E / x);
+    EPA_BACKTRACE(
+        "lambda (rs, y) %e, %e\n  defined in epa::luminosity_y", rs, y
+    );
+  };
+};
+
+template <typename Spectrum>
+auto luminosity_y(Spectrum n) {
+  return luminosity_y(n, n);
+};
+
+// See epa::luminosity_fid
+template <typename SpectrumA, typename SpectrumB, typename Integrate>
+auto luminosity_fid(SpectrumA nA, SpectrumB nB, Integrate integrate) {
+  auto fx = [nA = std::move(nA), nB = std::move(nB)](double E, double x)
+            -> double {
+    EPA_TRY
+      double rx = sqrt(x);
+      return nA(E * rx) * nB(E / rx) / x;
+    EPA_BACKTRACE("lambda (x) %e; y = %e", x, 0.5 * log(x));
+  };
+
+  return [fx = std::move(fx), integrate = std::move(integrate)](
+      double rs, double y_min, double y_max
+  ) -> double {
+    EPA_TRY
+      double E = 0.5 * rs;
+      IntegrationSite site("fx");
+      return 0.25 * rs * integrate(
+          [&](double x) -> double { return fx(E, x); },
+          exp(2 * y_min),
+          exp(2 * y_max)
+      );
+    EPA_BACKTRACE(
+        "lambda (rs, y_min, y_max) %e, %e, %e\n  defined in epa::luminosity_fid",
+        rs, y_min, y_max
+    );
+  };
+};
+
+// when nA == nB, the integral over symmetric rapidity ranges is halved
+template <typename Spectrum, typename Integrate>
+auto luminosity_fid(Spectrum n, Integrate integrate) {
+  return [l = luminosity_fid(n, n, std::move(integrate))](
+      double rs, double y_min, double y_max
+  ) -> double {
+    return y_min == -y_max ? 2 * l(rs, y_min, 0) : l(rs, y_min, y_max);
+  };
+};
+
+// See epa::luminosity
+template <typename SpectrumA, typename SpectrumB, typename Integrate>
+auto luminosity(SpectrumA nA, SpectrumB nB, Integrate integrate) {
+  return [l = luminosity_fid(std::move(nA), std::move(nB), std::move(integrate))](
+      double rs
+  ) -> double {
+    return l(rs, -infinity, infinity);
+  };
+};
+
+template <typename Spectrum, typename Integrate>
+auto luminosity(Spectrum n, Integrate integrate) {
+  return [l = luminosity_fid(n, n, std::move(integrate))](double rs) -> double {
+    return 2 * l(rs, -infinity, 0);
+  };
+};
+
+// See epa::luminosity_y_b. angular(b1, b2, polarization) is the angular
+// integral of the survival probability (see angular_integral); integrate_b1
+// and integrate_b2 integrate over the impact parameters of the two particles.
+template <
+  typename SpectrumA,
+  typename SpectrumB,
+  typename Angular,
+  typename Integrate_b1,
+  typename Integrate_b2
+>
+auto luminosity_y_b(
+    SpectrumA nA,
+    SpectrumB nB,
+    Angular angular,
+    Integrate_b1 integrate_b1,
+    Integrate_b2 integrate_b2
+) {
+  struct Env {
+    double E;
+    double rx;
+    double b1;
+    Polarization polarization;
+  };
+
+  auto fb2 = [
+    nA      = std::move(nA),
+    nB      = std::move(nB),
+    angular = std::move(angular)
+  ](const Env& env, double b2) -> double {
+    EPA_TRY
+      return b2
+             * nA(env.b1, env.E * env.rx)
+             * nB(b2, env.E / env.rx)
+             * angular(env.b1, b2, env.polarization);
+    EPA_BACKTRACE("lambda (b2) %e", b2);
+  };
+
+  auto fb1 = [fb2 = std::move(fb2), integrate = std::move(integrate_b2)](
+      Env env, double b1
+  ) -> double {
+    EPA_TRY
+      env.b1 = b1;
+      IntegrationSite site("fb2");
+      return b1 * integrate(
+          [&](double b2) -> double { return fb2(env, b2); }, 0, infinity
+      );
+    EPA_BACKTRACE("lambda (b1) %e", b1);
+  };
+
+  return [fb1 = std::move(fb1), integrate = std::move(integrate_b1)](
+      double rs, double y, Polarization polarization
+  ) -> double {
+    EPA_TRY
+      Env env;
+      env.E = 0.5 * rs;
+      env.rx = exp(y);
+      env.polarization = polarization;
+      IntegrationSite site("fb1");
+      return env.E * pi / sqr(env.rx) * integrate(
+          [&](double b1) -> double { return fb1(env, b1); }, 0, infinity
+      );
+    EPA_BACKTRACE(
+        "lambda (rs, y, polarization) %e, %e, {%e, %e}\n"
+        "  defined in luminosity_y_b",
+        rs, y, polarization.parallel, polarization.perpendicular
+    );
+  };
+};
+
+}; // namespace compose
+}; // namespace epa
@@ -1,9 +1,16 @@
 #pragma once
 
+#include <atomic>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #include <epa/algorithms.hpp>
+#include <epa/bessel.hpp>
 #include <epa/gsl.hpp>
+#include <epa/integration.hpp>
 
 #define EPA_VERSION_MAJOR 1
 #define EPA_VERSION_MINOR 0
@@ -43,6 +50,7 @@ extern double default_relative_error;
 extern double default_error_step;
 extern size_t default_integration_limit;
 extern size_t default_cquad_integration_limit;
+extern size_t default_cubature_max_evaluations;
 extern gsl::integration::QAGMethod default_integration_method;
 
 // Function: f, a, b -> integral of f from a to b
@@ -53,7 +61,11 @@ typedef std::function<
 // Default integrator generator
 extern std::function<Integrator (unsigned)> default_integrator;
 
-// GSL quadratic adaptive integrator with default initialization
+// GSL quadratic adaptive integrator with default initialization. If workspace
+// is nullptr, each call takes a workspace from the pool local to the calling
+// thread (see gsl::integration::PooledWorkspace), and the integrator can be
+// used from several threads at once. Otherwise the workspace is shared by all
+// the calls and the integrator must not be called concurrently.
 Integrator qag_integrator(
     double absolute_error = default_absolute_error,
     double relative_error = default_relative_error,
@@ -83,7 +95,74 @@ qag_integrator_generator(
     double error_step     = default_error_step
 );
 
-// GSL CQUAD integrator with default initialization
+// Adaptive Gauss-Kronrod integrator implemented in libepa (see
+// quadpack::qag). It gives the same results and throws the same errors as
+// qag_integrator, but does not go through GSL: there is no workspace, and the
+// integrator can be used from several threads at once.
+Integrator gk_integrator(
+    double absolute_error = default_absolute_error,
+    double relative_error = default_relative_error,
+    gsl::integration::QAGMethod = default_integration_method,
+    size_t limit = default_integration_limit
+);
+
+struct gk_integrator_keys {
+  double absolute_error = default_absolute_error;
+  double relative_error = default_relative_error;
+  gsl::integration::QAGMethod method = default_integration_method;
+  size_t limit = default_integration_limit;
+};
+
+// Helper function --- with keyword parameters
+Integrator gk_integrator(const gk_integrator_keys&);
+
+// Same with relative_error = default_relative_error * default_error_step **
+// level
+Integrator gk_integrator(unsigned level);
+
+// Integrator generator with absolute_error = 0, relative_error =
+// relative_error * error_step ** level
+std::function<Integrator (unsigned)>
+gk_integrator_generator(
+    double relative_error = default_relative_error,
+    double error_step     = default_error_step
+);
+
+// Double exponential integrator (see integration::double_exponential):
+// tanh-sinh on a finite range, exp-sinh on a semi-infinite one and sinh-sinh
+// on the whole axis. For smooth integrands, especially those with
+// exponential tails such as K1, it needs several times fewer evaluations
+// than the adaptive integrators; it also tolerates singularities at the
+// endpoints. It is not suited for integrands with kinks or peaks inside the
+// range.
+Integrator de_integrator(
+    double absolute_error = default_absolute_error,
+    double relative_error = default_relative_error,
+    unsigned max_level    = integration::de_max_level
+);
+
+struct de_integrator_keys {
+  double absolute_error = default_absolute_error;
+  double relative_error = default_relative_error;
+  unsigned max_level    = integration::de_max_level;
+};
+
+Integrator de_integrator(const de_integrator_keys&);
+
+// Double exponential integrator with relative_error = default_relative_error
+// * default_error_step ** level
+Integrator de_integrator(unsigned level);
+
+// Integrator generator with absolute_error = 0, relative_error =
+// relative_error * error_step ** level
+std::function<Integrator (unsigned)>
+de_integrator_generator(
+    double relative_error = default_relative_error,
+    double error_step     = default_error_step
+);
+
+// GSL CQUAD integrator with default initialization. See qag_integrator about
+// the workspace.
 Integrator cquad_integrator(
     double absolute_error = default_absolute_error,
     double relative_error = default_relative_error,
@@ -100,6 +179,157 @@ Integrator cquad_integrator(const cquad_integrator_keys&);
 
 Integrator cquad_integrator(unsigned level = 0);
 
+// Adaptive Gauss-Kronrod integrator evaluating the integrand on several threads
+// at once (see epa::integration::parallel_qag). The integrand must be safe to
+// call concurrently. The luminosities and spectra provided by the library are,
+// as long as their integrators are (the default ones are). threads = 0 means
+// std::thread::hardware_concurrency().
+Integrator parallel_integrator(
+    double absolute_error = default_absolute_error,
+    double relative_error = default_relative_error,
+    gsl::integration::QAGMethod = default_integration_method,
+    unsigned threads = 0
+);
+
+struct parallel_integrator_keys {
+  double absolute_error = default_absolute_error;
+  double relative_error = default_relative_error;
+  gsl::integration::QAGMethod method = default_integration_method;
+  unsigned threads = 0;
+};
+
+Integrator parallel_integrator(const parallel_integrator_keys&);
+
+// Integrator generator that returns parallel_integrator with relative_error =
+// default_relative_error * default_error_step ** level for the level
+// `parallel_level' and default_integrator for the other levels. Pass it to
+// luminosity_b, luminosity_fid_b, pp_luminosity_b etc. to split the outermost
+// (b1) integral of a single expensive point between threads.
+std::function<Integrator (unsigned)>
+parallel_integrator_generator(unsigned parallel_level = 0, unsigned threads = 0);
+
+// Integration statistics. Profiling is opt-in: wrap an integrator generator
+// with profiled_integrator_generator and pass the result where a generator is
+// expected, e.g.
+//
+//   auto profile = std::make_shared<IntegrationProfile>();
+//   auto l = luminosity_fid_b(
+//     n, n, upc, profiled_integrator_generator(default_integrator, profile)
+//   );
+//   l(rs, polarization, y_min, y_max);
+//   for (auto& entry: profile->entries()) ...
+//
+// The statistics are collected per integration level and per call site. The
+// call sites in libepa are named after their integrands: "fb1", "fb2", "fx"
+// (the impact parameter and rapidity integrals in luminosity_fid,
+// luminosity_y_b, luminosity_fid_b and their ppx_ variants), "fphi" (the
+// angular integral of the survival probability), "fpT" (the transverse
+// momentum integral in xsection_fid and xsection_fid_b) and "iqt" (the
+// transverse momentum integral in spectrum and spectrum_b).
+struct IntegrationStats {
+  size_t calls      = 0; // number of integrals computed
+  size_t nevals     = 0; // number of integrand evaluations
+  size_t failures   = 0; // number of integrals that threw an exception
+  size_t limit_hits = 0; // failures due to the subdivision or level limit
+  double max_abserr = 0; // largest error estimate reported by the integrator
+  double max_relerr = 0; // largest ratio of the error estimate to the result
+  double time       = 0; // wall time, s, including the nested integrals
+
+  IntegrationStats& operator+=(const IntegrationStats&);
+};
+
+class IntegrationProfile {
+  public:
+    struct Entry {
+      std::string      site;  // empty for unnamed call sites
+      unsigned         level;
+      IntegrationStats stats;
+    };
+
+    void add(const char* site, unsigned level, const IntegrationStats&);
+
+    // Statistics sorted by call site and level
+    std::vector<Entry> entries() const;
+
+    void clear();
+
+    // Human-readable table of entries()
+    std::string report() const;
+
+  private:
+    mutable std::mutex mutex;
+    std::map<std::pair<std::string, unsigned>, IntegrationStats> stats;
+};
+
+// Sets the name of the integrals computed in its scope by profiled integrators.
+// Integrals in the integrand are not affected: each call site has to name
+// itself, otherwise it is recorded with an empty name.
+class IntegrationSite {
+  public:
+    explicit IntegrationSite(const char* name);
+    ~IntegrationSite();
+
+    IntegrationSite(const IntegrationSite&) = delete;
+    IntegrationSite& operator=(const IntegrationSite&) = delete;
+
+    static const char* current();
+
+  private:
+    const char* previous;
+};
+
+// Integrator that records the statistics of integrate into profile under the
+// given level. Error estimates are available for the integrators provided by
+// the library (qag, gk, de, cquad and parallel); for the other integrators
+// max_abserr and max_relerr stay zero.
+Integrator profiled_integrator(
+    Integrator integrate,
+    unsigned level,
+    std::shared_ptr<IntegrationProfile> profile
+);
+
+// Integrator generator that wraps the integrators of generator in
+// profiled_integrator
+std::function<Integrator (unsigned)>
+profiled_integrator_generator(
+    std::function<Integrator (unsigned)> generator,
+    std::shared_ptr<IntegrationProfile> profile
+);
+
+// Function: f, a, b -> integral of f from a to b, where f is evaluated on
+// batches of points (see integration::Batch_function)
+typedef std::function<
+          double (const integration::Batch_function&, double, double)
+        > Integrator_batch;
+
+// Adaptive Gauss-Kronrod integrator of batched integrands that takes the same
+// steps as qag_integrator (see integration::qag). Each application of the
+// rule evaluates the integrand on all of its nodes (15 to 61, depending on the
+// method) in a single call.
+Integrator_batch batch_integrator(
+    double absolute_error = default_absolute_error,
+    double relative_error = default_relative_error,
+    gsl::integration::QAGMethod = default_integration_method
+);
+
+struct batch_integrator_keys {
+  double absolute_error = default_absolute_error;
+  double relative_error = default_relative_error;
+  gsl::integration::QAGMethod method = default_integration_method;
+};
+
+Integrator_batch batch_integrator(const batch_integrator_keys&);
+
+// Batch integrator with relative_error = default_relative_error *
+// default_error_step ** level
+Integrator_batch batch_integrator(unsigned level);
+
+extern std::function<Integrator_batch (unsigned)> default_batch_integrator;
+
+// Integrator that evaluates the integrand with a batch integrator point by
+// point
+Integrator scalar_integrator(Integrator_batch);
+
 // Integrator that takes one extra parameter: the value of the integral
 // calculated so far. It can be used to avoid extra work in calculations that
 // don't need that much accuracy. This kind of integrator is currently used in
@@ -126,6 +356,171 @@ Integrator_I qag_integrator_i(unsigned level = 0);
 
 extern std::function<Integrator_I (unsigned)> default_integrator_i;
 
+// Function: f, b -> integral of f(q) J1(b q) dq from 0 to infinity. This is
+// the integral that defines the spectra in the impact parameter space.
+typedef std::function<
+          double (const std::function<double (double)>&, double)
+        > Integrator_Hankel;
+
+// Ogata's quadrature for the Hankel transform (see integration::hankel). It
+// needs no special treatment of the oscillations of J1 and works for form
+// factors that fall slowly or not at all. Throws gsl::Error with GSL_EMAXITER
+// if f varies on scales much smaller than 1 / b and the step cannot be made
+// small enough. The result cannot be more accurate than 1e-16 times the
+// integral of the absolute value of the integrand; for exponentially small
+// transforms (b w / gamma >> 1) it is dominated by rounding errors.
+Integrator_Hankel ogata_integrator(
+    double absolute_error = default_absolute_error,
+    double relative_error = default_relative_error,
+    unsigned max_level    = integration::ogata_max_level
+);
+
+struct ogata_integrator_keys {
+  double absolute_error = default_absolute_error;
+  double relative_error = default_relative_error;
+  unsigned max_level    = integration::ogata_max_level;
+};
+
+Integrator_Hankel ogata_integrator(const ogata_integrator_keys&);
+
+// Ogata integrator with relative_error = default_relative_error *
+// default_error_step ** level
+Integrator_Hankel ogata_integrator(unsigned level);
+
+// Hankel transform by integration between the zeros of J1 and summation of
+// the partial integrals with series acceleration (see
+// integration::hankel_tail). Needs fewer evaluations than ogata_integrator
+// when f falls slowly or not at all, and tolerates kinks in f.
+Integrator_Hankel oscillatory_integrator(
+    double absolute_error = default_absolute_error,
+    double relative_error = default_relative_error,
+    gsl::integration::QAGMethod = default_integration_method,
+    size_t max_terms = 200
+);
+
+struct oscillatory_integrator_keys {
+  double absolute_error = default_absolute_error;
+  double relative_error = default_relative_error;
+  gsl::integration::QAGMethod method = default_integration_method;
+  size_t max_terms = 200;
+};
+
+Integrator_Hankel oscillatory_integrator(const oscillatory_integrator_keys&);
+
+// Oscillatory integrator with relative_error = default_relative_error *
+// default_error_step ** level
+Integrator_Hankel oscillatory_integrator(unsigned level);
+
+extern std::function<Integrator_Hankel (unsigned)> default_integrator_hankel;
+
+// Function: f, a, b -> integral of f over the box [a_1, b_1] x ... x [a_n,
+// b_n]
+typedef std::function<
+          double (
+              const integration::Function_nd&,
+              const std::vector<double>&,
+              const std::vector<double>&
+          )
+        > Cubature;
+
+// Adaptive Genz-Malik cubature (see integration::cubature). The error target
+// is global: unlike nested one-dimensional integrators, the inner integrals
+// are not computed to a higher precision than the total requires. If
+// evaluations is not nullptr, the number of integrand evaluations of each call
+// is added to it.
+Cubature hcubature_integrator(
+    double absolute_error  = default_absolute_error,
+    double relative_error  = default_relative_error,
+    size_t max_evaluations = default_cubature_max_evaluations,
+    std::atomic<size_t>* evaluations = nullptr
+);
+
+struct hcubature_integrator_keys {
+  double absolute_error  = default_absolute_error;
+  double relative_error  = default_relative_error;
+  size_t max_evaluations = default_cubature_max_evaluations;
+  std::atomic<size_t>* evaluations = nullptr;
+};
+
+Cubature hcubature_integrator(const hcubature_integrator_keys&);
+
+// Cubature integrator with relative_error = default_relative_error *
+// default_error_step ** level
+Cubature hcubature_integrator(unsigned level);
+
+// VEGAS Monte Carlo integrator (see integration::vegas) with the error target
+// of one standard deviation. It is suitable for integrals of higher dimension
+// than hcubature_integrator, e.g. the fiducial cross sections. The result is
+// reproducible for a given seed. Unless threads = 1, the integrand is
+// evaluated from several threads at once. If evaluations is not nullptr, the
+// number of integrand evaluations of each call is added to it.
+Cubature vegas_integrator(
+    double absolute_error    = default_absolute_error,
+    double relative_error    = default_relative_error,
+    size_t calls             = 100000, // per iteration
+    unsigned max_iterations  = 50,
+    uint64_t seed            = 0,
+    unsigned threads         = 0,
+    std::atomic<size_t>* evaluations = nullptr
+);
+
+struct vegas_integrator_keys {
+  double absolute_error    = default_absolute_error;
+  double relative_error    = default_relative_error;
+  size_t calls             = 100000;
+  unsigned max_iterations  = 50;
+  uint64_t seed            = 0;
+  unsigned threads         = 0;
+  std::atomic<size_t>* evaluations = nullptr;
+};
+
+Cubature vegas_integrator(const vegas_integrator_keys&);
+
+// VEGAS integrator with relative_error = default_relative_error *
+// default_error_step ** level
+Cubature vegas_integrator(unsigned level);
+
+// Randomized quasi-Monte Carlo integrator (see integration::qmc) with the
+// error target of one standard error of the replicas. For smooth integrands
+// it converges much faster than vegas_integrator. Its mapping of the infinite
+// ranges of b suits the b-space luminosities: luminosity_y_b is integrated
+// with about three times fewer evaluations than with vegas_integrator at
+// 1e-3, and qmc still converges at 1e-4 where vegas does not. It does not
+// adapt to the integrand, though: in luminosity_fid_b the integrand falls as
+// 1 / x in x = exp(2 y), and qmc needs about three times more evaluations
+// than vegas_integrator. `points' is the initial number of points of the
+// Sobol sequence for each of the `replicas' random shifts.
+// Unless threads = 1, the integrand is evaluated from several threads at
+// once. If evaluations is not nullptr, the number of integrand evaluations of
+// each call is added to it.
+Cubature qmc_integrator(
+    double absolute_error  = default_absolute_error,
+    double relative_error  = default_relative_error,
+    size_t points          = 4096,
+    unsigned replicas      = 16,
+    size_t max_evaluations = default_cubature_max_evaluations,
+    uint64_t seed          = 0,
+    unsigned threads       = 0,
+    std::atomic<size_t>* evaluations = nullptr
+);
+
+struct qmc_integrator_keys {
+  double absolute_error  = default_absolute_error;
+  double relative_error  = default_relative_error;
+  size_t points          = 4096;
+  unsigned replicas      = 16;
+  size_t max_evaluations = default_cubature_max_evaluations;
+  uint64_t seed          = 0;
+  unsigned threads       = 0;
+  std::atomic<size_t>* evaluations = nullptr;
+};
+
+Cubature qmc_integrator(const qmc_integrator_keys&);
+
+// QMC integrator with relative_error = default_relative_error *
+// default_error_step ** level
+Cubature qmc_integrator(unsigned level);
+
 // Electromagnetic form factor of a particle. Q2 is the photon 3-momentum
 // squared
 typedef std::function<double (double /* Q2 */)> FormFactor;
@@ -153,6 +548,17 @@ Spectrum spectrum_monopole(unsigned Z, double gamma, double lambda2);
 // EPA spectrum for dipole form factor with the parameter lambda^2
 Spectrum spectrum_dipole(unsigned Z, double gamma, double lambda2);
 
+// Spectrum evaluated on an array of photon energies: n[i] = spectrum(w[i]) for
+// i = 0 .. size - 1. The batch variants of the built-in spectra give the same
+// values as the scalar ones and are written so that the compiler can vectorize
+// them (see bessel.hpp).
+typedef std::function<
+          void (size_t /* size */, const double* /* w */, double* /* n */)
+        > Spectrum_batch;
+
+Spectrum_batch spectrum_monopole_batch(unsigned Z, double gamma, double lambda2);
+Spectrum_batch spectrum_dipole_batch  (unsigned Z, double gamma, double lambda2);
+
 // Equivalent photon spectrum at distance b from the source particle in the
 // transversal plane. w is the photon energy
 typedef std::function<double (double /* b */, double /* w */)> Spectrum_b;
@@ -164,12 +570,44 @@ typedef std::function<double (double /* b */, double /* w */)> Spectrum_b;
 // Note that the form factor is weighted with an oscillating function (the
 // Bessel function J1) and integrated over semi-infinite interval. Unless the
 // form factor falls very rapidly, this integration is very difficult to
-// perform numerically. Take care with the default quadrature integrator.
+// perform numerically. Take care with the quadrature integrator.
+Spectrum_b spectrum_b(unsigned Z, double gamma, FormFactor, Integrator);
+
+// Same with the integral over the transverse momentum done as a Hankel
+// transform. This is the default and is much faster and more reliable than
+// general purpose integrators.
 Spectrum_b spectrum_b(
     unsigned Z,
     double gamma,
     FormFactor,
-    Integrator = default_integrator(0)
+    Integrator_Hankel = default_integrator_hankel(0)
+);
+
+struct spectrum_b_grid_keys {
+  // Number of points of the grid in log(qt) per unit
+  double density = 32;
+
+  // The grid in qt extends until the integrand falls below cutoff times its
+  // largest value
+  double cutoff = 1e-10;
+};
+
+// Values of spectrum_b(Z, gamma, form_factor) at all the points of b_grid for
+// a fixed w. The integral over qt is calculated for all b at once with a fast
+// Hankel transform (see integration::fftlog) and interpolated to b_grid. The
+// form factor must fall at large Q2. The points of b_grid must be positive
+// and need not be sorted.
+//
+// The error of sqrt(n) is about 1e-7 of its largest value over the grid, so
+// the spectrum is not resolved where it is exponentially small (b w / gamma
+// >> 1).
+std::vector<double> spectrum_b_grid(
+    unsigned Z,
+    double gamma,
+    FormFactor,
+    double w,
+    const std::vector<double>& b_grid,
+    const spectrum_b_grid_keys& = spectrum_b_grid_keys()
 );
 
 // EPA spectrum for point-like particle
@@ -181,6 +619,23 @@ Spectrum_b spectrum_b_monopole(unsigned Z, double gamma, double lambda2);
 // EPA spectrum for dipole form factor
 Spectrum_b spectrum_b_dipole(unsigned Z, double gamma, double lambda2);
 
+// Spectrum_b evaluated on arrays of points: n[i] = spectrum_b(b[i], w[i]) for
+// i = 0 .. size - 1
+typedef std::function<
+          void (
+            size_t /* size */, const double* /* b */, const double* /* w */,
+            double* /* n */
+          )
+        > Spectrum_b_batch;
+
+// Batch variants of spectrum_b_point, spectrum_b_monopole and
+// spectrum_b_dipole
+Spectrum_b_batch spectrum_b_point_batch(unsigned Z, double gamma);
+Spectrum_b_batch
+spectrum_b_monopole_batch(unsigned Z, double gamma, double lambda2);
+Spectrum_b_batch
+spectrum_b_dipole_batch(unsigned Z, double gamma, double lambda2);
+
 // EPA spectrum for form factor given by Function1d as a set of points (q2, ff)
 // for 0 <= q2 <= q2_max. "g" stands for "global": the form factor is integrated
 // from 0 to q2_max as a regular function of one variable,
@@ -198,6 +653,11 @@ Spectrum_b spectrum_b_dipole(unsigned Z, double gamma, double lambda2);
 // b_max: for b > b_max > 0, assume that the source particle is point-like and
 // use spectrum_b_pointlike.
 //
+// hankel: if rest_form_factor is given and rest_spectrum is not, the integral
+// of rest_form_factor from q2_max to infinity is calculated as its Hankel
+// transform minus the integral from 0 to q2_max. Pass nullptr to integrate
+// from q2_max to infinity directly.
+//
 // This function uses slightly different integration interface:
 // integrate parameters are:
 //   the function to integrate
@@ -214,7 +674,8 @@ spectrum_b_function1d_g(
     FormFactor rest_form_factor = FormFactor(),
     Spectrum_b rest_spectrum    = Spectrum_b(),
     double b_max = 0,
-    Integrator_I = default_integrator_i(0)
+    Integrator_I = default_integrator_i(0),
+    Integrator_Hankel hankel = default_integrator_hankel(0)
 );
 
 // EPA spectrum for form factor given by Function1d as a set of points (q2, ff)
@@ -231,7 +692,8 @@ spectrum_b_function1d_s(
     FormFactor rest_form_factor = FormFactor(),
     Spectrum_b rest_spectrum    = Spectrum_b(),
     double b_max = 0,
-    Integrator_I = default_integrator_i(0)
+    Integrator_I = default_integrator_i(0),
+    Integrator_Hankel hankel = default_integrator_hankel(0)
 );
 
 // EPA spectrum for form factor given by Function1d as a set of points (q2, ff)
@@ -245,7 +707,56 @@ spectrum_b_function1d(
     FormFactor rest_form_factor = FormFactor(),
     Spectrum_b rest_spectrum    = Spectrum_b(),
     double b_max = 0,
-    Integrator_I = default_integrator_i(0)
+    Integrator_I = default_integrator_i(0),
+    Integrator_Hankel hankel = default_integrator_hankel(0)
+);
+
+struct tabulate_spectrum_keys {
+  // see chebyshev_keys
+  unsigned degree    = 8;
+  unsigned max_depth = 20;
+  unsigned threads   = 0;
+
+  // The table ends where the spectrum falls below cutoff, and the returned
+  // function is 0 beyond
+  double cutoff = 1e-100;
+
+  // If not nullptr, receives the estimate of the largest relative error of
+  // the table
+  double* error = nullptr;
+};
+
+// Tabulates the spectrum on w_range so that it can be evaluated cheaply in
+// luminosity integrals; useful for spectra that integrate over the form factor
+// at every point, such as those made by spectrum(). log(n) is approximated by
+// piecewise Chebyshev polynomials in log(w) (see Chebyshev1d) to the relative
+// error `tolerance'. Outside of w_range the returned function calls the
+// spectrum. The spectrum must fall with w where it reaches keys.cutoff. See
+// tabulate_spectrum_b for the notes on threads.
+Spectrum
+tabulate_spectrum(
+    Spectrum,
+    std::pair<double, double> w_range,
+    double tolerance = default_relative_error,
+    const tabulate_spectrum_keys& = tabulate_spectrum_keys()
+);
+
+// Tabulates the spectrum on b_range x w_range so that it can be evaluated
+// cheaply in luminosity integrals. log(n) is approximated by piecewise
+// Chebyshev polynomials in log(b) and log(w) (see Chebyshev2d) to the relative
+// error `tolerance'. Outside of the ranges the returned function calls the
+// spectrum. The spectrum must fall with b and w where it reaches keys.cutoff,
+// as the b-space spectra do at b w >> gamma; the table is cut along that
+// curve. The spectrum is called in parallel during tabulation unless
+// keys.threads = 1; the spectra provided by the library allow it as long as
+// their integrators do (the default ones do).
+Spectrum_b
+tabulate_spectrum_b(
+    Spectrum_b,
+    std::pair<double, double> b_range,
+    std::pair<double, double> w_range,
+    double tolerance = default_relative_error,
+    const tabulate_spectrum_keys& = tabulate_spectrum_keys()
 );
 
 // Photon-photon luminosity with non-electromagnetic interactions neglected
@@ -302,6 +813,10 @@ typedef std::function<
 // Photon-photon luminosity in ultraperipheral collisions of particles with EPA
 // spectra nA and nB and the probability to survive upc_probability(b) where b
 // is the impact parameter of the collision.
+//
+// The returned function keeps the integration variables on the stack of the
+// call, so it can be evaluated from several threads at once provided that the
+// spectra, upc_probability and the integrators can.
 Luminosity_b
 luminosity_b(
     Spectrum_b nA,
@@ -320,6 +835,108 @@ luminosity_b(
     unsigned integration_level = 0
 );
 
+// Survival probability written as a sum of Gaussians in the impact parameter,
+// upc_probability(b) = sum_i c_i exp(-a_i b^2), a_i >= 0 (a_i = 0 makes a
+// constant term). For example, pp_upc_probability is {{1, 0}, {-2, 1 / B},
+// {1, 2 / B}} with B = 2 pp_elastic_slope.
+struct Gaussian {
+  double c;
+  double a;
+};
+typedef std::vector<Gaussian> UPCProbability_Gaussians;
+
+// The survival probability as a function of b
+std::function<double (double)> upc_probability(UPCProbability_Gaussians);
+
+// Integrals over the angle phi between the impact parameters b1 and b2 of the
+// colliding particles of the survival probability weighted for the photons
+// polarizations:
+//   parallel      = \int_0^{2 pi} dphi upc_probability(b) cos^2 phi,
+//   perpendicular = \int_0^{2 pi} dphi upc_probability(b) sin^2 phi,
+//   b^2 = b1^2 + b2^2 - 2 b1 b2 cos phi.
+// These are all the luminosity integrals need of the survival probability.
+typedef std::function<Polarization (double /* b1 */, double /* b2 */)>
+        UPCProbability_Angular;
+
+struct tabulate_upc_probability_keys {
+  // see chebyshev_keys
+  unsigned degree    = 8;
+  unsigned max_depth = 20;
+  unsigned threads   = 0;
+
+  // Integrator over phi, used for tabulation and outside of b_range
+  Integrator integrator = default_integrator(2);
+
+  // If not nullptr, receives the estimate of the largest absolute error of
+  // the table
+  double* error = nullptr;
+};
+
+// Tabulates the angular integrals of the survival probability on b_range x
+// b_range by piecewise Chebyshev polynomials in log(b1) and log(b2) (see
+// Chebyshev2d) to the absolute error pi * tolerance. They do not depend on
+// the photons energies, so the table can be shared by the luminosities at all
+// sqrt(s) and y. Outside of b_range the returned function integrates over
+// phi. See tabulate_spectrum_b for the notes on threads.
+UPCProbability_Angular
+tabulate_upc_probability(
+    std::function<double (double)> upc_probability,
+    std::pair<double, double> b_range,
+    double tolerance = default_relative_error,
+    const tabulate_upc_probability_keys& = tabulate_upc_probability_keys()
+);
+
+// Same as above with the angular integrals of the survival probability
+// precomputed, e.g. by tabulate_upc_probability
+Luminosity_b
+luminosity_b(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    UPCProbability_Angular upc_probability,
+    const std::function<Integrator (unsigned)>& = default_integrator,
+    unsigned integration_level = 0
+);
+
+// when nA == nB
+Luminosity_b
+luminosity_b(
+    Spectrum_b,
+    UPCProbability_Angular upc_probability,
+    const std::function<Integrator (unsigned)>& = default_integrator,
+    unsigned integration_level = 0
+);
+
+// The angular integrals of the survival probability computed by integrate
+// at each call
+UPCProbability_Angular
+upc_probability_angular(
+    std::function<double (double)> upc_probability,
+    Integrator integrate = default_integrator(2)
+);
+
+// Same as above with the survival probability given as a sum of Gaussians.
+// The integral over the angle between b1 and b2 is then computed in closed
+// form with the modified Bessel functions I0 and I2 for both polarizations,
+// leaving the two-dimensional integral over b1 and b2 (three-dimensional for
+// luminosity_fid_b).
+Luminosity_b
+luminosity_b(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    UPCProbability_Gaussians upc_probability,
+    const std::function<Integrator (unsigned)>& = default_integrator,
+    unsigned integration_level = 0
+);
+
+// when nA == nB
+Luminosity_b
+luminosity_b(
+    Spectrum_b,
+    UPCProbability_Gaussians upc_probability,
+    const std::function<Integrator (unsigned)>& = default_integrator,
+    unsigned integration_level = 0
+);
+
 // differentiated with respect to rapidity of the system
 Luminosity_y_b
 luminosity_y_b(
@@ -339,6 +956,111 @@ luminosity_y_b(
     unsigned integration_level = 0
 );
 
+// The angular integrals of a sum of Gaussians in closed form (see
+// luminosity_b)
+UPCProbability_Angular upc_probability_angular(UPCProbability_Gaussians);
+
+// with the survival probability given as a sum of Gaussians (see
+// luminosity_b)
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    UPCProbability_Gaussians upc_probability,
+    const std::function<Integrator (unsigned)>& = default_integrator,
+    unsigned integration_level = 0
+);
+
+// when nA == nB
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b,
+    UPCProbability_Gaussians upc_probability,
+    const std::function<Integrator (unsigned)>& = default_integrator,
+    unsigned integration_level = 0
+);
+
+// with the angular integrals of the survival probability precomputed (see
+// luminosity_b)
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    UPCProbability_Angular upc_probability,
+    const std::function<Integrator (unsigned)>& = default_integrator,
+    unsigned integration_level = 0
+);
+
+// when nA == nB
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b,
+    UPCProbability_Angular upc_probability,
+    const std::function<Integrator (unsigned)>& = default_integrator,
+    unsigned integration_level = 0
+);
+
+// Same with batch spectra and batch integrators (see Integrator_batch): each
+// application of a rule over b1 or b2 evaluates the spectrum on all of its
+// nodes in a single call
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b_batch nA,
+    Spectrum_b_batch nB,
+    UPCProbability_Gaussians upc_probability,
+    const std::function<Integrator_batch (unsigned)>&
+      = default_batch_integrator,
+    unsigned integration_level = 0
+);
+
+// when nA == nB
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b_batch,
+    UPCProbability_Gaussians upc_probability,
+    const std::function<Integrator_batch (unsigned)>&
+      = default_batch_integrator,
+    unsigned integration_level = 0
+);
+
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b_batch nA,
+    Spectrum_b_batch nB,
+    UPCProbability_Angular upc_probability,
+    const std::function<Integrator_batch (unsigned)>&
+      = default_batch_integrator,
+    unsigned integration_level = 0
+);
+
+// when nA == nB
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b_batch,
+    UPCProbability_Angular upc_probability,
+    const std::function<Integrator_batch (unsigned)>&
+      = default_batch_integrator,
+    unsigned integration_level = 0
+);
+
+// Same computed as a single three-dimensional integral over b1, b2 and the
+// angle between them instead of the nested one-dimensional integrals
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    std::function<double (double)> upc_probability,
+    Cubature
+);
+
+// when nA == nB
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b,
+    std::function<double (double)> upc_probability,
+    Cubature
+);
+
 // for calculating fiducial cross section
 Luminosity_fid_b
 luminosity_fid_b(
@@ -358,6 +1080,106 @@ luminosity_fid_b(
     unsigned integration_level = 0
 );
 
+// with the survival probability given as a sum of Gaussians (see
+// luminosity_b)
+Luminosity_fid_b
+luminosity_fid_b(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    UPCProbability_Gaussians upc_probability,
+    const std::function<Integrator (unsigned)>& = default_integrator,
+    unsigned integration_level = 0
+);
+
+// when nA == nB
+Luminosity_fid_b
+luminosity_fid_b(
+    Spectrum_b,
+    UPCProbability_Gaussians upc_probability,
+    const std::function<Integrator (unsigned)>& = default_integrator,
+    unsigned integration_level = 0
+);
+
+// with the angular integrals of the survival probability precomputed (see
+// luminosity_b)
+Luminosity_fid_b
+luminosity_fid_b(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    UPCProbability_Angular upc_probability,
+    const std::function<Integrator (unsigned)>& = default_integrator,
+    unsigned integration_level = 0
+);
+
+// when nA == nB
+Luminosity_fid_b
+luminosity_fid_b(
+    Spectrum_b,
+    UPCProbability_Angular upc_probability,
+    const std::function<Integrator (unsigned)>& = default_integrator,
+    unsigned integration_level = 0
+);
+
+// Same computed as a single four-dimensional integral over b1, b2, the angle
+// between them and the photon energy ratio
+Luminosity_fid_b
+luminosity_fid_b(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    std::function<double (double)> upc_probability,
+    Cubature
+);
+
+// when nA == nB
+Luminosity_fid_b
+luminosity_fid_b(
+    Spectrum_b,
+    std::function<double (double)> upc_probability,
+    Cubature
+);
+
+struct luminosity_b_scan_keys {
+  // The range of the impact parameters b1 and b2 (GeV^-1); the spectra are
+  // neglected outside of it
+  std::pair<double, double> b_range = { 1e-2, 1e9 };
+
+  // The number of equal panels in log(b) with the Gauss-Kronrod rule `method'
+  // on each
+  unsigned b_panels = 40;
+  gsl::integration::QAGMethod method = gsl::integration::GAUSS21;
+
+  // The step of the grid in the logarithm of the photon energy
+  double log_w_step = 0.05;
+
+  // see parallel_for
+  unsigned threads = 0;
+};
+
+// Luminosity computed by luminosity_fid_b at all the points of rs_grid at
+// once, with the polarization weights `polarization' and the rapidity of the
+// photon-photon system in [y_min, y_max] (both must be finite; the spectra
+// usually make the luminosity negligible at |y| > log(2 E / sqrt(s)), where E
+// is the energy of the colliding particles). The impact parameters are
+// integrated with a fixed rule in log(b) and the photons energies on a fixed
+// grid in log(w) shared by all the points, so that the spectra and the angular
+// integrals of the survival probability (see UPCProbability_Angular) are
+// computed once for the whole scan, and each additional point costs much
+// less than a call of the luminosity. The error estimate of each point is
+// the sum of the differences with the Gauss rule in log(b) and with twice
+// the step in log(w). The spectra and upc are called from several threads at
+// once unless keys.threads = 1.
+std::vector<integration::Result>
+luminosity_b_scan(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    UPCProbability_Angular upc,
+    const std::vector<double>& rs_grid,
+    Polarization polarization,
+    double y_min,
+    double y_max,
+    const luminosity_b_scan_keys& = luminosity_b_scan_keys()
+);
+
 // Cross section differentiated with respect to invariant mass, d \sigma / d
 // \sqrt{s}. Note that cross sections which are not differentiated with respect
 // to sqrt{s}, take s as a parameter.
@@ -509,6 +1331,28 @@ xsection_fid_b(
   );
 };
 
+// Same computed as a single five-dimensional integral over the transverse
+// momentum, the rapidity of the pair, the impact parameters b1, b2 and the
+// angle between them, for particles with EPA spectra nA and nB and the
+// probability to survive upc_probability(b) (cf. luminosity_fid_b). Use with
+// vegas_integrator; hcubature_integrator works as well, but converges slowly
+// in five dimensions.
+XSection
+xsection_fid_b(
+    std::function<Polarization (double /* sqrt(s) */, double /* pT */)> xsection_pT,
+    Spectrum_b nA,
+    Spectrum_b nB,
+    std::function<double (double)> upc_probability,
+    double mass,
+    double pT_min,
+    double eta_max,
+    double w1_min,
+    double w1_max,
+    double w2_min,
+    double w2_max,
+    Cubature
+);
+
 // Cross section for the production of a pair of fermions in photon-photon
 // collisions (the Breit-Wheeler cross section). `mass' and `charge' are the
 // fermion mass and charge.
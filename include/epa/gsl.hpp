@@ -2,11 +2,15 @@
 
 #include <gsl/gsl_integration.h>
 #include <gsl/gsl_sf_bessel.h>
+#include <gsl/gsl_sum.h>
 
+#include <complex>
 #include <functional>
+#include <memory>
 #include <utility>
 #include <stdexcept>
 #include <limits>
+#include <vector>
 
 namespace gsl {
 
@@ -40,8 +44,30 @@ inline double bessel_K1(double x) {
   return gsl_sf_bessel_K1(x);
 };
 
+// log(Gamma(z)) for complex z. The imaginary part is the phase of Gamma(z) in
+// (-pi, pi].
+std::complex<double> lngamma(std::complex<double> z);
+
+// Discrete Fourier transform in place: x[k] = sum_j x[j] exp(-2 pi i j k / n).
+// The size n must be a power of 2.
+void fft(std::vector<std::complex<double>>& x);
+
 void init();
 
+namespace sum {
+
+struct LevinResult {
+  double sum;
+  double abserr;
+  size_t terms_used;
+};
+
+// Sum of the series with the given terms accelerated with the Levin
+// u-transform (gsl_sum_levin_u_accel)
+LevinResult levin_u(const std::vector<double>& terms);
+
+}; // namespace sum
+
 namespace integration {
 
 class QAGWorkspace {
@@ -66,6 +92,56 @@ class QAGWorkspace {
     size_t limit_;
 };
 
+// A workspace taken from the pool local to the calling thread. The workspace
+// is returned to the pool when the object is destroyed. Nested integrations
+// on the same thread receive distinct workspaces, and new workspaces are
+// allocated only when the pool of the thread runs out of ones with a
+// sufficient limit, so that no locking and no allocation per call are needed.
+template <typename Workspace>
+class PooledWorkspace {
+  public:
+    PooledWorkspace(size_t limit) {
+      Pool& pool = pool_();
+      for (auto i = pool.free.rbegin(); i != pool.free.rend(); ++i)
+        if ((*i)->limit() >= limit) {
+          workspace = std::move(*i);
+          pool.free.erase(std::next(i).base());
+          ++pool.used;
+          return;
+        };
+      // make sure that the destructor won't need to allocate memory
+      pool.free.reserve(pool.free.size() + pool.used + 1);
+      workspace = std::make_unique<Workspace>(limit);
+      ++pool.used;
+    };
+
+    PooledWorkspace(const PooledWorkspace&) = delete;
+    PooledWorkspace& operator=(const PooledWorkspace&) = delete;
+
+    ~PooledWorkspace() {
+      Pool& pool = pool_();
+      --pool.used;
+      pool.free.push_back(std::move(workspace));
+    };
+
+    const Workspace& operator*() const {
+      return *workspace;
+    };
+
+  private:
+    struct Pool {
+      std::vector<std::unique_ptr<Workspace>> free;
+      size_t used = 0;
+    };
+
+    static Pool& pool_() {
+      thread_local Pool pool;
+      return pool;
+    };
+
+    std::unique_ptr<Workspace> workspace;
+};
+
 enum QAGMethod {
   GAUSS15 = GSL_INTEG_GAUSS15,
   GAUSS21 = GSL_INTEG_GAUSS21,
@@ -80,6 +156,21 @@ struct QAGResult {
   double abserr;
 };
 
+struct QKResult {
+  double result;
+  double abserr;
+  double resabs; // integral of abs(f)
+  double resasc; // integral of abs(f - mean(f))
+};
+
+// Single application of the Gauss-Kronrod rule to [a, b] (no adaptation)
+QKResult qk(
+    const std::function<double (double)>& f,
+    double a,
+    double b,
+    QAGMethod
+);
+
 // Unified interface for quadrature integration (qag, qagiu, qagil, qagi). Pass
 // the infinity constant to integrate to infinity.
 QAGResult qag(
@@ -93,6 +184,125 @@ QAGResult qag(
     const QAGWorkspace&
 );
 
+// Same using a workspace from the pool of the calling thread
+QAGResult qag(
+    const std::function<double (double)>& f,
+    double a,
+    double b,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    QAGMethod
+);
+
+// gsl_function calling f of any type through a trampoline specialized for
+// that type, so that f can be inlined into it. f must outlive the result.
+template <typename F>
+gsl_function make_function(const F& f) {
+  gsl_function result;
+  result.function = [](double x, void* data) -> double {
+    return (*static_cast<const F*>(data))(x);
+  };
+  result.params = const_cast<F*>(&f);
+  return result;
+};
+
+// Same as above for the integrand given as gsl_function (see make_function)
+QAGResult qag(
+    const gsl_function& f,
+    double a,
+    double b,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    QAGMethod,
+    const QAGWorkspace&
+);
+
+QAGResult qag(
+    const gsl_function& f,
+    double a,
+    double b,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    QAGMethod
+);
+
+enum QAWOWeight {
+  COSINE = GSL_INTEG_COSINE,
+  SINE   = GSL_INTEG_SINE
+};
+
+// Table of Chebyshev moments for the weight cos(omega x) or sin(omega x) on
+// an interval of length L and its n successive bisections (see
+// gsl_integration_qawo_table_alloc). The table is modified by qawf, so it
+// should not be shared between threads.
+class QAWOTable {
+  public:
+    QAWOTable(double omega, double L, QAWOWeight, size_t n = 20);
+    QAWOTable(const QAWOTable&) = delete;
+    QAWOTable(QAWOTable&&);
+    ~QAWOTable();
+
+    QAWOTable& operator=(const QAWOTable&) = delete;
+
+    // Changes the parameters of the table without reallocation
+    void set(double omega, double L, QAWOWeight);
+
+    gsl_integration_qawo_table* get() const {
+      return table;
+    };
+
+  private:
+    gsl_integration_qawo_table* table;
+};
+
+// Integral of f(x) cos(omega x) or f(x) sin(omega x) from a to a + L, where
+// omega, L and the weight are those of the table
+QAGResult qawo(
+    const std::function<double (double)>& f,
+    double a,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    const QAWOTable&,
+    const QAGWorkspace&
+);
+
+// Same using a workspace from the pool of the calling thread
+QAGResult qawo(
+    const std::function<double (double)>& f,
+    double a,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    const QAWOTable&
+);
+
+// Fourier integral of f(x) cos(omega x) or f(x) sin(omega x) from a to
+// infinity. The integral is summed over the periods with the epsilon
+// algorithm. GSL uses only the absolute error here. The length of the table is
+// changed.
+QAGResult qawf(
+    const std::function<double (double)>& f,
+    double a,
+    double epsabs,
+    size_t limit,
+    const QAWOTable&,
+    const QAGWorkspace& workspace,
+    const QAGWorkspace& cycle_workspace
+);
+
+// Same using workspaces from the pool of the calling thread
+QAGResult qawf(
+    const std::function<double (double)>& f,
+    double a,
+    double epsabs,
+    size_t limit,
+    const QAWOTable&
+);
+
 class CQuadWorkspace {
   public:
     CQuadWorkspace(size_t limit = 1000);
@@ -130,8 +340,21 @@ CQuadResult cquad(
     const CQuadWorkspace&
 );
 
+// Same using a workspace from the pool of the calling thread
+CQuadResult cquad(
+    const std::function<double (double)>& f,
+    double a,
+    double b,
+    double epsabs,
+    double epsrel,
+    size_t limit
+);
+
 }; // namespace integration
 
-const auto integrate = integration::qag;
+template <typename... Args>
+inline integration::QAGResult integrate(Args&&... args) {
+  return integration::qag(std::forward<Args>(args)...);
+};
 
 }; // namespace gsl
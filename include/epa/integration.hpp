@@ -0,0 +1,306 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <epa/gsl.hpp>
+
+// Integration algorithms implemented in libepa (as opposed to the GSL
+// wrappers in gsl.hpp)
+
+namespace epa {
+
+namespace integration {
+
+struct Result {
+  double result;
+  double abserr;
+  size_t nevals; // number of integrand evaluations
+};
+
+// Integrand evaluated on a batch of points at once: fx[i] = f(x[i]) for
+// i = 0 .. n - 1. This allows the integrand to amortize the cost of the call
+// and to vectorize the evaluation.
+typedef std::function<void (size_t n, const double* x, double* fx)>
+        Batch_function;
+
+// Gauss-Kronrod rule on [-1, 1] with n Gauss nodes and 2n + 1 Kronrod nodes.
+// The Kronrod nodes are listed in ascending order; the Gauss weights of the
+// nodes that belong to the Kronrod extension only are zero.
+struct GaussKronrod {
+  unsigned n;
+  std::vector<double> x;  // nodes
+  std::vector<double> wk; // Kronrod weights
+  std::vector<double> wg; // Gauss weights
+};
+
+// The rule used by GSL for the method: GAUSS15 is the 7-point Gauss rule with
+// its 15-point Kronrod extension, etc. The nodes and weights are those of the
+// QUADPACK tables (quadpack::QK).
+const GaussKronrod& gauss_kronrod(gsl::integration::QAGMethod);
+
+// Apply the Gauss-Kronrod rule to f on [a, b], evaluating f on all the nodes
+// in a single call (quadpack::qk_batch). The result and the error estimate
+// are those of QUADPACK (and GSL).
+gsl::integration::QKResult qk(
+    const Batch_function& f,
+    double a,
+    double b,
+    gsl::integration::QAGMethod
+);
+
+// quadpack::qag for a batched integrand: the same steps, the same error
+// estimates and the same error codes as gsl::integration::qag, with the rule
+// evaluated on all its nodes in a single call. Infinite ranges are
+// integrated with extrapolation and the 15-point rule after the change of
+// variables x = (1 - t) / t, as in QAGI, QAGIU and QAGIL.
+Result qag(
+    const Batch_function& f,
+    double a,
+    double b,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    gsl::integration::QAGMethod
+);
+
+// The loop of quadpack::qag in which at each step the `threads' intervals
+// with the largest error estimates are bisected at once, and the integrand is
+// evaluated on them in parallel. The roundoff tests are applied to the
+// interval with the largest error, as in QUADPACK; the error codes are those
+// of quadpack::qag_finite. Infinite ranges are mapped onto (0, 1] with
+// x = (1 - t) / t as in QAGI, QAGIU and QAGIL, but integrated without
+// extrapolation. The result does not depend on thread scheduling, only on the
+// number of threads, and with one thread it is that of quadpack::qag_finite.
+// threads = 0 means std::thread::hardware_concurrency().
+//
+// The integrand must be safe to call from several threads at once.
+Result parallel_qag(
+    const std::function<double (double)>& f,
+    double a,
+    double b,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    gsl::integration::QAGMethod,
+    unsigned threads = 0
+);
+
+// Ogata's quadrature formula for integrals of f(x) J1(x) from 0 to infinity
+// (T. Ogata, Publ. RIMS Kyoto Univ. 41 (2005) 949):
+//   integral = sum_k w_k f(x_k).
+// The nodes are the zeros of J1 moved by a double exponential transformation
+// with the step h = 0.1 / 2^level; for large k they approach the zeros double
+// exponentially fast, so the sum converges even if f does not decay. The nodes
+// and weights are computed on demand and shared by all calls.
+const unsigned ogata_max_level = 14;
+
+// Integral of f(q) J1(b q) dq from 0 to infinity (b > 0) by Ogata's formula.
+// Starting from level 0, h is halved until the results for two successive
+// steps agree within epsabs or epsrel, or within the rounding error of the
+// sum. The sum is cut short once the terms become negligible compared to
+// epsrel times the result. Throws gsl::Error with GSL_EMAXITER if there is no
+// convergence at level max_level.
+Result hankel(
+    const std::function<double (double)>& f,
+    double b,
+    double epsabs,
+    double epsrel,
+    unsigned max_level = ogata_max_level
+);
+
+// Integral of f(q) J1(b q) dq from a to infinity (b > 0, a >= 0). The range
+// is split at the zeros of J1(b q); the integrals between successive zeros
+// are computed with gsl::integration::qag and summed with the Levin
+// u-transform (gsl::sum::levin_u) until two successive accelerated sums agree
+// within epsabs or epsrel. The summation stops early if the terms become
+// negligible. Unlike hankel, this works for any a and does not require f to
+// be smooth; for slowly decaying f it usually needs tens of times fewer
+// evaluations of f.
+// Throws gsl::Error with GSL_EMAXITER if there is no convergence after
+// max_terms half-periods.
+Result hankel_tail(
+    const std::function<double (double)>& f,
+    double b,
+    double a,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    gsl::integration::QAGMethod,
+    size_t max_terms = 200
+);
+
+// Double exponential quadrature (H. Takahashi, M. Mori, Publ. RIMS Kyoto
+// Univ. 9 (1974) 721): the integral is mapped onto t in (-infinity,
+// infinity) by a change of variables x(t) after which the integrand decays
+// double exponentially in t, and is computed by the trapezoidal rule with the
+// step h = 1 / 2^level. Each level adds the nodes halfway between those of
+// the previous one, so all the evaluations of f are reused. The range of t is
+// cut where the terms of the level 0 sum become negligible or stop being
+// finite (non-finite terms at higher levels are skipped). Starting from
+// level 1, h is halved until the results for two successive steps agree
+// within epsabs or epsrel, or within the rounding error of the sum. Throws
+// gsl::Error with GSL_EMAXITER if there is no convergence at level max_level.
+// The nodes and weights are computed on the first call and shared by all
+// calls. f is never evaluated at the endpoints, so it may be singular there.
+const unsigned de_max_level = 10;
+
+// Integral of f from a to b (finite) with x = tanh(pi/2 sinh(t))
+Result tanh_sinh(
+    const std::function<double (double)>& f,
+    double a,
+    double b,
+    double epsabs,
+    double epsrel,
+    unsigned max_level = de_max_level
+);
+
+// Integral of f from a to infinity with x = a + exp(pi/2 sinh(t)). f must
+// decay at infinity; exponential tails such as exp(-x) or K1(x) are handled
+// best.
+Result exp_sinh(
+    const std::function<double (double)>& f,
+    double a,
+    double epsabs,
+    double epsrel,
+    unsigned max_level = de_max_level
+);
+
+// Integral of f from -infinity to infinity with x = sinh(pi/2 sinh(t))
+Result sinh_sinh(
+    const std::function<double (double)>& f,
+    double epsabs,
+    double epsrel,
+    unsigned max_level = de_max_level
+);
+
+// Integral of f from a to b by tanh_sinh, exp_sinh or sinh_sinh depending on
+// which of a and b are infinite
+Result double_exponential(
+    const std::function<double (double)>& f,
+    double a,
+    double b,
+    double epsabs,
+    double epsrel,
+    unsigned max_level = de_max_level
+);
+
+// Integrand of several variables: x points to an array of dim values
+typedef std::function<double (const double* x)> Function_nd;
+
+// Number of integrand evaluations per application of the Genz-Malik rule in
+// dim dimensions
+size_t genz_malik_points(unsigned dim);
+
+// Adaptive cubature over the box [a_1, b_1] x ... x [a_n, b_n], n >= 2, with
+// the degree 7 rule of Genz and Malik and its embedded degree 5 rule for the
+// error estimate (A. C. Genz, A. A. Malik, J. Comput. Appl. Math. 6 (1980)
+// 295; the same scheme as in S. G. Johnson's hcubature). The box with the
+// largest error estimate is bisected along the axis where the integrand has
+// the largest fourth difference until the total error satisfies epsabs or
+// epsrel. Infinite bounds are allowed: the variable is mapped onto a finite
+// interval as in QAGI, QAGIU and QAGIL. Throws gsl::Error with GSL_EMAXITER
+// if the tolerance is not reached within max_evals evaluations of f.
+Result cubature(
+    const Function_nd& f,
+    const std::vector<double>& a,
+    const std::vector<double>& b,
+    double epsabs,
+    double epsrel,
+    size_t max_evals
+);
+
+// Result of a Monte Carlo integration: abserr is the standard deviation of the
+// estimate, chi2 is chi^2 per degree of freedom of the estimates of the
+// individual iterations (it should not be much larger than 1)
+struct MonteCarloResult {
+  double   result;
+  double   abserr;
+  size_t   nevals;
+  double   chi2;
+  unsigned iterations;
+};
+
+// Adaptive Monte Carlo integration over the box [a_1, b_1] x ... x [a_n, b_n]
+// by the VEGAS algorithm (G. P. Lepage, J. Comput. Phys. 27 (1978) 192).
+// Infinite bounds are mapped as in cubature. The box is divided into
+// hypercubes for stratified sampling, and each coordinate is importance
+// sampled on a grid that is refined after each iteration of `calls'
+// evaluations. The estimates of the iterations are averaged with their
+// inverse variances as weights until the standard deviation satisfies epsabs
+// or epsrel (at least two iterations are made).
+//
+// The random numbers are drawn from Philox (see algorithms.hpp) keyed by the
+// seed and indexed by the iteration, the hypercube and the point, so the
+// result depends only on the seed. The hypercubes are sampled in chunks on
+// `threads' threads (0 means std::thread::hardware_concurrency()); the
+// integrand must be safe to call from several threads at once unless threads
+// = 1. Throws gsl::Error with GSL_EMAXITER if the tolerance is not reached
+// within max_iterations, and std::invalid_argument if n > 2^17,
+// max_iterations > 2^16 or calls >= 2^32 (the counter of Philox has no room
+// for more).
+MonteCarloResult vegas(
+    const Function_nd& f,
+    const std::vector<double>& a,
+    const std::vector<double>& b,
+    double epsabs,
+    double epsrel,
+    size_t calls,
+    unsigned max_iterations,
+    uint64_t seed = 0,
+    unsigned threads = 0
+);
+
+// Largest dimension supported by qmc
+const unsigned sobol_max_dim = 16;
+
+// Randomized quasi-Monte Carlo integration over the box [a_1, b_1] x ... x
+// [a_n, b_n] with the Sobol sequence (direction numbers of S. Joe and F. Y.
+// Kuo, SIAM J. Sci. Comput. 30 (2008) 2635). The first `points' points of the
+// sequence (rounded up to a power of 2) are taken with `replicas'
+// independent random digital shifts (XOR of the coordinates with random
+// bits); the spread of the replica estimates gives the standard error. The
+// number of points is doubled, reusing the previous ones, until the error
+// satisfies epsabs or epsrel. For smooth integrands the error falls almost
+// as 1 / N. A doubly infinite range is mapped as in cubature, and a
+// semi-infinite one by x - a = ((1 - t) / t)^2 (or b - x), so that log(x -
+// a) is proportional to the logit of 1 - t: an integrand that falls as 1 / x
+// over several decades varies only slowly with t.
+//
+// The points are generated in chunks that are evaluated on `threads' threads
+// (0 means std::thread::hardware_concurrency()); the integrand must be safe
+// to call from several threads at once unless threads = 1. The shifts are
+// drawn from Philox keyed by the seed, and the result does not depend on the
+// number of threads. Throws gsl::Error with GSL_EMAXITER if the tolerance is
+// not reached within max_evals evaluations of f.
+Result qmc(
+    const Function_nd& f,
+    const std::vector<double>& a,
+    const std::vector<double>& b,
+    double epsabs,
+    double epsrel,
+    size_t points,
+    unsigned replicas,
+    size_t max_evals,
+    uint64_t seed = 0,
+    unsigned threads = 0
+);
+
+// Fast Hankel transform of order one by the FFTLog algorithm (A. J. S.
+// Hamilton, MNRAS 312 (2000) 257). f holds the values of a function on the
+// logarithmic grid q_j = q0 exp(j dln), j = 0 .. n - 1, where n is a power of
+// 2. The function is treated as periodic in log(q), so it must be negligible
+// at both ends of the grid. The result is the integral of f(q) J1(b q) dq from
+// 0 to infinity on the grid b_j = b0 exp(j dln). b0 q_{n-1} is within
+// exp(dln / 2) of 1 and is chosen to reduce ringing.
+struct FFTLog {
+  double b0;
+  std::vector<double> result;
+};
+
+FFTLog fftlog(const std::vector<double>& f, double q0, double dln);
+
+}; // namespace integration
+
+}; // namespace epa
@@ -44,6 +44,23 @@ proton_dipole_spectrum_b_Dirac(
     double lambda2 = proton_dipole_form_factor_lambda2
 );
 
+// Batch variants of the above (see Spectrum_batch)
+Spectrum_batch
+proton_dipole_spectrum_batch(
+    double energy,
+    double lambda2 = proton_dipole_form_factor_lambda2
+);
+Spectrum_batch
+proton_dipole_spectrum_Dirac_batch(
+    double energy,
+    double lambda2 = proton_dipole_form_factor_lambda2
+);
+Spectrum_b_batch
+proton_dipole_spectrum_b_Dirac_batch(
+    double energy,
+    double lambda2 = proton_dipole_form_factor_lambda2
+);
+
 // The slope of the cross section for elastic scattering of two protons
 // (parameter B in [1112.3243])
 double pp_elastic_slope(double collision_energy);
@@ -53,6 +70,10 @@ double pp_elastic_slope(double collision_energy);
 std::function<double (double /* b */)>
 pp_upc_probability(double collision_energy);
 
+// Same as a sum of Gaussians for the closed-form angular integration in
+// luminosity_b, luminosity_y_b and luminosity_fid_b
+UPCProbability_Gaussians pp_upc_probability_Gaussians(double collision_energy);
+
 // Photon-photon luminosity in ultraperipheral proton-proton collisions with
 // non-electromagnetic interactions neglected
 Luminosity     pp_luminosity(
@@ -0,0 +1,1239 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+#include <gsl/gsl_errno.h>
+
+#include <epa/integration.hpp>
+
+// Adaptive Gauss-Kronrod integration after QUADPACK (R. Piessens et al.,
+// Springer, 1983) as implemented in GSL: qag and qags here follow
+// gsl_integration_qag and gsl_integration_qags step by step, with the same
+// tolerances, the same roundoff and singularity tests and the same error
+// codes. Unlike gsl::integration::qag, the integrand is a template parameter
+// and is called directly, so it can be inlined into the quadrature rule, and
+// there is no GSL workspace: the list of intervals lives on the stack while
+// it is small and moves to the heap only when it grows past
+// quadpack::stack_intervals.
+
+namespace epa {
+namespace quadpack {
+
+// Number of intervals kept on the stack
+const size_t stack_intervals = 64;
+
+// QUADPACK error estimate of a Gauss-Kronrod rule: err is the difference
+// between the Kronrod and the Gauss results, resabs and resasc are the
+// integrals of abs(f) and abs(f - mean(f)).
+inline double rescale_error(double err, double resabs, double resasc) {
+  err = std::abs(err);
+  if (resasc != 0 && err != 0)
+    err = resasc * std::min(1., pow(200 * err / resasc, 1.5));
+  double eps = std::numeric_limits<double>::epsilon();
+  if (resabs > std::numeric_limits<double>::min() / (50 * eps))
+    err = std::max(err, 50 * eps * resabs);
+  return err;
+};
+
+// The Gauss-Kronrod rules of QUADPACK (qk15 .. qk61) with m Gauss nodes:
+// xgk are the 2 m + 1 nodes on [-1, 1] from the edge to the center (the
+// nodes below the center are -xgk), wgk are their Kronrod weights, and wg
+// are the Gauss weights of the Gauss nodes xgk[1], xgk[3], ...
+template <unsigned m> struct QK;
+
+template <> struct QK<7> {
+  static constexpr double xgk[8] = {
+    0.991455371120812639206854697526329,
+    0.949107912342758524526189684047851,
+    0.864864423359769072789712788640926,
+    0.741531185599394439863864773280788,
+    0.586087235467691130294144838258730,
+    0.405845151377397166906606412076961,
+    0.207784955007898467600689403773245,
+    0.000000000000000000000000000000000
+  };
+  static constexpr double wgk[8] = {
+    0.022935322010529224963732008058970,
+    0.063092092629978553290700663189204,
+    0.104790010322250183839876322541518,
+    0.140653259715525918745189590510238,
+    0.169004726639267902826583426598550,
+    0.190350578064785409913256402421014,
+    0.204432940075298892414161999234649,
+    0.209482141084727828012999174891714
+  };
+  static constexpr double wg[4] = {
+    0.129484966168869693270611432679082,
+    0.279705391489276667901467771423780,
+    0.381830050505118944950369775488975,
+    0.417959183673469387755102040816327
+  };
+};
+
+template <> struct QK<10> {
+  static constexpr double xgk[11] = {
+    0.995657163025808080735527280689003,
+    0.973906528517171720077964012084452,
+    0.930157491355708226001207180059508,
+    0.865063366688984510732096688423493,
+    0.780817726586416897063717578345042,
+    0.679409568299024406234327365114874,
+    0.562757134668604683339000099272694,
+    0.433395394129247190799265943165784,
+    0.294392862701460198131126603103866,
+    0.148874338981631210884826001129720,
+    0.000000000000000000000000000000000
+  };
+  static constexpr double wgk[11] = {
+    0.011694638867371874278064396062192,
+    0.032558162307964727478818972459390,
+    0.054755896574351996031381300244580,
+    0.075039674810919952767043140916190,
+    0.093125454583697605535065465083366,
+    0.109387158802297641899210590325805,
+    0.123491976262065851077958109831074,
+    0.134709217311473325928054001771707,
+    0.142775938577060080797094273138717,
+    0.147739104901338491374841515972068,
+    0.149445554002916905664936468389821
+  };
+  static constexpr double wg[5] = {
+    0.066671344308688137593568809893332,
+    0.149451349150580593145776339657697,
+    0.219086362515982043995534934228163,
+    0.269266719309996355091226921569469,
+    0.295524224714752870173892994651338
+  };
+};
+
+template <> struct QK<15> {
+  static constexpr double xgk[16] = {
+    0.998002298693397060285172840152271,
+    0.987992518020485428489565718586613,
+    0.967739075679139134257347978784337,
+    0.937273392400705904307758947710209,
+    0.897264532344081900882509656454496,
+    0.848206583410427216200648320774217,
+    0.790418501442465932967649294817947,
+    0.724417731360170047416186054613938,
+    0.650996741297416970533735895313275,
+    0.570972172608538847537226737253911,
+    0.485081863640239680693655740232351,
+    0.394151347077563369897207370981045,
+    0.299180007153168812166780024266389,
+    0.201194093997434522300628303394596,
+    0.101142066918717499027074231447392,
+    0.000000000000000000000000000000000
+  };
+  static constexpr double wgk[16] = {
+    0.005377479872923348987792051430128,
+    0.015007947329316122538374763075807,
+    0.025460847326715320186874001019653,
+    0.035346360791375846222037948478360,
+    0.044589751324764876608227299373280,
+    0.053481524690928087265343147239430,
+    0.062009567800670640285139230960803,
+    0.069854121318728258709520077099147,
+    0.076849680757720378894432777482659,
+    0.083080502823133021038289247286104,
+    0.088564443056211770647275443693774,
+    0.093126598170825321225486872747346,
+    0.096642726983623678505179907627589,
+    0.099173598721791959332393173484603,
+    0.100769845523875595044946662617570,
+    0.101330007014791549017374792767493
+  };
+  static constexpr double wg[8] = {
+    0.030753241996117268354628393577204,
+    0.070366047488108124709267416450667,
+    0.107159220467171935011869546685869,
+    0.139570677926154314447804794511028,
+    0.166269205816993933553200860481209,
+    0.186161000015562211026800561866423,
+    0.198431485327111576456118326443839,
+    0.202578241925561272880620199967519
+  };
+};
+
+template <> struct QK<20> {
+  static constexpr double xgk[21] = {
+    0.998859031588277663838315576545863,
+    0.993128599185094924786122388471320,
+    0.981507877450250259193342994720217,
+    0.963971927277913791267666131197277,
+    0.940822633831754753519982722212443,
+    0.912234428251325905867752441203298,
+    0.878276811252281976077442995113078,
+    0.839116971822218823394529061701521,
+    0.795041428837551198350638833272788,
+    0.746331906460150792614305070355642,
+    0.693237656334751384805490711845932,
+    0.636053680726515025452836696226286,
+    0.575140446819710315342946036586425,
+    0.510867001950827098004364050955251,
+    0.443593175238725103199992213492640,
+    0.373706088715419560672548177024927,
+    0.301627868114913004320555356858592,
+    0.227785851141645078080496195368575,
+    0.152605465240922675505220241022678,
+    0.076526521133497333754640409398838,
+    0.000000000000000000000000000000000
+  };
+  static constexpr double wgk[21] = {
+    0.003073583718520531501218293246031,
+    0.008600269855642942198661787950102,
+    0.014626169256971252983787960308868,
+    0.020388373461266523598010231432755,
+    0.025882133604951158834505067096153,
+    0.031287306777032798958543119323801,
+    0.036600169758200798030557240707211,
+    0.041668873327973686263788305936895,
+    0.046434821867497674720231880926108,
+    0.050944573923728691932707670050345,
+    0.055195105348285994744832372419777,
+    0.059111400880639572374967220648594,
+    0.062653237554781168025870122174255,
+    0.065834597133618422111563556969398,
+    0.068648672928521619345623411885368,
+    0.071054423553444068305790361723210,
+    0.073030690332786667495189417658913,
+    0.074582875400499188986581418362488,
+    0.075704497684556674659542775376617,
+    0.076377867672080736705502835038061,
+    0.076600711917999656445049901530102
+  };
+  static constexpr double wg[10] = {
+    0.017614007139152118311861962351853,
+    0.040601429800386941331039952274932,
+    0.062672048334109063569506535187042,
+    0.083276741576704748724758143222046,
+    0.101930119817240435036750135480350,
+    0.118194531961518417312377377711382,
+    0.131688638449176626898494499748163,
+    0.142096109318382051329298325067165,
+    0.149172986472603746787828737001969,
+    0.152753387130725850698084331955098
+  };
+};
+
+template <> struct QK<25> {
+  static constexpr double xgk[26] = {
+    0.999262104992609834193457486540341,
+    0.995556969790498097908784946893902,
+    0.988035794534077247637331014577406,
+    0.976663921459517511498315386479594,
+    0.961614986425842512418130033660167,
+    0.942974571228974339414011169658471,
+    0.920747115281701561746346084546331,
+    0.894991997878275368851042006782805,
+    0.865847065293275595448996969588340,
+    0.833442628760834001421021108693570,
+    0.797873797998500059410410904994307,
+    0.759259263037357630577282865204361,
+    0.717766406813084388186654079773298,
+    0.673566368473468364485120633247622,
+    0.626810099010317412788122681624518,
+    0.577662930241222967723689841612654,
+    0.526325284334719182599623778158010,
+    0.473002731445714960522182115009192,
+    0.417885382193037748851814394594572,
+    0.361172305809387837735821730127641,
+    0.303089538931107830167478909980339,
+    0.243866883720988432045190362797452,
+    0.183718939421048892015969888759528,
+    0.122864692610710396387359818808037,
+    0.061544483005685078886546392366797,
+    0.000000000000000000000000000000000
+  };
+  static constexpr double wgk[26] = {
+    0.001987383892330315926507851882843,
+    0.005561932135356713758040236901066,
+    0.009473973386174151607207710523655,
+    0.013236229195571674813656405846976,
+    0.016847817709128298231516667536336,
+    0.020435371145882835456568292235939,
+    0.024009945606953216220092489164881,
+    0.027475317587851737802948455517811,
+    0.030792300167387488891109020215229,
+    0.034002130274329337836748795229551,
+    0.037116271483415543560330625367620,
+    0.040083825504032382074839284467076,
+    0.042872845020170049476895792439495,
+    0.045502913049921788909870584752660,
+    0.047982537138836713906392255756915,
+    0.050277679080715671963325259433440,
+    0.052362885806407475864366712137873,
+    0.054251129888545490144543370459876,
+    0.055950811220412317308240686382747,
+    0.057437116361567832853582693939506,
+    0.058689680022394207961974175856788,
+    0.059720340324174059979099291932562,
+    0.060539455376045862945360267517565,
+    0.061128509717053048305859030416293,
+    0.061471189871425316661544131965264,
+    0.061580818067832935078759824240065
+  };
+  static constexpr double wg[13] = {
+    0.011393798501026287947902964113235,
+    0.026354986615032137261901815295299,
+    0.040939156701306312655623487711646,
+    0.054904695975835191925936891540473,
+    0.068038333812356917207187185656708,
+    0.080140700335001018013234959669111,
+    0.091028261982963649811497220702892,
+    0.100535949067050644202206890392686,
+    0.108519624474263653116093957050117,
+    0.114858259145711648339325545869556,
+    0.119455763535784772228178126512901,
+    0.122242442990310041688959518945852,
+    0.123176053726715451203902873079050
+  };
+};
+
+template <> struct QK<30> {
+  static constexpr double xgk[31] = {
+    0.999484410050490637571325895705811,
+    0.996893484074649540271630050918695,
+    0.991630996870404594858628366109486,
+    0.983668123279747209970032581605663,
+    0.973116322501126268374693868423707,
+    0.960021864968307512216871025581798,
+    0.944374444748559979415831324037439,
+    0.926200047429274325879324277080474,
+    0.905573307699907798546522558925958,
+    0.882560535792052681543116462530226,
+    0.857205233546061098958658510658944,
+    0.829565762382768397442898119732502,
+    0.799727835821839083013668942322683,
+    0.767777432104826194917977340974503,
+    0.733790062453226804726171131369528,
+    0.697850494793315796932292388026640,
+    0.660061064126626961370053668149271,
+    0.620526182989242861140477556431189,
+    0.579345235826361691756024932172540,
+    0.536624148142019899264169793311073,
+    0.492480467861778574993693061207709,
+    0.447033769538089176780609900322854,
+    0.400401254830394392535476211542661,
+    0.352704725530878113471037207089374,
+    0.304073202273625077372677107199257,
+    0.254636926167889846439805129817805,
+    0.204525116682309891438957671002025,
+    0.153869913608583546963794672743256,
+    0.102806937966737030147096751318001,
+    0.051471842555317695833025213166723,
+    0.000000000000000000000000000000000
+  };
+  static constexpr double wgk[31] = {
+    0.001389013698677007624551591226760,
+    0.003890461127099884051267201844516,
+    0.006630703915931292173319826369750,
+    0.009273279659517763428441146892024,
+    0.011823015253496341742232898853251,
+    0.014369729507045804812451432443580,
+    0.016920889189053272627572289420322,
+    0.019414141193942381173408951050128,
+    0.021828035821609192297167485738339,
+    0.024191162078080601365686370725232,
+    0.026509954882333101610601709335075,
+    0.028754048765041292843978785354334,
+    0.030907257562387762472884252943092,
+    0.032981447057483726031814191016854,
+    0.034979338028060024137499670731468,
+    0.036882364651821229223911065617136,
+    0.038678945624727592950348651532281,
+    0.040374538951535959111995279752468,
+    0.041969810215164246147147541285970,
+    0.043452539701356069316831728117073,
+    0.044814800133162663192355551616723,
+    0.046059238271006988116271735559374,
+    0.047185546569299153945261478181099,
+    0.048185861757087129140779492298305,
+    0.049055434555029778887528165367238,
+    0.049795683427074206357811569379942,
+    0.050405921402782346840893085653585,
+    0.050881795898749606492297473049805,
+    0.051221547849258772170656282604944,
+    0.051426128537459025933862879215781,
+    0.051494729429451567558340433647099
+  };
+  static constexpr double wg[15] = {
+    0.007968192496166605615465883474674,
+    0.018466468311090959142302131912047,
+    0.028784707883323369349719179611292,
+    0.038799192569627049596801936446348,
+    0.048402672830594052902938140422808,
+    0.057493156217619066481721689402056,
+    0.065974229882180495128128515115962,
+    0.073755974737705206268243850022191,
+    0.080755895229420215354694938460530,
+    0.086899787201082979802387530715126,
+    0.092122522237786128717632707087619,
+    0.096368737174644259639468626351810,
+    0.099593420586795267062780282103569,
+    0.101762389748405504596428952168554,
+    0.102852652893558840341285636705415
+  };
+};
+
+namespace detail {
+
+// The sums of the Gauss-Kronrod rule with m Gauss nodes given the integrand
+// at the center, fc, and at the nodes center -+ half * QK<m>::xgk[k], fv1[k]
+// and fv2[k] (k = 0 .. m - 1). The terms are summed in the order of QUADPACK
+// so that the rounding errors are the same as in GSL.
+template <unsigned m>
+gsl::integration::QKResult qk_sums(
+    double fc, const double* fv1, const double* fv2, double half
+) {
+  const double* wgk = QK<m>::wgk;
+  const double* wg  = QK<m>::wg;
+
+  double resg   = m % 2 ? fc * wg[(m - 1) / 2] : 0;
+  double resk   = fc * wgk[m];
+  double resabs = std::abs(resk);
+
+  for (size_t k = 1; k < m; k += 2) {
+    double fsum = fv1[k] + fv2[k];
+    resg   += wg[(k - 1) / 2] * fsum;
+    resk   += wgk[k] * fsum;
+    resabs += wgk[k] * (std::abs(fv1[k]) + std::abs(fv2[k]));
+  };
+  for (size_t k = 0; k < m; k += 2) {
+    double fsum = fv1[k] + fv2[k];
+    resk   += wgk[k] * fsum;
+    resabs += wgk[k] * (std::abs(fv1[k]) + std::abs(fv2[k]));
+  };
+
+  double mean   = 0.5 * resk;
+  double resasc = wgk[m] * std::abs(fc - mean);
+  for (size_t k = 0; k < m; ++k)
+    resasc += wgk[k] * (std::abs(fv1[k] - mean) + std::abs(fv2[k] - mean));
+
+  gsl::integration::QKResult result;
+  result.result = resk * half;
+  result.resabs = resabs * std::abs(half);
+  result.resasc = resasc * std::abs(half);
+  result.abserr = rescale_error(
+      (resk - resg) * half, result.resabs, result.resasc
+  );
+  return result;
+};
+
+}; // namespace detail
+
+// Apply the Gauss-Kronrod rule with m Gauss nodes to f on [a, b]
+template <unsigned m, typename F>
+gsl::integration::QKResult qk(const F& f, double a, double b) {
+  double center = 0.5 * (a + b);
+  double half   = 0.5 * (b - a);
+
+  double fc = f(center);
+  std::array<double, m> fv1, fv2;
+  for (size_t k = 0; k < m; ++k) {
+    double dx = half * QK<m>::xgk[k];
+    fv1[k] = f(center - dx);
+    fv2[k] = f(center + dx);
+  };
+  return detail::qk_sums<m>(fc, fv1.data(), fv2.data(), half);
+};
+
+// Same with f evaluated on all the 2 m + 1 nodes in a single call
+// f(n, x, fx) (see integration::Batch_function)
+template <unsigned m, typename F>
+gsl::integration::QKResult qk_batch(const F& f, double a, double b) {
+  double center = 0.5 * (a + b);
+  double half   = 0.5 * (b - a);
+
+  // The center, then the nodes to the left and to the right of it
+  std::array<double, 2 * m + 1> nodes, fx;
+  nodes[0] = center;
+  for (size_t k = 0; k < m; ++k) {
+    double dx = half * QK<m>::xgk[k];
+    nodes[1 + k]     = center - dx;
+    nodes[1 + m + k] = center + dx;
+  };
+  f(nodes.size(), nodes.data(), fx.data());
+  return detail::qk_sums<m>(fx[0], &fx[1], &fx[1 + m], half);
+};
+
+// Same for any of the rules of gsl::integration::QAGMethod. The number of
+// nodes becomes a constant, and the loops over the nodes can be unrolled.
+template <typename F>
+gsl::integration::QKResult qk(
+    const F& f, double a, double b, gsl::integration::QAGMethod method
+) {
+  switch (method) {
+    case gsl::integration::GAUSS15: return qk<7> (f, a, b);
+    case gsl::integration::GAUSS21: return qk<10>(f, a, b);
+    case gsl::integration::GAUSS31: return qk<15>(f, a, b);
+    case gsl::integration::GAUSS41: return qk<20>(f, a, b);
+    case gsl::integration::GAUSS51: return qk<25>(f, a, b);
+    case gsl::integration::GAUSS61: return qk<30>(f, a, b);
+    default:
+      throw std::invalid_argument("epa::quadpack::qk: unsupported rule");
+  };
+};
+
+template <typename F>
+gsl::integration::QKResult qk_batch(
+    const F& f, double a, double b, gsl::integration::QAGMethod method
+) {
+  switch (method) {
+    case gsl::integration::GAUSS15: return qk_batch<7> (f, a, b);
+    case gsl::integration::GAUSS21: return qk_batch<10>(f, a, b);
+    case gsl::integration::GAUSS31: return qk_batch<15>(f, a, b);
+    case gsl::integration::GAUSS41: return qk_batch<20>(f, a, b);
+    case gsl::integration::GAUSS51: return qk_batch<25>(f, a, b);
+    case gsl::integration::GAUSS61: return qk_batch<30>(f, a, b);
+    default:
+      throw std::invalid_argument(
+          "epa::quadpack::qk_batch: unsupported rule"
+      );
+  };
+};
+
+namespace detail {
+
+// Array of N elements on the stack that moves to the heap when more room is
+// requested
+template <typename T, size_t N>
+class SmallArray {
+  public:
+    SmallArray() {};
+    SmallArray(const SmallArray&) = delete;
+    SmallArray& operator=(const SmallArray&) = delete;
+
+    T& operator[](size_t i) { return data_[i]; };
+    const T& operator[](size_t i) const { return data_[i]; };
+
+    // Make room for n elements preserving the first size ones
+    void reserve(size_t n, size_t size) {
+      if (n <= capacity_) return;
+      size_t capacity = std::max(n, 2 * capacity_);
+      std::unique_ptr<T[]> heap(new T[capacity]);
+      std::copy(data_, data_ + size, heap.get());
+      heap_     = std::move(heap);
+      data_     = heap_.get();
+      capacity_ = capacity;
+    };
+
+  private:
+    std::array<T, N> stack_;
+    std::unique_ptr<T[]> heap_;
+    T* data_ = stack_.data();
+    size_t capacity_ = N;
+};
+
+// The list of intervals of gsl_integration_workspace
+class Workspace {
+  public:
+    struct Interval {
+      double a;
+      double b;
+      double result;
+      double error;
+      size_t level;
+    };
+
+    size_t size          = 0;
+    size_t nrmax         = 0;
+    size_t i             = 0; // the interval to bisect next
+    size_t maximum_level = 0;
+
+    Workspace(size_t limit, double a, double b): limit_(limit) {
+      intervals_[0] = { a, b, 0, 0, 0 };
+      order_[0] = 0;
+    };
+
+    const Interval& current() const { return intervals_[i]; };
+    const Interval& interval(size_t index) const { return intervals_[index]; };
+
+    // The number of intervals kept in the order of descending error
+    // estimates: once few iterations remain, the intervals that could not be
+    // bisected anyway drop out of the list
+    size_t sorted() const {
+      size_t last = size - 1;
+      size_t top = last < limit_ / 2 + 2 ? last : limit_ - last + 1;
+      return std::min(size, top + 1);
+    };
+
+    // The index of the interval with the k-th largest error estimate
+    // (k < sorted())
+    size_t largest(size_t k) const { return order_[k]; };
+
+    // Make the interval with the given index the one to bisect next. Returns
+    // false if it has dropped out of the sorted list.
+    bool select(size_t index) {
+      size_t n = sorted();
+      for (size_t k = 0; k < n; ++k)
+        if (order_[k] == index) {
+          nrmax = k;
+          i = index;
+          return true;
+        };
+      return false;
+    };
+
+    void set_initial_result(double result, double error) {
+      size = 1;
+      intervals_[0].result = result;
+      intervals_[0].error  = error;
+    };
+
+    // Replace the current interval with its halves [a1, b1] and [a2, b2]
+    void update(
+        double a1, double b1, double area1, double error1,
+        double a2, double b2, double area2, double error2
+    ) {
+      intervals_.reserve(size + 1, size);
+      order_.reserve(size + 1, size);
+
+      size_t level = intervals_[i].level + 1;
+      if (error2 > error1) {
+        Interval& current = intervals_[i];
+        current.a      = a2;
+        current.result = area2;
+        current.error  = error2;
+        current.level  = level;
+        intervals_[size] = { a1, b1, area1, error1, level };
+      } else {
+        Interval& current = intervals_[i];
+        current.b      = b1;
+        current.result = area1;
+        current.error  = error1;
+        current.level  = level;
+        intervals_[size] = { a2, b2, area2, error2, level };
+      };
+      ++size;
+      if (level > maximum_level) maximum_level = level;
+      sort();
+    };
+
+    double sum_results() const {
+      double result = 0;
+      for (size_t j = 0; j < size; ++j) result += intervals_[j].result;
+      return result;
+    };
+
+    bool large_interval() const {
+      return intervals_[i].level < maximum_level;
+    };
+
+    void reset_nrmax() {
+      nrmax = 0;
+      i = order_[0];
+    };
+
+    bool increase_nrmax() {
+      size_t last = size - 1;
+      size_t jupbnd = last > 1 + limit_ / 2 ? limit_ + 1 - last : last;
+      for (size_t k = nrmax; k <= jupbnd; ++k) {
+        i = order_[nrmax];
+        if (intervals_[i].level < maximum_level) return true;
+        ++nrmax;
+      };
+      return false;
+    };
+
+  private:
+    size_t limit_;
+    SmallArray<Interval, stack_intervals> intervals_;
+    SmallArray<size_t, stack_intervals> order_;
+
+    // Keep the error estimates in descending order (qpsrt)
+    void sort() {
+      size_t last = size - 1;
+      size_t i_nrmax = nrmax;
+      size_t i_maxerr = order_[i_nrmax];
+
+      if (last < 2) {
+        order_[0] = 0;
+        order_[1] = 1;
+        i = i_maxerr;
+        return;
+      };
+
+      double errmax = intervals_[i_maxerr].error;
+      while (i_nrmax > 0 && errmax > intervals_[order_[i_nrmax - 1]].error) {
+        order_[i_nrmax] = order_[i_nrmax - 1];
+        --i_nrmax;
+      };
+
+      long top = last < limit_ / 2 + 2 ? last : limit_ - last + 1;
+
+      long j = i_nrmax + 1;
+      while (j < top && errmax < intervals_[order_[j]].error) {
+        order_[j - 1] = order_[j];
+        ++j;
+      };
+      order_[j - 1] = i_maxerr;
+
+      double errmin = intervals_[last].error;
+      long k = top - 1;
+      while (k > j - 2 && errmin >= intervals_[order_[k]].error) {
+        order_[k + 1] = order_[k];
+        --k;
+      };
+      order_[k + 1] = last;
+
+      i = order_[i_nrmax];
+      nrmax = i_nrmax;
+    };
+};
+
+// Wynn's epsilon algorithm (qelg)
+class ExtrapolationTable {
+  public:
+    size_t n = 0;
+
+    void append(double y) { rlist2_[n++] = y; };
+
+    void extrapolate(double& result, double& abserr) {
+      const double eps = std::numeric_limits<double>::epsilon();
+      const double max = std::numeric_limits<double>::max();
+      double* epstab = rlist2_.data();
+      const size_t n_orig = n - 1;
+      const double current = epstab[n_orig];
+      const size_t newelm = n_orig / 2;
+      size_t n_final = n_orig;
+
+      result = current;
+      abserr = max;
+
+      if (n_orig < 2) {
+        abserr = std::max(max, 5 * eps * std::abs(current));
+        return;
+      };
+
+      epstab[n_orig + 2] = epstab[n_orig];
+      epstab[n_orig] = max;
+
+      for (size_t i = 0; i < newelm; ++i) {
+        double res = epstab[n_orig - 2 * i + 2];
+        double e0 = epstab[n_orig - 2 * i - 2];
+        double e1 = epstab[n_orig - 2 * i - 1];
+        double e2 = res;
+
+        double e1abs  = std::abs(e1);
+        double delta2 = e2 - e1;
+        double err2   = std::abs(delta2);
+        double tol2   = std::max(std::abs(e2), e1abs) * eps;
+        double delta3 = e1 - e0;
+        double err3   = std::abs(delta3);
+        double tol3   = std::max(e1abs, std::abs(e0)) * eps;
+
+        if (err2 <= tol2 && err3 <= tol3) {
+          // e0, e1 and e2 are equal within machine accuracy: convergence
+          result = res;
+          abserr = std::max(err2 + err3, 5 * eps * std::abs(res));
+          return;
+        };
+
+        double e3 = epstab[n_orig - 2 * i];
+        epstab[n_orig - 2 * i] = e1;
+        double delta1 = e1 - e3;
+        double err1   = std::abs(delta1);
+        double tol1   = std::max(e1abs, std::abs(e3)) * eps;
+
+        // Two elements are very close to each other: omit a part of the table
+        if (err1 <= tol1 || err2 <= tol2 || err3 <= tol3) {
+          n_final = 2 * i;
+          break;
+        };
+
+        double ss = (1 / delta1 + 1 / delta2) - 1 / delta3;
+
+        // Irregular behaviour in the table: omit a part of it
+        if (std::abs(ss * e1) <= 1e-4) {
+          n_final = 2 * i;
+          break;
+        };
+
+        res = e1 + 1 / ss;
+        epstab[n_orig - 2 * i] = res;
+
+        double error = err2 + std::abs(res - e2) + err3;
+        if (error <= abserr) {
+          abserr = error;
+          result = res;
+        };
+      };
+
+      const size_t limexp = 50 - 1;
+      if (n_final == limexp) n_final = 2 * (limexp / 2);
+
+      if (n_orig % 2 == 1)
+        for (size_t i = 0; i <= newelm; ++i) epstab[1 + 2 * i] = epstab[2 * i + 3];
+      else
+        for (size_t i = 0; i <= newelm; ++i) epstab[2 * i] = epstab[2 * i + 2];
+
+      if (n_orig != n_final)
+        for (size_t i = 0; i <= n_final; ++i)
+          epstab[i] = epstab[n_orig - n_final + i];
+
+      n = n_final + 1;
+
+      if (nres_ < 3) {
+        res3la_[nres_] = result;
+        abserr = max;
+      } else {
+        abserr = std::abs(result - res3la_[2])
+               + std::abs(result - res3la_[1])
+               + std::abs(result - res3la_[0]);
+        res3la_[0] = res3la_[1];
+        res3la_[1] = res3la_[2];
+        res3la_[2] = result;
+      };
+      ++nres_;
+
+      abserr = std::max(abserr, 5 * eps * std::abs(result));
+    };
+
+  private:
+    std::array<double, 52> rlist2_;
+    std::array<double, 3>  res3la_;
+    size_t nres_ = 0;
+};
+
+inline bool subinterval_too_small(double a1, double a2, double b2) {
+  const double eps = std::numeric_limits<double>::epsilon();
+  double tmp = (1 + 100 * eps)
+             * (std::abs(a2) + 1000 * std::numeric_limits<double>::min());
+  return std::abs(a1) <= tmp && std::abs(b2) <= tmp;
+};
+
+inline void check_tolerance(double epsabs, double epsrel) {
+  if (
+      epsabs <= 0
+      && (
+        epsrel < 50 * std::numeric_limits<double>::epsilon()
+        || epsrel < 0.5e-28
+      )
+  )
+    throw gsl::Error(GSL_EBADTOL);
+};
+
+// Calls job(0) ... job(n - 1) in turn
+struct Serial {
+  template <typename Job>
+  void operator()(size_t n, const Job& job) const {
+    for (size_t j = 0; j < n; ++j) job(j);
+  };
+};
+
+// The loop of gsl_integration_qag with rule(a, b) returning the
+// gsl::integration::QKResult on [a, b] at the cost of npoints evaluations.
+// At each step the `width' intervals with the largest error estimates are
+// bisected; run(n, job) evaluates the rule on their halves by calling
+// job(0) ... job(n - 1) in any order, possibly at once. The intervals are
+// then updated one by one as in QUADPACK, so the result depends on width but
+// not on run. With width = 1 this is gsl_integration_qag.
+template <typename Rule, typename Run = Serial>
+integration::Result qag(
+    const Rule& rule,
+    size_t npoints,
+    double a,
+    double b,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    size_t width = 1,
+    const Run& run = Run()
+) {
+  check_tolerance(epsabs, epsrel);
+
+  const double eps = std::numeric_limits<double>::epsilon();
+
+  integration::Result result;
+  result.nevals = npoints;
+
+  Workspace workspace(limit, a, b);
+  auto r0 = rule(a, b);
+  workspace.set_initial_result(r0.result, r0.abserr);
+  result.result = r0.result;
+  result.abserr = r0.abserr;
+
+  double tolerance = std::max(epsabs, epsrel * std::abs(r0.result));
+  if (r0.abserr <= 50 * eps * r0.resabs && r0.abserr > tolerance)
+    throw gsl::Error(GSL_EROUND);
+  if ((r0.abserr <= tolerance && r0.abserr != r0.resasc) || r0.abserr == 0)
+    return result;
+  if (limit == 1) throw gsl::Error(GSL_EMAXITER);
+
+  double area   = r0.result;
+  double errsum = r0.abserr;
+  int roundoff_type1 = 0;
+  int roundoff_type2 = 0;
+  int error_type     = 0;
+  size_t iteration   = 1;
+  SmallArray<size_t, 1> selected;
+  SmallArray<gsl::integration::QKResult, 2> halves;
+  do {
+    // Evaluate the rule on the halves of the intervals with the largest error
+    // estimates; every bisection adds an interval
+    size_t n = std::min({
+        width,
+        workspace.sorted(),
+        iteration < limit ? limit - iteration : 1
+    });
+    selected.reserve(n, 0);
+    halves.reserve(2 * n, 0);
+    for (size_t j = 0; j < n; ++j) selected[j] = workspace.largest(j);
+    run(
+        2 * n,
+        [&](size_t h) {
+          const auto& interval = workspace.interval(selected[h / 2]);
+          double middle = 0.5 * (interval.a + interval.b);
+          halves[h] = h % 2
+                    ? rule(middle, interval.b)
+                    : rule(interval.a, middle);
+        }
+    );
+    result.nevals += 2 * n * npoints;
+
+    // Update the intervals one by one as gsl_integration_qag does
+    for (size_t j = 0; j < n; ++j) {
+      if (!workspace.select(selected[j])) continue;
+      auto current = workspace.current();
+      double a1 = current.a;
+      double b1 = 0.5 * (current.a + current.b);
+      double a2 = b1;
+      double b2 = current.b;
+      const auto& r1 = halves[2 * j];
+      const auto& r2 = halves[2 * j + 1];
+
+      double area12  = r1.result + r2.result;
+      double error12 = r1.abserr + r2.abserr;
+      errsum += error12 - current.error;
+      area   += area12 - current.result;
+
+      // The roundoff tests are those of the interval that QUADPACK would
+      // bisect; the others may be at the level of the rounding errors already
+      if (j == 0 && r1.resasc != r1.abserr && r2.resasc != r2.abserr) {
+        double delta = current.result - area12;
+        if (
+            std::abs(delta) <= 1e-5 * std::abs(area12)
+            && error12 >= 0.99 * current.error
+        )
+          ++roundoff_type1;
+        if (iteration >= 10 && error12 > current.error) ++roundoff_type2;
+      };
+
+      tolerance = std::max(epsabs, epsrel * std::abs(area));
+      if (errsum > tolerance) {
+        if (roundoff_type1 >= 6 || roundoff_type2 >= 20) error_type = 2;
+        if (subinterval_too_small(a1, a2, b2)) error_type = 3;
+      };
+
+      workspace.update(
+          a1, b1, r1.result, r1.abserr, a2, b2, r2.result, r2.abserr
+      );
+      ++iteration;
+    };
+  } while (iteration < limit && !error_type && errsum > tolerance);
+
+  result.result = workspace.sum_results();
+  result.abserr = errsum;
+
+  if (errsum <= tolerance) return result;
+  if (error_type == 2) throw gsl::Error(GSL_EROUND);
+  if (error_type == 3) throw gsl::Error(GSL_ESING);
+  if (iteration == limit) throw gsl::Error(GSL_EMAXITER);
+  throw gsl::Error(GSL_EFAILED);
+};
+
+// The loop of gsl_integration_qags with rule as in qag
+template <typename Rule>
+integration::Result qags(
+    const Rule& rule,
+    size_t npoints,
+    double a,
+    double b,
+    double epsabs,
+    double epsrel,
+    size_t limit
+) {
+  check_tolerance(epsabs, epsrel);
+
+  const double eps = std::numeric_limits<double>::epsilon();
+
+  integration::Result result;
+  result.nevals = npoints;
+
+  Workspace workspace(limit, a, b);
+  auto r0 = rule(a, b);
+  workspace.set_initial_result(r0.result, r0.abserr);
+  result.result = r0.result;
+  result.abserr = r0.abserr;
+
+  double tolerance = std::max(epsabs, epsrel * std::abs(r0.result));
+  if (r0.abserr <= 100 * eps * r0.resabs && r0.abserr > tolerance)
+    throw gsl::Error(GSL_EROUND);
+  if ((r0.abserr <= tolerance && r0.abserr != r0.resasc) || r0.abserr == 0)
+    return result;
+  if (limit == 1) throw gsl::Error(GSL_EMAXITER);
+
+  ExtrapolationTable table;
+  table.append(r0.result);
+
+  double area    = r0.result;
+  double errsum  = r0.abserr;
+  double res_ext = r0.result;
+  double err_ext = std::numeric_limits<double>::max();
+  double ertest  = 0;
+  double error_over_large_intervals = 0;
+  double reseps = 0, abseps = 0, correc = 0;
+  size_t ktmin = 0;
+  int roundoff_type1 = 0, roundoff_type2 = 0, roundoff_type3 = 0;
+  int error_type = 0, error_type2 = 0;
+  bool positive_integrand
+    = std::abs(r0.result) >= (1 - 50 * eps) * r0.resabs;
+  bool extrapolate = false;
+  bool disallow_extrapolation = false;
+  bool converged = false;
+
+  size_t iteration = 1;
+  do {
+    // Bisect the interval with the largest error estimate
+    auto current = workspace.current();
+    size_t current_level = current.level + 1;
+    double a1 = current.a;
+    double b1 = 0.5 * (current.a + current.b);
+    double a2 = b1;
+    double b2 = current.b;
+    ++iteration;
+
+    auto r1 = rule(a1, b1);
+    auto r2 = rule(a2, b2);
+    result.nevals += 2 * npoints;
+
+    double area12  = r1.result + r2.result;
+    double error12 = r1.abserr + r2.abserr;
+
+    // The order of the operations is that of QUADPACK so that the rounding
+    // errors are the same
+    errsum = errsum + error12 - current.error;
+    area   = area + area12 - current.result;
+    tolerance = std::max(epsabs, epsrel * std::abs(area));
+
+    if (r1.resasc != r1.abserr && r2.resasc != r2.abserr) {
+      double delta = current.result - area12;
+      if (
+          std::abs(delta) <= 1e-5 * std::abs(area12)
+          && error12 >= 0.99 * current.error
+      ) {
+        if (!extrapolate)
+          ++roundoff_type1;
+        else
+          ++roundoff_type2;
+      };
+      if (iteration > 10 && error12 > current.error) ++roundoff_type3;
+    };
+
+    if (roundoff_type1 + roundoff_type2 >= 10 || roundoff_type3 >= 20)
+      error_type = 2;
+    if (roundoff_type2 >= 5) error_type2 = 1;
+    if (subinterval_too_small(a1, a2, b2)) error_type = 4;
+
+    workspace.update(
+        a1, b1, r1.result, r1.abserr, a2, b2, r2.result, r2.abserr
+    );
+
+    if (errsum <= tolerance) {
+      converged = true;
+      break;
+    };
+    if (error_type) break;
+    if (iteration >= limit - 1) {
+      error_type = 1;
+      break;
+    };
+
+    if (iteration == 2) {
+      error_over_large_intervals = errsum;
+      ertest = tolerance;
+      table.append(area);
+      continue;
+    };
+
+    if (disallow_extrapolation) continue;
+
+    error_over_large_intervals += -current.error;
+    if (current_level < workspace.maximum_level)
+      error_over_large_intervals += error12;
+
+    if (!extrapolate) {
+      // Test whether the interval to be bisected next is the smallest one
+      if (workspace.large_interval()) continue;
+      extrapolate = true;
+      workspace.nrmax = 1;
+    };
+
+    if (!error_type2 && error_over_large_intervals > ertest)
+      if (workspace.increase_nrmax()) continue;
+
+    table.append(area);
+    table.extrapolate(reseps, abseps);
+    ++ktmin;
+    if (ktmin > 5 && err_ext < 1e-3 * errsum) error_type = 5;
+    if (abseps < err_ext) {
+      ktmin   = 0;
+      err_ext = abseps;
+      res_ext = reseps;
+      correc  = error_over_large_intervals;
+      ertest  = std::max(epsabs, epsrel * std::abs(reseps));
+      if (err_ext <= ertest) break;
+    };
+
+    // Prepare bisection of the smallest interval
+    if (table.n == 1) disallow_extrapolation = true;
+    if (error_type == 5) break;
+
+    // Work on the interval with the largest error
+    workspace.reset_nrmax();
+    extrapolate = false;
+    error_over_large_intervals = errsum;
+  } while (iteration < limit);
+
+  bool sum = converged;
+  if (!converged) {
+    result.result = res_ext;
+    result.abserr = err_ext;
+    if (err_ext == std::numeric_limits<double>::max()) {
+      sum = true;
+    } else {
+      bool done = false;
+      if (error_type || error_type2) {
+        if (error_type2) err_ext += correc;
+        if (error_type == 0) error_type = 3;
+        if (res_ext != 0 && area != 0) {
+          if (err_ext / std::abs(res_ext) > errsum / std::abs(area))
+            sum = done = true;
+        } else if (err_ext > errsum) {
+          sum = done = true;
+        } else if (area == 0) {
+          done = true;
+        };
+      };
+      if (!done) {
+        // Test on divergence
+        double max_area = std::max(std::abs(res_ext), std::abs(area));
+        if (positive_integrand || max_area >= 0.01 * r0.resabs) {
+          double ratio = res_ext / area;
+          if (ratio < 0.01 || ratio > 100 || errsum > std::abs(area))
+            error_type = 6;
+        };
+      };
+    };
+  };
+
+  if (sum) {
+    result.result = workspace.sum_results();
+    result.abserr = errsum;
+  };
+
+  if (error_type > 2) --error_type;
+  switch (error_type) {
+    case 0: return result;
+    case 1: throw gsl::Error(GSL_EMAXITER);
+    case 2: throw gsl::Error(GSL_EROUND);
+    case 3: throw gsl::Error(GSL_ESING);
+    case 4: throw gsl::Error(GSL_EROUND);
+    case 5: throw gsl::Error(GSL_EDIVERGE);
+    default: throw gsl::Error(GSL_EFAILED);
+  };
+};
+
+}; // namespace detail
+
+// Adaptive integration over a finite range as gsl_integration_qag: the
+// interval with the largest error estimate is bisected until the total error
+// satisfies epsabs or epsrel. Throws gsl::Error with GSL_EBADTOL, GSL_EROUND,
+// GSL_ESING, GSL_EMAXITER or GSL_EFAILED where GSL would report these.
+template <typename F>
+integration::Result qag_finite(
+    const F& f,
+    double a,
+    double b,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    gsl::integration::QAGMethod method
+) {
+  return detail::qag(
+      [&f, method](double from, double to) { return qk(f, from, to, method); },
+      integration::gauss_kronrod(method).x.size(),
+      a, b, epsabs, epsrel, limit
+  );
+};
+
+// Adaptive integration with extrapolation over a finite range as
+// gsl_integration_qags (the rule is GAUSS21 there). The error codes are those
+// of qag_finite and GSL_EDIVERGE.
+template <typename F>
+integration::Result qags(
+    const F& f,
+    double a,
+    double b,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    gsl::integration::QAGMethod method = gsl::integration::GAUSS21
+) {
+  return detail::qags(
+      [&f, method](double from, double to) { return qk(f, from, to, method); },
+      integration::gauss_kronrod(method).x.size(),
+      a, b, epsabs, epsrel, limit
+  );
+};
+
+// Integral of f from a to b. As gsl::integration::qag, this calls qag_finite
+// for a finite range and, like gsl_integration_qagi, qagiu and qagil,
+// integrates over an infinite range with qags and the 15-point rule after the
+// change of variables x = (1 - t) / t.
+template <typename F>
+integration::Result qag(
+    const F& f,
+    double a,
+    double b,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    gsl::integration::QAGMethod method
+) {
+  const double inf = std::numeric_limits<double>::infinity();
+  const auto rule = gsl::integration::GAUSS15;
+  if (a == -inf) {
+    if (b == inf)
+      return qags(
+          [&f](double t) -> double {
+            double x = (1 - t) / t;
+            return (f(x) + f(-x)) / t / t;
+          },
+          0, 1, epsabs, epsrel, limit, rule
+      );
+    return qags(
+        [&f, b](double t) -> double {
+          return f(b - (1 - t) / t) / t / t;
+        },
+        0, 1, epsabs, epsrel, limit, rule
+    );
+  };
+  if (b == inf)
+    return qags(
+        [&f, a](double t) -> double {
+          return f(a + (1 - t) / t) / t / t;
+        },
+        0, 1, epsabs, epsrel, limit, rule
+    );
+  return qag_finite(f, a, b, epsabs, epsrel, limit, method);
+};
+
+}; // namespace quadpack
+}; // namespace epa
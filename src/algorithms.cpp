@@ -1,6 +1,11 @@
 #include <algorithm>
+#include <cmath>
+#include <exception>
 #include <fstream>
+#include <mutex>
+#include <numeric>
 #include <sstream>
+#include <thread>
 
 #include <epa/algorithms.hpp>
 
@@ -85,4 +90,507 @@ void Function1d::save(const std::filesystem::path& file) const {
   dump(f);
 };
 
+void parallel_for(
+    size_t n,
+    unsigned nthreads,
+    const std::function<std::function<void (size_t)> ()>& generator
+) {
+  std::atomic<size_t> next(0);
+  std::atomic<bool>   stop(false);
+  std::mutex          mutex;
+  std::exception_ptr  error;
+
+  auto work = [&]() {
+    try {
+      auto f = generator();
+      while (!stop.load(std::memory_order_relaxed)) {
+        size_t i = next.fetch_add(1, std::memory_order_relaxed);
+        if (i >= n) break;
+        f(i);
+      };
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error) error = std::current_exception();
+      stop = true;
+    };
+  };
+
+  if (nthreads == 0) nthreads = std::thread::hardware_concurrency();
+  if (nthreads > n) nthreads = n;
+
+  std::vector<std::thread> threads;
+  try {
+    for (unsigned t = 1; t < nthreads; ++t) threads.emplace_back(work);
+  } catch (...) {
+    stop = true;
+    for (auto& thread: threads) thread.join();
+    throw;
+  };
+  work();
+  for (auto& thread: threads) thread.join();
+
+  if (error) std::rethrow_exception(error);
+};
+
+void parallel_for(
+    size_t n,
+    unsigned threads,
+    const std::function<void (size_t)>& f
+) {
+  parallel_for(
+      n,
+      threads,
+      [&f]() -> std::function<void (size_t)> {
+        return [&f](size_t i) { f(i); };
+      }
+  );
+};
+
+std::array<uint32_t, 4> philox(
+    std::array<uint32_t, 4> c, std::array<uint32_t, 2> k
+) {
+  for (int round = 0; round < 10; ++round) {
+    uint64_t p0 = uint64_t(0xD2511F53) * c[0];
+    uint64_t p1 = uint64_t(0xCD9E8D57) * c[2];
+    c = {
+      uint32_t(p1 >> 32) ^ c[1] ^ k[0],
+      uint32_t(p1),
+      uint32_t(p0 >> 32) ^ c[3] ^ k[1],
+      uint32_t(p0)
+    };
+    k[0] += 0x9E3779B9;
+    k[1] += 0xBB67AE85;
+  };
+  return c;
+};
+
+Function1d tabulate(
+    const std::function<std::function<double (double)> ()>& generator,
+    std::vector<double> grid,
+    const tabulate_keys& keys
+) {
+  size_t n = grid.size();
+
+  std::vector<size_t> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  if (keys.cost) {
+    std::vector<double> cost(n);
+    for (size_t i = 0; i < n; ++i) cost[i] = keys.cost(grid[i]);
+    std::stable_sort(
+        order.begin(),
+        order.end(),
+        [&cost](size_t i, size_t j) -> bool { return cost[i] > cost[j]; }
+    );
+  };
+
+  std::vector<double> values(n);
+  std::vector<char>   computed(n, 0);
+  std::mutex          mutex; // guards progress
+  size_t              done = 0;
+
+  parallel_for(
+      n,
+      keys.threads,
+      [&]() -> std::function<void (size_t)> {
+        return [&, f = generator()](size_t k) {
+          if (keys.cancel && keys.cancel->load(std::memory_order_relaxed))
+            return;
+          size_t i = order[k];
+          values[i] = f(grid[i]);
+          computed[i] = 1;
+          if (keys.progress) {
+            std::lock_guard<std::mutex> lock(mutex);
+            keys.progress(++done, n, grid[i], values[i]);
+          };
+        };
+      }
+  );
+
+  std::vector<std::pair<double, double>> points;
+  points.reserve(n);
+  for (size_t i = 0; i < n; ++i)
+    if (computed[i]) points.emplace_back(grid[i], values[i]);
+  std::stable_sort(
+      points.begin(),
+      points.end(),
+      [](const std::pair<double, double>& a, const std::pair<double, double>& b)
+      -> bool {
+        return a.first < b.first;
+      }
+  );
+  return Function1d(std::move(points));
+};
+
+Function1d tabulate(
+    const std::function<double (double)>& f,
+    std::vector<double> grid,
+    const tabulate_keys& keys
+) {
+  return tabulate(
+      [&f]() -> std::function<double (double)> {
+        return [&f](double x) -> double { return f(x); };
+      },
+      std::move(grid),
+      keys
+  );
+};
+
+namespace {
+
+const unsigned chebyshev_max_degree = 24;
+
+// cos(pi p (i + 1/2) / n): the value of the Chebyshev polynomial T_p at the
+// i-th Chebyshev node of the first kind, stored as c[p * n + i]
+std::vector<double> chebyshev_matrix(unsigned n) {
+  std::vector<double> c(n * n);
+  for (unsigned p = 0; p < n; ++p)
+    for (unsigned i = 0; i < n; ++i)
+      c[p * n + i] = cos(M_PI * p * (i + 0.5) / n);
+  return c;
+};
+
+// T_0(t), ..., T_{n-1}(t)
+inline void chebyshev_polynomials(unsigned n, double t, double* T) {
+  T[0] = 1;
+  T[1] = t;
+  for (unsigned p = 2; p < n; ++p) T[p] = 2 * t * T[p - 1] - T[p - 2];
+};
+
+void check_chebyshev_keys(const chebyshev_keys& keys) {
+  if (keys.degree < 2 || keys.degree > chebyshev_max_degree)
+    throw std::invalid_argument(
+        "epa::chebyshev_keys: degree must be between 2 and "
+        + std::to_string(chebyshev_max_degree)
+    );
+};
+
+}; // namespace
+
+struct Chebyshev1d::Data {
+  std::pair<double, double> range;
+  unsigned n; // number of coefficients on each piece
+  std::vector<double> breaks; // boundaries of the pieces in ascending order
+  std::vector<double> coefficients; // n per piece
+  double error = 0;
+  size_t evaluations = 0;
+};
+
+Chebyshev1d::Chebyshev1d(
+    const std::function<double (double)>& f,
+    std::pair<double, double> range,
+    double tolerance,
+    const chebyshev_keys& keys
+) {
+  check_chebyshev_keys(keys);
+  if (!(range.first < range.second))
+    throw std::invalid_argument("epa::Chebyshev1d: empty range");
+
+  auto data = std::make_shared<Data>();
+  data->range = range;
+  unsigned n = data->n = keys.degree + 1;
+  auto C = chebyshev_matrix(n);
+
+  struct Piece {
+    double   x0;
+    double   x1;
+    unsigned depth;
+  };
+
+  // accepted pieces with their coefficients; sorted once all are known
+  std::vector<std::pair<Piece, std::vector<double>>> leaves;
+
+  std::vector<Piece> pieces = { { range.first, range.second, 0 } };
+  std::vector<double> values;
+  while (!pieces.empty()) {
+    values.resize(pieces.size() * n);
+    parallel_for(
+        values.size(),
+        keys.threads,
+        [&](size_t k) {
+          const Piece& piece = pieces[k / n];
+          values[k] = f(
+              0.5 * (piece.x0 + piece.x1)
+            + 0.5 * (piece.x1 - piece.x0) * C[n + k % n]
+          );
+        }
+    );
+    data->evaluations += values.size();
+
+    std::vector<Piece> next;
+    for (size_t k = 0; k < pieces.size(); ++k) {
+      const Piece& piece = pieces[k];
+      const double* v = values.data() + k * n;
+
+      std::vector<double> c(n);
+      for (unsigned p = 0; p < n; ++p) {
+        double sum = 0;
+        for (unsigned i = 0; i < n; ++i) sum += v[i] * C[p * n + i];
+        c[p] = (p == 0 ? 1. : 2.) / n * sum;
+      };
+
+      double error = std::abs(c[n - 1]) + std::abs(c[n - 2]);
+      if (error <= tolerance || piece.depth >= keys.max_depth) {
+        if (!(error <= data->error)) data->error = error;
+        leaves.emplace_back(piece, std::move(c));
+        continue;
+      };
+
+      double split = 0.5 * (piece.x0 + piece.x1);
+      next.push_back({ piece.x0, split,    piece.depth + 1 });
+      next.push_back({ split,    piece.x1, piece.depth + 1 });
+    };
+    pieces = std::move(next);
+  };
+
+  std::sort(
+      leaves.begin(),
+      leaves.end(),
+      [](const auto& a, const auto& b) -> bool {
+        return a.first.x0 < b.first.x0;
+      }
+  );
+  data->breaks.reserve(leaves.size() + 1);
+  data->coefficients.reserve(leaves.size() * n);
+  for (const auto& leaf: leaves) {
+    data->breaks.push_back(leaf.first.x0);
+    data->coefficients.insert(
+        data->coefficients.end(), leaf.second.begin(), leaf.second.end()
+    );
+  };
+  data->breaks.push_back(range.second);
+
+  this->data = std::move(data);
+};
+
+bool Chebyshev1d::contains(double x) const {
+  return data->range.first <= x && x <= data->range.second;
+};
+
+double Chebyshev1d::operator()(double x) const {
+  if (!contains(x)) {
+    std::stringstream ss;
+    ss << "epa::Chebyshev1d: " << x << " is out of range";
+    throw std::out_of_range(ss.str());
+  };
+
+  const auto& breaks = data->breaks;
+  size_t k = std::upper_bound(breaks.begin() + 1, breaks.end() - 1, x)
+           - breaks.begin() - 1;
+  double t = (2 * x - breaks[k] - breaks[k + 1]) / (breaks[k + 1] - breaks[k]);
+
+  // Clenshaw recurrence
+  unsigned n = data->n;
+  const double* c = data->coefficients.data() + k * n;
+  double b1 = 0;
+  double b2 = 0;
+  for (unsigned p = n - 1; p > 0; --p) {
+    double b = 2 * t * b1 - b2 + c[p];
+    b2 = b1;
+    b1 = b;
+  };
+  return t * b1 - b2 + c[0];
+};
+
+double Chebyshev1d::error() const {
+  return data->error;
+};
+
+size_t Chebyshev1d::patches() const {
+  return data->breaks.size() - 1;
+};
+
+size_t Chebyshev1d::evaluations() const {
+  return data->evaluations;
+};
+
+struct Chebyshev2d::Data {
+  // Node of the tree that locates the patches. axis is 0 for a split along x,
+  // 1 for a split along y and -1 for a leaf.
+  struct Node {
+    int    axis;
+    double split;
+    size_t left;
+    size_t right;
+    size_t patch;
+  };
+
+  struct Patch {
+    double x0;
+    double x1;
+    double y0;
+    double y1;
+  };
+
+  std::pair<double, double> x_range;
+  std::pair<double, double> y_range;
+  unsigned n; // number of coefficients along each direction
+  std::vector<Node>   nodes;
+  std::vector<Patch>  patches;
+  std::vector<double> coefficients; // n * n per patch, c[p * n + q]
+  double error = 0;
+  size_t evaluations = 0;
+};
+
+Chebyshev2d::Chebyshev2d(
+    const std::function<double (double, double)>& f,
+    std::pair<double, double> x_range,
+    std::pair<double, double> y_range,
+    double tolerance,
+    const chebyshev_keys& keys
+) {
+  check_chebyshev_keys(keys);
+  if (!(x_range.first < x_range.second && y_range.first < y_range.second))
+    throw std::invalid_argument("epa::Chebyshev2d: empty range");
+
+  auto data = std::make_shared<Data>();
+  data->x_range = x_range;
+  data->y_range = y_range;
+  unsigned n = data->n = keys.degree + 1;
+  size_t m = n * n;
+  auto C = chebyshev_matrix(n);
+
+  struct Cell {
+    Data::Patch patch;
+    unsigned    depth;
+    size_t      node;
+  };
+
+  std::vector<Cell> cells = {
+    { { x_range.first, x_range.second, y_range.first, y_range.second }, 0, 0 }
+  };
+  data->nodes.push_back({ -1, 0, 0, 0, 0 });
+
+  std::vector<double> values;
+  std::vector<double> half(m);
+  std::vector<double> c(m);
+  while (!cells.empty()) {
+    values.resize(cells.size() * m);
+    parallel_for(
+        values.size(),
+        keys.threads,
+        [&](size_t k) {
+          const auto& patch = cells[k / m].patch;
+          unsigned i = k % m / n;
+          unsigned j = k % n;
+          double x = 0.5 * (patch.x0 + patch.x1)
+                   + 0.5 * (patch.x1 - patch.x0) * C[n + i];
+          double y = 0.5 * (patch.y0 + patch.y1)
+                   + 0.5 * (patch.y1 - patch.y0) * C[n + j];
+          values[k] = f(x, y);
+        }
+    );
+    data->evaluations += values.size();
+
+    std::vector<Cell> next;
+    for (size_t k = 0; k < cells.size(); ++k) {
+      const Cell& cell = cells[k];
+      const double* v = values.data() + k * m;
+
+      // discrete Chebyshev transform along y, then along x
+      for (unsigned i = 0; i < n; ++i)
+        for (unsigned q = 0; q < n; ++q) {
+          double sum = 0;
+          for (unsigned j = 0; j < n; ++j) sum += v[i * n + j] * C[q * n + j];
+          half[i * n + q] = (q == 0 ? 1. : 2.) / n * sum;
+        };
+      for (unsigned p = 0; p < n; ++p)
+        for (unsigned q = 0; q < n; ++q) {
+          double sum = 0;
+          for (unsigned i = 0; i < n; ++i) sum += half[i * n + q] * C[p * n + i];
+          c[p * n + q] = (p == 0 ? 1. : 2.) / n * sum;
+        };
+
+      double tail_x = 0;
+      double tail_y = 0;
+      for (unsigned l = 0; l < n; ++l) {
+        tail_x += std::abs(c[(n - 1) * n + l]) + std::abs(c[(n - 2) * n + l]);
+        tail_y += std::abs(c[l * n + n - 1])   + std::abs(c[l * n + n - 2]);
+      };
+      double error = tail_x + tail_y;
+
+      if (error <= tolerance || cell.depth >= keys.max_depth) {
+        auto& node = data->nodes[cell.node];
+        node.axis  = -1;
+        node.patch = data->patches.size();
+        data->patches.push_back(cell.patch);
+        data->coefficients.insert(data->coefficients.end(), c.begin(), c.end());
+        if (!(error <= data->error)) data->error = error;
+        continue;
+      };
+
+      int axis = tail_x >= tail_y ? 0 : 1;
+      Cell left  = { cell.patch, cell.depth + 1, data->nodes.size() };
+      Cell right = { cell.patch, cell.depth + 1, data->nodes.size() + 1 };
+      double split;
+      if (axis == 0) {
+        split = 0.5 * (cell.patch.x0 + cell.patch.x1);
+        left.patch.x1 = right.patch.x0 = split;
+      } else {
+        split = 0.5 * (cell.patch.y0 + cell.patch.y1);
+        left.patch.y1 = right.patch.y0 = split;
+      };
+      data->nodes[cell.node] = { axis, split, left.node, right.node, 0 };
+      data->nodes.push_back({ -1, 0, 0, 0, 0 });
+      data->nodes.push_back({ -1, 0, 0, 0, 0 });
+      next.push_back(left);
+      next.push_back(right);
+    };
+    cells = std::move(next);
+  };
+
+  this->data = std::move(data);
+};
+
+bool Chebyshev2d::contains(double x, double y) const {
+  return data->x_range.first <= x && x <= data->x_range.second
+      && data->y_range.first <= y && y <= data->y_range.second;
+};
+
+double Chebyshev2d::operator()(double x, double y) const {
+  if (!contains(x, y)) {
+    std::stringstream ss;
+    ss << "epa::Chebyshev2d: (" << x << ", " << y << ") is out of range";
+    throw std::out_of_range(ss.str());
+  };
+
+  const auto& nodes = data->nodes;
+  size_t k = 0;
+  while (nodes[k].axis >= 0)
+    k = (nodes[k].axis == 0 ? x : y) < nodes[k].split
+      ? nodes[k].left
+      : nodes[k].right;
+
+  const auto& patch = data->patches[nodes[k].patch];
+  unsigned n = data->n;
+  double Tx[chebyshev_max_degree + 1];
+  double Ty[chebyshev_max_degree + 1];
+  chebyshev_polynomials(
+      n, (2 * x - patch.x0 - patch.x1) / (patch.x1 - patch.x0), Tx
+  );
+  chebyshev_polynomials(
+      n, (2 * y - patch.y0 - patch.y1) / (patch.y1 - patch.y0), Ty
+  );
+
+  const double* c = data->coefficients.data() + nodes[k].patch * n * n;
+  double result = 0;
+  for (unsigned p = 0; p < n; ++p) {
+    double sum = 0;
+    for (unsigned q = 0; q < n; ++q) sum += c[p * n + q] * Ty[q];
+    result += Tx[p] * sum;
+  };
+  return result;
+};
+
+double Chebyshev2d::error() const {
+  return data->error;
+};
+
+size_t Chebyshev2d::patches() const {
+  return data->patches.size();
+};
+
+size_t Chebyshev2d::evaluations() const {
+  return data->evaluations;
+};
+
 }; // namespace epa
@@ -0,0 +1,469 @@
+#include <algorithm>
+#include <cmath>
+
+#include <epa/bessel.hpp>
+
+namespace epa {
+
+// Rational and polynomial approximations from Boost.Math,
+// boost/math/special_functions/detail/bessel_k0.hpp, bessel_k1.hpp,
+// bessel_i0.hpp and bessel_i1.hpp (53-bit variants). Copyright John Maddock
+// 2006, 2017. Distributed under the Boost Software License, Version 1.0.
+
+namespace {
+
+// c[0] + c[1] x + ... + c[N - 1] x^{N - 1}, unrolled at compile time so that
+// the loops calling it can be vectorized
+template <size_t N, size_t I = 0>
+inline double polynomial(const double (&c)[N], double x) {
+  if constexpr (I + 1 == N)
+    return c[I];
+  else
+    return c[I] + x * polynomial<N, I + 1>(c, x);
+};
+
+// x <= 1; l = log(x)
+inline double K0_small(double x, double l) {
+  static const double Y = 1.137250900268554688;
+  static const double P[] = {
+    -1.372509002685546267e-01,
+     2.574916117833312855e-01,
+     1.395474602146869316e-02,
+     5.445476986653926759e-04,
+     7.125159422136622118e-06
+  };
+  static const double Q[] = {
+     1.000000000000000000e+00,
+    -5.458333438017788530e-02,
+     1.291052816975251298e-03,
+    -1.367653946978586591e-05
+  };
+  static const double P2[] = {
+    1.159315156584124484e-01,
+    2.789828789146031732e-01,
+    2.524892993216121934e-02,
+    8.460350907213637784e-04,
+    1.491471924309617534e-05,
+    1.627106892422088488e-07,
+    1.208266102392756055e-09,
+    6.611686391749704310e-12
+  };
+  double x2 = x * x;
+  double a  = 0.25 * x2;
+  a = (polynomial(P, a) / polynomial(Q, a) + Y) * a + 1;
+  return polynomial(P2, x2) - l * a;
+};
+
+// x > 1; e = exp(-x) / sqrt(x)
+inline double K0_large(double x, double e) {
+  static const double P[] = {
+     2.533141373155002416e-01,
+     3.628342133984595192e+00,
+     1.868441889406606057e+01,
+     4.306243981063412784e+01,
+     4.424116209627428189e+01,
+     1.562095339356220468e+01,
+    -1.810138978229410898e+00,
+    -1.414237994269995877e+00,
+    -9.369168119754924625e-02
+  };
+  static const double Q[] = {
+    1.000000000000000000e+00,
+    1.494194694879908328e+01,
+    8.265296455388554217e+01,
+    2.162779506621866970e+02,
+    2.845145155184222157e+02,
+    1.851714491916334995e+02,
+    5.486540717439723515e+01,
+    6.118075837628957015e+00,
+    1.586261269326235053e-01
+  };
+  double u = 1 / x;
+  return (polynomial(P, u) / polynomial(Q, u) + 1) * e;
+};
+
+// x <= 1; l = log(x)
+inline double K1_small(double x, double l) {
+  static const double Y = 8.69547128677368164e-02;
+  static const double P[] = {
+    -3.62137953440350228e-03,
+     7.11842087490330300e-03,
+     1.00302560256614306e-05,
+     1.77231085381040811e-06
+  };
+  static const double Q[] = {
+     1.00000000000000000e+00,
+    -4.80414794429043831e-02,
+     9.85972641934416525e-04,
+    -8.91196859397070326e-06
+  };
+  static const double P2[] = {
+    -3.07965757829206184e-01,
+    -7.80929703673074907e-02,
+    -2.70619343754051620e-03,
+    -2.49549522229072008e-05
+  };
+  static const double Q2[] = {
+     1.00000000000000000e+00,
+    -2.36316836412163098e-02,
+     2.64524577525962719e-04,
+    -1.49749618004162787e-06
+  };
+  double x2 = x * x;
+  double a  = 0.25 * x2;
+  a = ((polynomial(P, a) / polynomial(Q, a) + Y) * a * a + 0.5 * a + 1)
+    * 0.5 * x;
+  return polynomial(P2, x2) / polynomial(Q2, x2) * x + 1 / x + l * a;
+};
+
+// x > 1; e = exp(-x) / sqrt(x)
+inline double K1_large(double x, double e) {
+  static const double Y = 1.45034217834472656;
+  static const double P[] = {
+    -1.97028041029226295e-01,
+    -2.32408961548087617e+00,
+    -7.98269784507699938e+00,
+    -2.39968410774221632e+00,
+     3.28314043780858713e+01,
+     5.67713761158496058e+01,
+     3.30907788466509823e+01,
+     6.62582288933739787e+00,
+     3.08851840645286691e-01
+  };
+  static const double Q[] = {
+    1.00000000000000000e+00,
+    1.41811409298826118e+01,
+    7.35979466317556420e+01,
+    1.77821793937080859e+02,
+    2.11014501598705982e+02,
+    1.19425262951064454e+02,
+    2.88448064302447607e+01,
+    2.27912927104139732e+00,
+    2.50358186953478678e-02
+  };
+  double u = 1 / x;
+  return (polynomial(P, u) / polynomial(Q, u) + Y) * e;
+};
+
+// x < 7.75; I0(x) without scaling
+inline double I0_small(double x) {
+  static const double P[] = {
+    1.00000000000000000e+00,
+    2.49999999999999909e-01,
+    2.77777777777782257e-02,
+    1.73611111111023792e-03,
+    6.94444444453352521e-05,
+    1.92901234513219920e-06,
+    3.93675991102510739e-08,
+    6.15118672704439289e-10,
+    7.59407002058973446e-12,
+    7.59389793369836367e-14,
+    6.27767773636292611e-16,
+    4.34709704153272287e-18,
+    2.63417742690109154e-20,
+    1.13943037744822825e-22,
+    9.07926920085624812e-25
+  };
+  double a = 0.25 * x * x;
+  return a * polynomial(P, a) + 1;
+};
+
+// x < 7.75; I1(x) without scaling
+inline double I1_small(double x) {
+  static const double P[] = {
+    8.333333333333333803e-02,
+    6.944444444444341983e-03,
+    3.472222222225921045e-04,
+    1.157407407354987232e-05,
+    2.755731926254790268e-07,
+    4.920949692800671435e-09,
+    6.834657311305621830e-11,
+    7.593969849687574339e-13,
+    6.904822652741917551e-15,
+    5.220157095351373194e-17,
+    3.410720494727771276e-19,
+    1.625212890947171108e-21,
+    1.332898928162290861e-23
+  };
+  double a = 0.25 * x * x;
+  return 0.5 * x * ((polynomial(P, a) * a + 0.5) * a + 1);
+};
+
+// x < 2; I2(x) without scaling, from the series
+// I2(x) = a sum_k a^k / (k! (k + 2)!), a = x^2 / 4
+inline double I2_small(double x) {
+  static const double P[] = {
+    1. / 2,
+    1. / 6,
+    1. / 48,
+    1. / 720,
+    1. / 17280,
+    1. / 604800,
+    1. / 29030400,
+    1. / 1828915200,
+    1. / 146313216000,
+    1. / 14485008384000,
+    1. / 1738201006080000,
+    1. / 248562743869440000.,
+    1. / 41758540970065920000.
+  };
+  double a = 0.25 * x * x;
+  return a * polynomial(P, a);
+};
+
+// x >= 7.75; u = 1 / x; sqrt(x) exp(-x) I0(x)
+inline double I0_large(double x, double u) {
+  static const double P[] = {
+     3.98942280401425088e-01,
+     4.98677850604961985e-02,
+     2.80506233928312623e-02,
+     2.92211225166047873e-02,
+     4.44207299493659561e-02,
+     1.30970574605856719e-01,
+    -3.35052280231727022e+00,
+     2.33025711583514727e+02,
+    -1.13366350697172355e+04,
+     4.24057674317867331e+05,
+    -1.23157028595698731e+07,
+     2.80231938155267516e+08,
+    -5.01883999713777929e+09,
+     7.08029243015109113e+10,
+    -7.84261082124811106e+11,
+     6.76825737854096565e+12,
+    -4.49034849696138065e+13,
+     2.24155239966958995e+14,
+    -8.13426467865659318e+14,
+     2.02391097391687777e+15,
+    -3.08675715295370878e+15,
+     2.17587543863819074e+15
+  };
+  static const double P500[] = {
+    3.98942280401432905e-01,
+    4.98677850491434560e-02,
+    2.80506308916506102e-02,
+    2.92179096853915176e-02,
+    4.53371208762579442e-02
+  };
+  return x < 500 ? polynomial(P, u) : polynomial(P500, u);
+};
+
+// x >= 7.75; u = 1 / x; sqrt(x) exp(-x) I1(x)
+inline double I1_large(double x, double u) {
+  static const double P[] = {
+     3.989422804014406054e-01,
+    -1.496033551613111533e-01,
+    -4.675104253598537322e-02,
+    -4.090895951581637791e-02,
+    -5.719036414430205390e-02,
+    -1.528189554374492735e-01,
+     3.458284470977172076e+00,
+    -2.426181371595021021e+02,
+     1.178785865993440669e+04,
+    -4.404655582443487334e+05,
+     1.277677779341446497e+07,
+    -2.903390398236656519e+08,
+     5.192386898222206474e+09,
+    -7.313784438967834057e+10,
+     8.087824484994859552e+11,
+    -6.967602516005787001e+12,
+     4.614040809616582764e+13,
+    -2.298849639457172489e+14,
+     8.325554073334618015e+14,
+    -2.067285045778906105e+15,
+     3.146401654361325073e+15,
+    -2.213318202179221945e+15
+  };
+  static const double P500[] = {
+     3.989422804014314820e-01,
+    -1.496033551467584157e-01,
+    -4.675105322571775911e-02,
+    -4.090421597376992892e-02,
+    -5.843630344778927582e-02
+  };
+  return x < 500 ? polynomial(P, u) : polynomial(P500, u);
+};
+
+// the boundary between the power series and the asymptotic forms of I0 and I1
+const double I_large = 7.75;
+
+// below this point I2 is calculated from its series rather than from the
+// recurrence I2 = I0 - 2 I1 / x, which loses accuracy at small x
+const double I2_small_max = 2;
+
+// Scaled I0, I1 and I2 given x and the quantities that depend on x through
+// transcendental functions: e = exp(-x) for x < I_large and r = 1 / sqrt(x)
+// otherwise; u = 1 / x.
+inline BesselI012 I012_scaled(double x, double u, double e, double r) {
+  BesselI012 result;
+  if (x < I_large) {
+    result.I0 = e * I0_small(x);
+    result.I1 = e * I1_small(x);
+  } else {
+    result.I0 = r * I0_large(x, u);
+    result.I1 = r * I1_large(x, u);
+  };
+  if (x < I2_small_max)
+    result.I2 = e * I2_small(x);
+  else
+    result.I2 = result.I0 - 2 * u * result.I1;
+  return result;
+};
+
+// gsl::bessel_K0 and gsl::bessel_K1 return 0 after this point to avoid
+// underflow errors
+const double x_max = 700;
+
+// the transcendental part shared by K0 and K1: log(x) for x <= 1 and
+// exp(-x) / sqrt(x) for x > 1
+inline double transcendental(double x) {
+  return x <= 1 ? log(x) : exp(-x) / sqrt(x);
+};
+
+// The batch functions below process the points in blocks: the transcendental
+// functions are called in one loop, and the rational approximations for both
+// ranges are evaluated in another loop without branches, which the compiler
+// can turn into SIMD instructions.
+const size_t block = 64;
+
+}; // namespace
+
+double bessel_K0(double x) {
+  if (x > x_max) return 0;
+  double t = transcendental(x);
+  return x <= 1 ? K0_small(x, t) : K0_large(x, t);
+};
+
+double bessel_K1(double x) {
+  if (x > x_max) return 0;
+  double t = transcendental(x);
+  return x <= 1 ? K1_small(x, t) : K1_large(x, t);
+};
+
+BesselK01 bessel_K01(double x) {
+  if (x > x_max) return { 0, 0 };
+  double t = transcendental(x);
+  if (x <= 1) return { K0_small(x, t), K1_small(x, t) };
+  return { K0_large(x, t), K1_large(x, t) };
+};
+
+void bessel_K0(size_t n, const double* x, double* y) {
+  double t[block];
+  for (size_t start = 0; start < n; start += block) {
+    size_t m = std::min(block, n - start);
+    const double* z = x + start;
+    for (size_t i = 0; i < m; ++i) t[i] = transcendental(z[i]);
+    double* k = y + start;
+#pragma omp simd
+    for (size_t i = 0; i < m; ++i) {
+      double small = K0_small(z[i], t[i]);
+      double large = K0_large(z[i], t[i]);
+      k[i] = z[i] > x_max ? 0 : z[i] <= 1 ? small : large;
+    };
+  };
+};
+
+void bessel_K1(size_t n, const double* x, double* y) {
+  double t[block];
+  for (size_t start = 0; start < n; start += block) {
+    size_t m = std::min(block, n - start);
+    const double* z = x + start;
+    for (size_t i = 0; i < m; ++i) t[i] = transcendental(z[i]);
+    double* k = y + start;
+#pragma omp simd
+    for (size_t i = 0; i < m; ++i) {
+      double small = K1_small(z[i], t[i]);
+      double large = K1_large(z[i], t[i]);
+      k[i] = z[i] > x_max ? 0 : z[i] <= 1 ? small : large;
+    };
+  };
+};
+
+void bessel_K01(size_t n, const double* x, double* k0, double* k1) {
+  double t[block];
+  for (size_t start = 0; start < n; start += block) {
+    size_t m = std::min(block, n - start);
+    const double* z = x + start;
+    for (size_t i = 0; i < m; ++i) t[i] = transcendental(z[i]);
+    double* y0 = k0 + start;
+    double* y1 = k1 + start;
+#pragma omp simd
+    for (size_t i = 0; i < m; ++i) {
+      bool small = z[i] <= 1;
+      bool zero  = z[i] > x_max;
+      double s0 = K0_small(z[i], t[i]);
+      double l0 = K0_large(z[i], t[i]);
+      double s1 = K1_small(z[i], t[i]);
+      double l1 = K1_large(z[i], t[i]);
+      y0[i] = zero ? 0 : small ? s0 : l0;
+      y1[i] = zero ? 0 : small ? s1 : l1;
+    };
+  };
+};
+
+double bessel_I0_scaled(double x) {
+  if (x < I_large) return exp(-x) * I0_small(x);
+  return 1 / sqrt(x) * I0_large(x, 1 / x);
+};
+
+double bessel_I1_scaled(double x) {
+  if (x < I_large) return exp(-x) * I1_small(x);
+  return 1 / sqrt(x) * I1_large(x, 1 / x);
+};
+
+double bessel_I2_scaled(double x) {
+  if (x < I2_small_max) return exp(-x) * I2_small(x);
+  return bessel_I012_scaled(x).I2;
+};
+
+BesselI012 bessel_I012_scaled(double x) {
+  if (x < I_large) return I012_scaled(x, 1 / x, exp(-x), 0);
+  return I012_scaled(x, 1 / x, 0, 1 / sqrt(x));
+};
+
+std::pair<BesselI012, BesselI012> bessel_I012_scaled_2x(double x) {
+  const double sqrt1_2 = 0.70710678118654752440;
+  double u = 1 / x;
+  double e = 0;
+  double r = 0;
+  if (x < I_large) e = exp(-x);
+  if (2 * x >= I_large) r = 1 / sqrt(x);
+  return {
+    I012_scaled(x,     u,       e,     r),
+    I012_scaled(2 * x, 0.5 * u, e * e, sqrt1_2 * r)
+  };
+};
+
+void bessel_I012_scaled(
+    size_t n, const double* x, double* i0, double* i1, double* i2
+) {
+  double e[block];
+  double r[block];
+  for (size_t start = 0; start < n; start += block) {
+    size_t m = std::min(block, n - start);
+    const double* z = x + start;
+    for (size_t i = 0; i < m; ++i) {
+      e[i] = exp(-z[i]);
+      r[i] = 1 / sqrt(z[i]);
+    };
+    double* y0 = i0 + start;
+    double* y1 = i1 + start;
+    double* y2 = i2 + start;
+#pragma omp simd
+    for (size_t i = 0; i < m; ++i) {
+      double u = 1 / z[i];
+      bool small = z[i] < I_large;
+      double s0 = e[i] * I0_small(z[i]);
+      double s1 = e[i] * I1_small(z[i]);
+      double s2 = e[i] * I2_small(z[i]);
+      double l0 = r[i] * I0_large(z[i], u);
+      double l1 = r[i] * I1_large(z[i], u);
+      double b0 = small ? s0 : l0;
+      double b1 = small ? s1 : l1;
+      y0[i] = b0;
+      y1[i] = b1;
+      y2[i] = z[i] < I2_small_max ? s2 : b0 - 2 * u * b1;
+    };
+  };
+};
+
+}; // namespace epa
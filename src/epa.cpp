@@ -1,5 +1,10 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <cmath>
+#include <limits>
 
+#include <epa/compose.hpp>
 #include <epa/epa.hpp>
 
 namespace epa {
@@ -11,6 +16,7 @@ double default_relative_error          = 1e-3;
 double default_error_step              = 1e-1;
 size_t default_integration_limit       = 1000;
 size_t default_cquad_integration_limit = 100;
+size_t default_cubature_max_evaluations = 10000000;
 gsl::integration::QAGMethod default_integration_method
   = gsl::integration::GAUSS41;
 
@@ -20,28 +26,55 @@ std::function<Integrator (unsigned)> default_integrator
 std::function<Integrator_I (unsigned)> default_integrator_i
   = static_cast<Integrator_I (*)(unsigned)>(qag_integrator_i);
 
+std::function<Integrator_Hankel (unsigned)> default_integrator_hankel
+  = static_cast<Integrator_Hankel (*)(unsigned)>(ogata_integrator);
+
+std::function<Integrator_batch (unsigned)> default_batch_integrator
+  = static_cast<Integrator_batch (*)(unsigned)>(batch_integrator);
+
+// State of the profiler on this thread: the name of the call site set by
+// IntegrationSite and the error estimate slot of the innermost
+// profiled_integrator
+static thread_local const char* integration_site   = nullptr;
+static thread_local double*     integration_abserr = nullptr;
+
+// Passes the error estimate of an integral to the profiler and returns the
+// integral
+template <typename Result>
+static double report(const Result& r) {
+  if (integration_abserr) *integration_abserr = r.abserr;
+  return r.result;
+};
+
 Integrator qag_integrator(
     double absolute_error,
     double relative_error,
     gsl::integration::QAGMethod method,
     std::shared_ptr<gsl::integration::QAGWorkspace> workspace
 ) {
-  if (!workspace)
-    workspace = std::make_shared<gsl::integration::QAGWorkspace>(
-        default_integration_limit
-    );
+  if (!workspace) {
+    size_t limit = default_integration_limit;
+    return [=](const std::function<double (double)>& f, double a, double b)
+           -> double {
+      return report(
+          gsl::integrate(f, a, b, absolute_error, relative_error, limit, method)
+      );
+    };
+  };
   return [=](const std::function<double (double)>& f, double a, double b)
          -> double {
-    return gsl::integrate(
-        f,
-        a,
-        b,
-        absolute_error,
-        relative_error,
-        workspace->limit(),
-        method,
-        *workspace
-    ).result;
+    return report(
+        gsl::integrate(
+          f,
+          a,
+          b,
+          absolute_error,
+          relative_error,
+          workspace->limit(),
+          method,
+          *workspace
+        )
+    );
   };
 };
 
@@ -68,26 +101,103 @@ qag_integrator_generator(double relative_error, double error_step) {
   };
 };
 
+Integrator gk_integrator(
+    double absolute_error,
+    double relative_error,
+    gsl::integration::QAGMethod method,
+    size_t limit
+) {
+  return [=](const std::function<double (double)>& f, double a, double b)
+         -> double {
+    return report(
+        quadpack::qag(f, a, b, absolute_error, relative_error, limit, method)
+    );
+  };
+};
+
+Integrator gk_integrator(const gk_integrator_keys& keys) {
+  return gk_integrator(
+      keys.absolute_error, keys.relative_error, keys.method, keys.limit
+  );
+};
+
+Integrator gk_integrator(unsigned level) {
+  return gk_integrator(
+      default_absolute_error,
+      default_relative_error * pow(default_error_step, level)
+  );
+};
+
+std::function<Integrator (unsigned)>
+gk_integrator_generator(double relative_error, double error_step) {
+  return [=](unsigned level) -> Integrator {
+    return gk_integrator(0, relative_error * pow(error_step, level));
+  };
+};
+
+Integrator de_integrator(
+    double absolute_error, double relative_error, unsigned max_level
+) {
+  return [=](const std::function<double (double)>& f, double a, double b)
+         -> double {
+    return report(
+        integration::double_exponential(
+          f, a, b, absolute_error, relative_error, max_level
+        )
+    );
+  };
+};
+
+Integrator de_integrator(const de_integrator_keys& keys) {
+  return de_integrator(
+      keys.absolute_error, keys.relative_error, keys.max_level
+  );
+};
+
+Integrator de_integrator(unsigned level) {
+  return de_integrator(
+      default_absolute_error,
+      default_relative_error * pow(default_error_step, level)
+  );
+};
+
+std::function<Integrator (unsigned)>
+de_integrator_generator(double relative_error, double error_step) {
+  return [=](unsigned level) -> Integrator {
+    return de_integrator(0, relative_error * pow(error_step, level));
+  };
+};
+
 Integrator cquad_integrator(
     double absolute_error,
     double relative_error,
     std::shared_ptr<gsl::integration::CQuadWorkspace> workspace
 ) {
-  if (!workspace)
-    workspace = std::make_shared<gsl::integration::CQuadWorkspace>(
-        default_cquad_integration_limit
-    );
+  if (!workspace) {
+    size_t limit = default_cquad_integration_limit;
+    return [=](
+        const std::function<double (double)>& f, double a, double b
+    ) -> double {
+      return report(
+          gsl::integration::cquad(
+            f, a, b, absolute_error, relative_error, limit
+          )
+      );
+    };
+  };
   return [=](
       const std::function<double (double)>& f, double a, double b
   ) -> double {
-    return gsl::integration::cquad(
-        f,
-        a,
-        b,
-        absolute_error,
-        relative_error,
-        *workspace
-    ).result;
+    return report(
+        gsl::integration::cquad(
+          f,
+          a,
+          b,
+          absolute_error,
+          relative_error,
+          *workspace
+        )
+    );
   };
 };
 
@@ -106,15 +216,266 @@ Integrator cquad_integrator(unsigned level) {
   );
 };
 
+Integrator parallel_integrator(
+    double absolute_error,
+    double relative_error,
+    gsl::integration::QAGMethod method,
+    unsigned threads
+) {
+  size_t limit = default_integration_limit;
+  return [=](const std::function<double (double)>& f, double a, double b)
+         -> double {
+    return report(
+        integration::parallel_qag(
+          f, a, b, absolute_error, relative_error, limit, method, threads
+        )
+    );
+  };
+};
+
+Integrator parallel_integrator(const parallel_integrator_keys& keys) {
+  return parallel_integrator(
+      keys.absolute_error,
+      keys.relative_error,
+      keys.method,
+      keys.threads
+  );
+};
+
+std::function<Integrator (unsigned)>
+parallel_integrator_generator(unsigned parallel_level, unsigned threads) {
+  return [=](unsigned level) -> Integrator {
+    if (level != parallel_level) return default_integrator(level);
+    return parallel_integrator(
+        default_absolute_error,
+        default_relative_error * pow(default_error_step, level),
+        default_integration_method,
+        threads
+    );
+  };
+};
+
+IntegrationStats& IntegrationStats::operator+=(const IntegrationStats& s) {
+  calls      += s.calls;
+  nevals     += s.nevals;
+  failures   += s.failures;
+  limit_hits += s.limit_hits;
+  max_abserr  = std::max(max_abserr, s.max_abserr);
+  max_relerr  = std::max(max_relerr, s.max_relerr);
+  time       += s.time;
+  return *this;
+};
+
+void IntegrationProfile::add(
+    const char* site, unsigned level, const IntegrationStats& s
+) {
+  std::lock_guard<std::mutex> lock(mutex);
+  stats[{ site ? site : "", level }] += s;
+};
+
+std::vector<IntegrationProfile::Entry> IntegrationProfile::entries() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<Entry> result;
+  result.reserve(stats.size());
+  for (auto& s: stats)
+    result.push_back({ s.first.first, s.first.second, s.second });
+  return result;
+};
+
+void IntegrationProfile::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  stats.clear();
+};
+
+std::string IntegrationProfile::report() const {
+  std::string result
+    = "site     level      calls       nevals  failures  limit_hits"
+      "  max_abserr  max_relerr      time, s\n";
+  char line[160];
+  for (auto& e: entries()) {
+    snprintf(
+        line,
+        sizeof(line),
+        "%-8s %5u %10zu %12zu %9zu %11zu %11.3e %11.3e %12.6f\n",
+        e.site.empty() ? "-" : e.site.c_str(),
+        e.level,
+        e.stats.calls,
+        e.stats.nevals,
+        e.stats.failures,
+        e.stats.limit_hits,
+        e.stats.max_abserr,
+        e.stats.max_relerr,
+        e.stats.time
+    );
+    result += line;
+  };
+  return result;
+};
+
+IntegrationSite::IntegrationSite(const char* name):
+  previous(integration_site)
+{
+  integration_site = name;
+};
+
+IntegrationSite::~IntegrationSite() {
+  integration_site = previous;
+};
+
+const char* IntegrationSite::current() {
+  return integration_site;
+};
+
+// Sets the state of the profiler on this thread for the lifetime of the object
+class ProfilerState {
+  public:
+    ProfilerState(const char* site, double* abserr):
+      site_(integration_site), abserr_(integration_abserr)
+    {
+      integration_site   = site;
+      integration_abserr = abserr;
+    };
+
+    ~ProfilerState() {
+      integration_site   = site_;
+      integration_abserr = abserr_;
+    };
+
+  private:
+    const char* site_;
+    double*     abserr_;
+};
+
+Integrator profiled_integrator(
+    Integrator integrate,
+    unsigned level,
+    std::shared_ptr<IntegrationProfile> profile
+) {
+  if (!profile)
+    throw std::invalid_argument("epa::profiled_integrator: profile is null");
+  return [=](const std::function<double (double)>& f, double a, double b)
+         -> double {
+    const char* site = integration_site;
+    std::atomic<size_t> nevals = 0;
+    double abserr = 0;
+    IntegrationStats stats;
+    stats.calls = 1;
+
+    auto start = std::chrono::steady_clock::now();
+    auto record = [&]() {
+      stats.nevals = nevals;
+      stats.time   = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start
+                     ).count();
+      profile->add(site, level, stats);
+    };
+
+    double result;
+    try {
+      // the integrals in f are attributed to their own call sites and
+      // profiled integrators, never to this one
+      ProfilerState state(site, &abserr);
+      result = integrate(
+          [&](double x) -> double {
+            ++nevals;
+            ProfilerState state(nullptr, nullptr);
+            return f(x);
+          },
+          a,
+          b
+      );
+    } catch (gsl::Error& error) {
+      ++stats.failures;
+      if (error.err() == GSL_EMAXITER) ++stats.limit_hits;
+      record();
+      throw;
+    } catch (...) {
+      ++stats.failures;
+      record();
+      throw;
+    };
+
+    stats.max_abserr = abserr;
+    if (result != 0) stats.max_relerr = abserr / fabs(result);
+    record();
+    return result;
+  };
+};
+
+std::function<Integrator (unsigned)>
+profiled_integrator_generator(
+    std::function<Integrator (unsigned)> generator,
+    std::shared_ptr<IntegrationProfile> profile
+) {
+  if (!profile)
+    throw std::invalid_argument(
+        "epa::profiled_integrator_generator: profile is null"
+    );
+  return [generator = std::move(generator), profile = std::move(profile)](
+      unsigned level
+  ) -> Integrator {
+    return profiled_integrator(generator(level), level, profile);
+  };
+};
+
+Integrator_batch batch_integrator(
+    double absolute_error,
+    double relative_error,
+    gsl::integration::QAGMethod method
+) {
+  size_t limit = default_integration_limit;
+  return [=](const integration::Batch_function& f, double a, double b)
+         -> double {
+    return integration::qag(
+        f, a, b, absolute_error, relative_error, limit, method
+    ).result;
+  };
+};
+
+Integrator_batch batch_integrator(const batch_integrator_keys& keys) {
+  return batch_integrator(
+      keys.absolute_error,
+      keys.relative_error,
+      keys.method
+  );
+};
+
+Integrator_batch batch_integrator(unsigned level) {
+  return batch_integrator(
+      default_absolute_error,
+      default_relative_error * pow(default_error_step, level)
+  );
+};
+
+Integrator scalar_integrator(Integrator_batch integrate) {
+  return [integrate = std::move(integrate)](
+      const std::function<double (double)>& f, double a, double b
+  ) -> double {
+    return integrate(
+        [&f](size_t n, const double* x, double* fx) {
+          for (size_t i = 0; i < n; ++i) fx[i] = f(x[i]);
+        },
+        a,
+        b
+    );
+  };
+};
+
 Integrator_I qag_integrator_i(
     double relative_error,
     gsl::integration::QAGMethod method,
     std::shared_ptr<gsl::integration::QAGWorkspace> workspace
 ) {
-  if (!workspace)
-    workspace = std::make_shared<gsl::integration::QAGWorkspace>(
-        default_integration_limit
-    );
+  if (!workspace) {
+    size_t limit = default_integration_limit;
+    return [=](
+        const std::function<double (double)>& f, double a, double b, double I
+    ) -> double {
+      return gsl::integrate(
+          f, a, b, relative_error * abs(I), relative_error, limit, method
+      ).result;
+    };
+  };
   return [=](
       const std::function<double (double)>& f, double a, double b, double I
   ) -> double {
@@ -143,163 +504,508 @@ Integrator_I qag_integrator_i(unsigned level) {
   return qag_integrator_i(default_relative_error * pow(default_error_step, level));
 };
 
-FormFactor form_factor_monopole(double lambda2) {
-  return [=](double q2) -> double {
-    return 1. / (1 + q2 / lambda2);
+Integrator_Hankel ogata_integrator(
+    double absolute_error, double relative_error, unsigned max_level
+) {
+  return [=](const std::function<double (double)>& f, double b) -> double {
+    return integration::hankel(
+        f, b, absolute_error, relative_error, max_level
+    ).result;
   };
 };
 
-FormFactor form_factor_dipole(double lambda2) {
-  return [=](double q2) -> double {
-    return 1. / sqr(1 + q2 / lambda2);
-  };
+Integrator_Hankel ogata_integrator(const ogata_integrator_keys& keys) {
+  return ogata_integrator(
+      keys.absolute_error,
+      keys.relative_error,
+      keys.max_level
+  );
 };
 
-Spectrum
-spectrum(
-    unsigned Z, double gamma, FormFactor form_factor, Integrator integrate
-) {
-  auto wg2 = std::make_shared<double>();
-
-  auto iqt = [=, F = std::move(form_factor)](double qt) -> double {
-    EPA_TRY
-      double q2 = sqr(qt) + *wg2;
-      return qt * sqr(qt / q2 * F(q2));
-    EPA_BACKTRACE("lambda (qt) %e", qt);
-  };
-
-  double c = 2 * sqr(Z) * alpha / pi;
+Integrator_Hankel ogata_integrator(unsigned level) {
+  return ogata_integrator(
+      default_absolute_error,
+      default_relative_error * pow(default_error_step, level)
+  );
+};
 
-  return [=, integrate = std::move(integrate)](double w) -> double {
-    EPA_TRY
-      *wg2 = sqr(w / gamma);
-      return c / w * integrate(iqt, 0, infinity);
-    EPA_BACKTRACE("lambda (w) %e\n  defined in epa::spectrum(%u, %e)", w, Z, gamma);
+Integrator_Hankel oscillatory_integrator(
+    double absolute_error,
+    double relative_error,
+    gsl::integration::QAGMethod method,
+    size_t max_terms
+) {
+  size_t limit = default_integration_limit;
+  return [=](const std::function<double (double)>& f, double b) -> double {
+    return integration::hankel_tail(
+        f, b, 0, absolute_error, relative_error, limit, method, max_terms
+    ).result;
   };
 };
 
-Spectrum
-spectrum_monopole(unsigned Z, double gamma, double lambda2) {
-  double c = sqr(Z) * alpha / pi;
-  return [=](double w) -> double {
-    double x = sqr(w / gamma) / lambda2;
-//    if (x > 1.4e4) return 0; // prevent roundoff errors
-    return c / w * ((1 + 2 * x) * log(1 + 1. / x) - 2);
-  };
+Integrator_Hankel oscillatory_integrator(
+    const oscillatory_integrator_keys& keys
+) {
+  return oscillatory_integrator(
+      keys.absolute_error,
+      keys.relative_error,
+      keys.method,
+      keys.max_terms
+  );
 };
 
-Spectrum
-spectrum_dipole(unsigned Z, double gamma, double lambda2) {
-  double c = sqr(Z) * alpha / pi;
-  return [=](double w) -> double {
-    double x = sqr(w / gamma) / lambda2;
-//    if (x > 200) return 0; // prevent roundoff errors
-    return c / w * (
-       (1 + 4 * x) * log(1 + 1. / x)
-       - ((24 * x + 42) * x + 17) / (6 * sqr(x + 1))
-    );
-  };
+Integrator_Hankel oscillatory_integrator(unsigned level) {
+  return oscillatory_integrator(
+      default_absolute_error,
+      default_relative_error * pow(default_error_step, level)
+  );
 };
 
-Spectrum_b
-spectrum_b(
-    unsigned Z, double gamma, FormFactor form_factor, Integrator integrate
+Cubature hcubature_integrator(
+    double absolute_error,
+    double relative_error,
+    size_t max_evaluations,
+    std::atomic<size_t>* evaluations
 ) {
-  struct Env {
-    double b;
-    double wg2;
-  };
-
-  auto env = std::make_shared<Env>();
-
-  auto iqt = [=, F = std::move(form_factor)](double qt) -> double {
-    EPA_TRY
-      double qt2 = sqr(qt);
-      double q2  = qt2 + env->wg2;
-      return qt2 / q2 * F(q2) * gsl::bessel_J1(env->b * qt);
-    EPA_BACKTRACE("lambda (qt) %e", qt);
-  };
-
-  double c = alpha * sqr(Z / pi);
-
-  return [=, integrate = std::move(integrate)](double b, double w) -> double {
-    EPA_TRY
-      env->b   = b;
-      env->wg2 = sqr(w / gamma);
-      return c / w * sqr(integrate(iqt, 0, infinity));
-    EPA_BACKTRACE(
-        "lambda (b, w) %e, %e\n  defined in epa::spectrum_b(%u, %e)",
-        b, w, Z, gamma
+  return [=](
+      const integration::Function_nd& f,
+      const std::vector<double>& a,
+      const std::vector<double>& b
+  ) -> double {
+    auto r = integration::cubature(
+        f, a, b, absolute_error, relative_error, max_evaluations
     );
+    if (evaluations) *evaluations += r.nevals;
+    return r.result;
   };
 };
 
-Spectrum_b
-spectrum_b_point(unsigned Z, double gamma) {
-  double c = alpha * sqr(Z / pi / gamma);
-  return [=](double b, double w) -> double {
-    EPA_TRY
-      return c * w * sqr(gsl::bessel_K1(b * w / gamma));
-    EPA_BACKTRACE(
-        "lambda (b, w) %e, %e\n  defined in epa::spectrum_b_point(%u, %e)",
-        b, w, Z, gamma
-    );
-  };
+Cubature hcubature_integrator(const hcubature_integrator_keys& keys) {
+  return hcubature_integrator(
+      keys.absolute_error,
+      keys.relative_error,
+      keys.max_evaluations,
+      keys.evaluations
+  );
 };
 
-// x * K1(x) - 1 for small x
-// x K1(x) - 1 = (x/2)^2 (2 ln(x/2) + 2γ - 1) + (x/2)^4 (ln(x/2) + γ - 5/4)
-// where γ is the Euler constant
-static double xk1_1(double x) {
-  const double euler = 0.5772156649015329;
-  double le = log(0.5 * x) + euler;
-  double x2 = x * x;
-  return x2 * (0.5 * (le - 0.5) + (0.0625 * x2 * (le - 1.25)));
+Cubature hcubature_integrator(unsigned level) {
+  return hcubature_integrator(
+      default_absolute_error,
+      default_relative_error * pow(default_error_step, level)
+  );
+};
+
+Cubature vegas_integrator(
+    double absolute_error,
+    double relative_error,
+    size_t calls,
+    unsigned max_iterations,
+    uint64_t seed,
+    unsigned threads,
+    std::atomic<size_t>* evaluations
+) {
+  return [=](
+      const integration::Function_nd& f,
+      const std::vector<double>& a,
+      const std::vector<double>& b
+  ) -> double {
+    auto r = integration::vegas(
+        f, a, b,
+        absolute_error, relative_error,
+        calls, max_iterations,
+        seed, threads
+    );
+    if (evaluations) *evaluations += r.nevals;
+    return r.result;
+  };
+};
+
+Cubature vegas_integrator(const vegas_integrator_keys& keys) {
+  return vegas_integrator(
+      keys.absolute_error,
+      keys.relative_error,
+      keys.calls,
+      keys.max_iterations,
+      keys.seed,
+      keys.threads,
+      keys.evaluations
+  );
+};
+
+Cubature vegas_integrator(unsigned level) {
+  return vegas_integrator(
+      default_absolute_error,
+      default_relative_error * pow(default_error_step, level)
+  );
+};
+
+Cubature qmc_integrator(
+    double absolute_error,
+    double relative_error,
+    size_t points,
+    unsigned replicas,
+    size_t max_evaluations,
+    uint64_t seed,
+    unsigned threads,
+    std::atomic<size_t>* evaluations
+) {
+  return [=](
+      const integration::Function_nd& f,
+      const std::vector<double>& a,
+      const std::vector<double>& b
+  ) -> double {
+    auto r = integration::qmc(
+        f, a, b,
+        absolute_error, relative_error,
+        points, replicas, max_evaluations,
+        seed, threads
+    );
+    if (evaluations) *evaluations += r.nevals;
+    return r.result;
+  };
+};
+
+Cubature qmc_integrator(const qmc_integrator_keys& keys) {
+  return qmc_integrator(
+      keys.absolute_error,
+      keys.relative_error,
+      keys.points,
+      keys.replicas,
+      keys.max_evaluations,
+      keys.seed,
+      keys.threads,
+      keys.evaluations
+  );
+};
+
+Cubature qmc_integrator(unsigned level) {
+  return qmc_integrator(
+      default_absolute_error,
+      default_relative_error * pow(default_error_step, level)
+  );
+};
+
+FormFactor form_factor_monopole(double lambda2) {
+  return [=](double q2) -> double {
+    return 1. / (1 + q2 / lambda2);
+  };
+};
+
+FormFactor form_factor_dipole(double lambda2) {
+  return [=](double q2) -> double {
+    return 1. / sqr(1 + q2 / lambda2);
+  };
+};
+
+Spectrum
+spectrum(
+    unsigned Z, double gamma, FormFactor form_factor, Integrator integrate
+) {
+  auto iqt = [F = std::move(form_factor)](double wg2, double qt) -> double {
+    EPA_TRY
+      double q2 = sqr(qt) + wg2;
+      return qt * sqr(qt / q2 * F(q2));
+    EPA_BACKTRACE("lambda (qt) %e", qt);
+  };
+
+  double c = 2 * sqr(Z) * alpha / pi;
+
+  return [=, iqt = std::move(iqt), integrate = std::move(integrate)](double w)
+         -> double {
+    EPA_TRY
+      double wg2 = sqr(w / gamma);
+      IntegrationSite site("iqt");
+      return c / w * integrate(
+          [&](double qt) -> double { return iqt(wg2, qt); }, 0, infinity
+      );
+    EPA_BACKTRACE("lambda (w) %e\n  defined in epa::spectrum(%u, %e)", w, Z, gamma);
+  };
+};
+
+Spectrum
+spectrum_monopole(unsigned Z, double gamma, double lambda2) {
+  return compose::spectrum_monopole(Z, gamma, lambda2);
+};
+
+Spectrum
+spectrum_dipole(unsigned Z, double gamma, double lambda2) {
+  return compose::spectrum_dipole(Z, gamma, lambda2);
+};
+
+Spectrum_batch
+spectrum_monopole_batch(unsigned Z, double gamma, double lambda2) {
+  return [n = compose::spectrum_monopole(Z, gamma, lambda2)](
+      size_t size, const double* w, double* result
+  ) {
+#pragma omp simd
+    for (size_t i = 0; i < size; ++i) result[i] = n(w[i]);
+  };
+};
+
+Spectrum_batch
+spectrum_dipole_batch(unsigned Z, double gamma, double lambda2) {
+  return [n = compose::spectrum_dipole(Z, gamma, lambda2)](
+      size_t size, const double* w, double* result
+  ) {
+#pragma omp simd
+    for (size_t i = 0; i < size; ++i) result[i] = n(w[i]);
+  };
 };
 
 Spectrum_b
-spectrum_b_monopole(unsigned Z, double gamma, double lambda2) {
+spectrum_b(
+    unsigned Z, double gamma, FormFactor form_factor, Integrator integrate
+) {
+  struct Env {
+    double b;
+    double wg2;
+  };
+
+  auto iqt = [F = std::move(form_factor)](const Env& env, double qt)
+             -> double {
+    EPA_TRY
+      double qt2 = sqr(qt);
+      double q2  = qt2 + env.wg2;
+      return qt2 / q2 * F(q2) * gsl::bessel_J1(env.b * qt);
+    EPA_BACKTRACE("lambda (qt) %e", qt);
+  };
+
   double c = alpha * sqr(Z / pi);
-  return [=](double b, double w) -> double {
+
+  return [=, iqt = std::move(iqt), integrate = std::move(integrate)](
+      double b, double w
+  ) -> double {
     EPA_TRY
-      double wg = w / gamma;
-      double u = b * wg;
-      double a = lambda2 / sqr(wg);
-      double d;
-      if (a < 1e-6)
-        d = 0.5 * b * lambda2 * gsl::bessel_K0(u);
-      else {
-        double v = sqrt(b * b * lambda2 + sqr(u));
-        if (v < 1e-2)
-          d = xk1_1(u) - xk1_1(v);
-        else
-          d = u * gsl::bessel_K1(u) - v * gsl::bessel_K1(v);
-        d /= b;
-      };
-      return c / w * sqr(d);
+      Env env { b, sqr(w / gamma) };
+      IntegrationSite site("iqt");
+      return c / w * sqr(
+          integrate(
+            [&](double qt) -> double { return iqt(env, qt); }, 0, infinity
+          )
+      );
     EPA_BACKTRACE(
-        "lambda (b, w) %e, %e\n  defined in epa::spectrum_b_monopole(%u, %e, %e)",
-        b, w, Z, gamma, lambda2
+        "lambda (b, w) %e, %e\n  defined in epa::spectrum_b(%u, %e)",
+        b, w, Z, gamma
     );
   };
 };
 
 Spectrum_b
-spectrum_b_dipole(unsigned Z, double gamma, double lambda2) {
+spectrum_b(
+    unsigned Z, double gamma, FormFactor form_factor, Integrator_Hankel hankel
+) {
+  struct Env {
+    double wg2;
+  };
+
+  auto iqt = [F = std::move(form_factor)](const Env& env, double qt)
+             -> double {
+    EPA_TRY
+      double qt2 = sqr(qt);
+      double q2  = qt2 + env.wg2;
+      return qt2 / q2 * F(q2);
+    EPA_BACKTRACE("lambda (qt) %e", qt);
+  };
+
   double c = alpha * sqr(Z / pi);
-  return [=](double b, double w) -> double {
+
+  return [=, iqt = std::move(iqt), hankel = std::move(hankel)](
+      double b, double w
+  ) -> double {
     EPA_TRY
-      double wg = w / gamma;
-      double r = sqrt(lambda2 + sqr(wg));
+      Env env { sqr(w / gamma) };
       return c / w * sqr(
-            wg * gsl::bessel_K1(b*wg)
-          - r * gsl::bessel_K1(b*r)
-          - 0.5 * b * lambda2 * gsl::bessel_K0(b*r)
+          hankel([&](double qt) -> double { return iqt(env, qt); }, b)
       );
     EPA_BACKTRACE(
-        "lambda (b, w) %e, %e\n  defined in epa::spectrum_b_dipole(%u, %e, %e)",
-        b, w, Z, gamma, lambda2
+        "lambda (b, w) %e, %e\n  defined in epa::spectrum_b(%u, %e)",
+        b, w, Z, gamma
+    );
+  };
+};
+
+std::vector<double> spectrum_b_grid(
+    unsigned Z,
+    double gamma,
+    FormFactor form_factor,
+    double w,
+    const std::vector<double>& b_grid,
+    const spectrum_b_grid_keys& keys
+) {
+  if (b_grid.empty()) return {};
+  auto range = std::minmax_element(b_grid.begin(), b_grid.end());
+  double b_min = *range.first;
+  double b_max = *range.second;
+  if (!(b_min > 0))
+    throw std::invalid_argument(
+        "epa::spectrum_b_grid: the points of b_grid must be positive"
     );
+
+  double wg2 = sqr(w / gamma);
+  auto g = [&](double qt) -> double {
+    EPA_TRY
+      double qt2 = sqr(qt);
+      double q2  = qt2 + wg2;
+      return qt2 / q2 * form_factor(q2);
+    EPA_BACKTRACE("lambda (qt) %e", qt);
+  };
+
+  // The transform at b comes mostly from qt ~ 1 / b. Take a decade more on
+  // each side against the ringing of the periodic transform and extend the
+  // grid until the integrand is negligible at both ends.
+  double q_min = 0.1 / b_max;
+  double q_max = 10 / b_min;
+  double g_max = 0;
+  auto sample = [&](double from, double to) {
+    for (double q = from; q <= to; q *= 2) g_max = std::max(g_max, std::abs(g(q)));
+  };
+  sample(q_min, q_max);
+  for (int i = 0; i < 100 && std::abs(g(q_min)) > keys.cutoff * g_max; ++i) {
+    sample(0.1 * q_min, q_min);
+    q_min *= 0.1;
+  };
+  for (int i = 0; i < 100 && std::abs(g(q_max)) > keys.cutoff * g_max; ++i) {
+    sample(q_max, 10 * q_max);
+    q_max *= 10;
+  };
+
+  size_t n = 2;
+  while (n - 1 < keys.density * log(q_max / q_min)) n *= 2;
+  double dln = log(q_max / q_min) / (n - 1);
+
+  std::vector<double> f(n);
+  for (size_t j = 0; j < n; ++j) f[j] = g(q_min * exp(j * dln));
+  auto I = integration::fftlog(f, q_min, dln);
+
+  // cubic interpolation in log(b)
+  double c = alpha * sqr(Z / pi) / w;
+  std::vector<double> result;
+  result.reserve(b_grid.size());
+  for (double b: b_grid) {
+    double x = log(b / I.b0) / dln;
+    size_t i = std::min(std::max(static_cast<size_t>(x), size_t(1)), n - 3);
+    double t = x - i;
+    double v = - t * (t - 1) * (t - 2) / 6 * I.result[i - 1]
+             + (t + 1) * (t - 1) * (t - 2) / 2 * I.result[i]
+             - (t + 1) * t * (t - 2) / 2 * I.result[i + 1]
+             + (t + 1) * t * (t - 1) / 6 * I.result[i + 2];
+    result.push_back(c * sqr(v));
+  };
+  return result;
+};
+
+Spectrum_b
+spectrum_b_point(unsigned Z, double gamma) {
+  return compose::spectrum_b_point(Z, gamma);
+};
+
+Spectrum_b
+spectrum_b_monopole(unsigned Z, double gamma, double lambda2) {
+  return compose::spectrum_b_monopole(Z, gamma, lambda2);
+};
+
+Spectrum_b
+spectrum_b_dipole(unsigned Z, double gamma, double lambda2) {
+  return compose::spectrum_b_dipole(Z, gamma, lambda2);
+};
+
+// The batch b spectra process the points in blocks: the arguments of the
+// Bessel functions are collected into buffers, the Bessel functions are
+// evaluated with their batch variants, and the results are combined in a
+// separate loop.
+static const size_t batch_block = 64;
+
+Spectrum_b_batch
+spectrum_b_point_batch(unsigned Z, double gamma) {
+  double c = alpha * sqr(Z / pi / gamma);
+  return [=](size_t size, const double* b, const double* w, double* result) {
+    double u[batch_block];
+    double k1[batch_block];
+    for (size_t start = 0; start < size; start += batch_block) {
+      size_t m = std::min(batch_block, size - start);
+      const double* bs = b + start;
+      const double* ws = w + start;
+      double* n = result + start;
+#pragma omp simd
+      for (size_t i = 0; i < m; ++i) u[i] = bs[i] * ws[i] / gamma;
+      bessel_K1(m, u, k1);
+#pragma omp simd
+      for (size_t i = 0; i < m; ++i) n[i] = c * ws[i] * sqr(k1[i]);
+    };
+  };
+};
+
+Spectrum_b_batch
+spectrum_b_monopole_batch(unsigned Z, double gamma, double lambda2) {
+  double c = alpha * sqr(Z / pi);
+  return [=](size_t size, const double* b, const double* w, double* result) {
+    double u[batch_block];
+    double v[batch_block];
+    double k0u[batch_block];
+    double k1u[batch_block];
+    double k1v[batch_block];
+    for (size_t start = 0; start < size; start += batch_block) {
+      size_t m = std::min(batch_block, size - start);
+      const double* bs = b + start;
+      const double* ws = w + start;
+      double* n = result + start;
+#pragma omp simd
+      for (size_t i = 0; i < m; ++i) {
+        u[i] = bs[i] * (ws[i] / gamma);
+        v[i] = sqrt(bs[i] * bs[i] * lambda2 + sqr(u[i]));
+      };
+      bessel_K01(m, u, k0u, k1u);
+      bessel_K1(m, v, k1v);
+#pragma omp simd
+      for (size_t i = 0; i < m; ++i) {
+        double a = lambda2 / sqr(ws[i] / gamma);
+        double d = a < 1e-6
+                 ? 0.5 * bs[i] * lambda2 * k0u[i]
+                 : (u[i] * k1u[i] - v[i] * k1v[i]) / bs[i];
+        n[i] = c / ws[i] * sqr(d);
+      };
+      // u K1(u) - v K1(v) loses precision for small v; these points are rare
+      // and are recalculated from the series
+      for (size_t i = 0; i < m; ++i)
+        if (v[i] < 1e-2 && lambda2 / sqr(ws[i] / gamma) >= 1e-6)
+          n[i] = c / ws[i] * sqr((compose::xk1_1(u[i]) - compose::xk1_1(v[i])) / bs[i]);
+    };
+  };
+};
+
+Spectrum_b_batch
+spectrum_b_dipole_batch(unsigned Z, double gamma, double lambda2) {
+  double c = alpha * sqr(Z / pi);
+  return [=](size_t size, const double* b, const double* w, double* result) {
+    double r[batch_block];
+    double u[batch_block];
+    double v[batch_block];
+    double k1u[batch_block];
+    double k0v[batch_block];
+    double k1v[batch_block];
+    for (size_t start = 0; start < size; start += batch_block) {
+      size_t m = std::min(batch_block, size - start);
+      const double* bs = b + start;
+      const double* ws = w + start;
+      double* n = result + start;
+#pragma omp simd
+      for (size_t i = 0; i < m; ++i) {
+        double wg = ws[i] / gamma;
+        r[i] = sqrt(lambda2 + sqr(wg));
+        u[i] = bs[i] * wg;
+        v[i] = bs[i] * r[i];
+      };
+      bessel_K1(m, u, k1u);
+      bessel_K01(m, v, k0v, k1v);
+#pragma omp simd
+      for (size_t i = 0; i < m; ++i)
+        n[i] = c / ws[i] * sqr(
+              ws[i] / gamma * k1u[i]
+            - r[i] * k1v[i]
+            - 0.5 * bs[i] * lambda2 * k0v[i]
+        );
+    };
   };
 };
 
@@ -313,7 +1019,8 @@ spectrum_b_function1d_x(
     Spectrum_b rest_spectrum,
     double b_max,
     std::function<double (double, double, double)>&& integral_qt_max,
-    Integrator_I integrate
+    Integrator_I integrate,
+    Integrator_Hankel hankel = nullptr
 ) {
   if (!form_factor || form_factor->points->size() < 2)
     if (rest_spectrum)
@@ -334,8 +1041,6 @@ spectrum_b_function1d_x(
     double wg2;
   };
 
-  auto env = std::make_shared<Env>();
-
   double c = alpha * sqr(Z / pi);
 
   double norm;
@@ -347,25 +1052,31 @@ spectrum_b_function1d_x(
   Spectrum_b n0;
   if (b_max > 0) n0 = spectrum_b_point(Z, gamma);
 
-  auto rqt = [env, ff = std::move(rest_form_factor)](double qt) -> double {
+  // without the Bessel function
+  auto rqt = [ff = rest_form_factor](const Env& env, double qt) -> double {
     EPA_TRY
       double qt2 = sqr(qt);
-      double q2  = qt2 + env->wg2;
-      return qt2 / q2 * ff(q2) * gsl::bessel_J1(env->b * qt);
+      double q2  = qt2 + env.wg2;
+      return qt2 / q2 * ff(q2);
     EPA_BACKTRACE("lambda (qt) %e", qt);
   };
 
   return [
     =,
+    rqt             = std::move(rqt),
     integral_qt_max = std::move(integral_qt_max),
     integrate       = std::move(integrate),
-    n0              = std::move(n0)
+    n0              = std::move(n0),
+    hankel          = std::move(hankel)
   ](double b, double w) -> double {
     EPA_TRY
       if (b_max > 0 && b > b_max) return n0(b, w);
       double wg2 = sqr(w / gamma);
-      env->b   = b;
-      env->wg2 = wg2;
+      Env env { b, wg2 };
+      auto gqt = [&](double qt) -> double { return rqt(env, qt); };
+      auto fqt = [&](double qt) -> double {
+        return rqt(env, qt) * gsl::bessel_J1(b * qt);
+      };
 
       double qt_max = form_factor->points->back().first - wg2;
       qt_max = qt_max > 0 ? sqrt(qt_max) : 0;
@@ -376,8 +1087,10 @@ spectrum_b_function1d_x(
       if (rest_form_factor)
         I += norm * (
             rest_spectrum
-            ? sqrt(rest_spectrum(b, w) / C) - integrate(rqt, 0, qt_max, I)
-            : integrate(rqt, qt_max, infinity, I)
+            ? sqrt(rest_spectrum(b, w) / C) - integrate(fqt, 0, qt_max, I)
+            : hankel
+            ? hankel(gqt, b) - integrate(fqt, 0, qt_max, I)
+            : integrate(fqt, qt_max, infinity, I)
         );
       return C * sqr(I);
     EPA_BACKTRACE(
@@ -400,19 +1113,18 @@ spectrum_b_function1d_g(
     FormFactor rest_form_factor,
     Spectrum_b rest_spectrum,
     double b_max,
-    Integrator_I integrate
+    Integrator_I integrate,
+    Integrator_Hankel hankel
 ) {
   struct Env {
     double b;
     double wg2;
   };
 
-  auto env = std::make_shared<Env>();
-
-  auto fqt = [env, form_factor](double qt) -> double {
+  auto fqt = [form_factor](const Env& env, double qt) -> double {
     double qt2 = sqr(qt);
-    double q2  = qt2 + env->wg2;
-    return qt2 / q2 * (*form_factor)(q2) * gsl::bessel_J1(env->b * qt);
+    double q2  = qt2 + env.wg2;
+    return qt2 / q2 * (*form_factor)(q2) * gsl::bessel_J1(env.b * qt);
   };
 
   return spectrum_b_function1d_x(
@@ -422,19 +1134,21 @@ spectrum_b_function1d_g(
       rest_form_factor,
       rest_spectrum,
       b_max,
-      [env, fqt = std::move(fqt), integrate]
+      [fqt = std::move(fqt), integrate]
       (double b, double wg2, double qt_max) -> double {
         EPA_TRY
-          env->b = b;
-          env->wg2 = wg2;
-          return integrate(fqt, 0, qt_max, 0);
+          Env env { b, wg2 };
+          return integrate(
+              [&](double qt) -> double { return fqt(env, qt); }, 0, qt_max, 0
+          );
         EPA_BACKTRACE(
             "lambda (b, sqr(w/gamma), qt_max) %e, %e, %e\n"
             "  defined in epa::spectrum_b_function1d_g",
             b, wg2, qt_max
         );
       },
-      integrate
+      integrate,
+      hankel
   );
 };
 
@@ -446,18 +1160,17 @@ spectrum_b_function1d_s(
     FormFactor rest_form_factor,
     Spectrum_b rest_spectrum,
     double b_max,
-    Integrator_I integrate
+    Integrator_I integrate,
+    Integrator_Hankel hankel
 ) {
   struct Env {
     double b;
     double wg2;
   };
 
-  auto env = std::make_shared<Env>();
-
-  auto fj1 = [env](double qt) -> double {
+  auto fj1 = [](const Env& env, double qt) -> double {
     EPA_TRY
-      return gsl::bessel_J1(env->b * qt) / (sqr(qt) + env->wg2);
+      return gsl::bessel_J1(env.b * qt) / (sqr(qt) + env.wg2);
     EPA_BACKTRACE("lambda (qt) %e", qt);
   };
 
@@ -468,11 +1181,11 @@ spectrum_b_function1d_s(
       rest_form_factor,
       rest_spectrum,
       b_max,
-      [form_factor, env, fj1 = std::move(fj1), integrate]
+      [form_factor, fj1 = std::move(fj1), integrate]
       (double b, double wg2, double qt_max) -> double {
         EPA_TRY
-          env->b   = b;
-          env->wg2 = wg2;
+          Env env { b, wg2 };
+          auto fqt = [&](double qt) -> double { return fj1(env, qt); };
           std::vector<std::pair<double, double>>::const_iterator left
             = form_factor->locate(wg2);
           double start = left->first < wg2 ? 0 : sqrt(left->first - wg2);
@@ -490,7 +1203,7 @@ spectrum_b_function1d_s(
                    )
                + B / b
                  * (gsl::bessel_J0(b * start) - gsl::bessel_J0(b * end))
-               - B * wg2 * integrate(fj1, start, end, 0);
+               - B * wg2 * integrate(fqt, start, end, 0);
             left = right;
             start = end;
           };
@@ -501,7 +1214,8 @@ spectrum_b_function1d_s(
             b, wg2, qt_max
         );
       },
-      integrate
+      integrate,
+      hankel
   );
 };
 
@@ -513,7 +1227,8 @@ spectrum_b_function1d(
     FormFactor rest_form_factor,
     Spectrum_b rest_spectrum,
     double b_max,
-    Integrator_I integrate
+    Integrator_I integrate,
+    Integrator_Hankel hankel
 ) {
   auto global = spectrum_b_function1d_g(
       Z,
@@ -522,7 +1237,8 @@ spectrum_b_function1d(
       rest_form_factor,
       rest_spectrum,
       b_max,
-      integrate
+      integrate,
+      hankel
   );
   auto segmented = spectrum_b_function1d_s(
       Z,
@@ -531,7 +1247,8 @@ spectrum_b_function1d(
       rest_form_factor,
       rest_spectrum,
       b_max,
-      integrate
+      integrate,
+      hankel
   );
 
   return [global = std::move(global), segmented = std::move(segmented)]
@@ -541,147 +1258,754 @@ spectrum_b_function1d(
   };
 };
 
-Luminosity_y luminosity_y(Spectrum nA, Spectrum nB) {
-  return [nA = std::move(nA), nB = std::move(nB)]
-         (double rs, double y) -> double {
+// The point of [lo, hi] where the decreasing function above(x) (true or false)
+// switches to false, by bisection. lo if above(lo) is false, hi if above(hi)
+// is true.
+static double crossing(
+    const std::function<bool (double)>& above, double lo, double hi
+) {
+  if (!above(lo)) return lo;
+  if (above(hi)) return hi;
+  for (int i = 0; i < 50; ++i) {
+    double mid = 0.5 * (lo + hi);
+    (above(mid) ? lo : hi) = mid;
+  };
+  return lo;
+};
+
+Spectrum
+tabulate_spectrum(
+    Spectrum n,
+    std::pair<double, double> w_range,
+    double tolerance,
+    const tabulate_spectrum_keys& keys
+) {
+  double lw0 = log(w_range.first);
+  double cutoff = keys.cutoff;
+
+  // the table ends where the spectrum falls below the cutoff rather than
+  // following the kink of log(n) clamped there
+  double lw_cut = crossing(
+      [&n, cutoff](double lw) -> bool {
+        EPA_TRY
+          return n(exp(lw)) >= cutoff;
+        EPA_BACKTRACE("lambda (log(w)) %e", lw);
+      },
+      lw0,
+      log(w_range.second)
+  );
+  std::shared_ptr<const Chebyshev1d> table;
+  if (lw_cut > lw0)
+    table = std::make_shared<Chebyshev1d>(
+        [&n](double lw) -> double {
+          EPA_TRY
+            return log(
+                std::max(n(exp(lw)), std::numeric_limits<double>::min())
+            );
+          EPA_BACKTRACE("lambda (log(w)) %e", lw);
+        },
+        std::make_pair(lw0, lw_cut),
+        tolerance,
+        chebyshev_keys {
+          .degree = keys.degree, .max_depth = keys.max_depth, .threads = keys.threads
+        }
+    );
+  if (keys.error) *keys.error = table ? expm1(table->error()) : 0;
+
+  return [=, n = std::move(n)](double w) -> double {
     EPA_TRY
-      double E = 0.5 * rs;
-      double x = exp(y);
-      return E * nA(E * x) * nB(E / x);
+      if (w < w_range.first || w > w_range.second) return n(w);
+      double lw = log(w);
+      return table && lw <= lw_cut ? exp((*table)(lw)) : 0;
     EPA_BACKTRACE(
-        "lambda (rs, y) %e, %e\n  defined in epa::luminosity_y", rs, y
+        "lambda (w) %e\n  defined in epa::tabulate_spectrum", w
     );
   };
 };
 
+Spectrum_b
+tabulate_spectrum_b(
+    Spectrum_b n,
+    std::pair<double, double> b_range,
+    std::pair<double, double> w_range,
+    double tolerance,
+    const tabulate_spectrum_keys& keys
+) {
+  chebyshev_keys chebyshev {
+    .degree = keys.degree, .max_depth = keys.max_depth, .threads = keys.threads
+  };
+  double lb0 = log(b_range.first);
+  double lb1 = log(b_range.second);
+  double lw0 = log(w_range.first);
+  double lw1 = log(w_range.second);
+  double cutoff = keys.cutoff;
+  auto above = [&n, cutoff](double lb, double lw) -> bool {
+    EPA_TRY
+      return n(exp(lb), exp(lw)) >= cutoff;
+    EPA_BACKTRACE("lambda (log(b), log(w)) %e, %e", lb, lw);
+  };
+  auto log_n = [&n](double lb, double lw) -> double {
+    EPA_TRY
+      return log(
+          std::max(n(exp(lb), exp(lw)), std::numeric_limits<double>::min())
+      );
+    EPA_BACKTRACE("lambda (log(b), log(w)) %e, %e", lb, lw);
+  };
+
+  // The spectrum falls with b and w, and drops below the cutoff beyond a curve
+  // log(w) = cut(log(b)). A table of log(n) clamped at the cutoff would have a
+  // kink along the curve, so the tables end at it instead: `full' covers b <
+  // b_full where the whole w_range is above the cutoff, and `partial' covers
+  // b_full < b < b_empty in the coordinates (log(b), s) with log(w) = lw0 + s
+  // (cut(log(b)) - lw0), 0 < s < 1. The curve is smooth, but only its
+  // position matters, so it is tabulated with a fixed tolerance.
+  double lb_full = crossing(
+      [&](double lb) -> bool { return above(lb, lw1); }, lb0, lb1
+  );
+  double lb_empty = crossing(
+      [&](double lb) -> bool { return above(lb, lw0); }, lb_full, lb1
+  );
+
+  double error = 0;
+  std::shared_ptr<const Chebyshev2d> full, partial;
+  std::shared_ptr<const Chebyshev1d> cut;
+  if (lb_full > lb0) {
+    full = std::make_shared<Chebyshev2d>(
+        log_n, std::make_pair(lb0, lb_full), std::make_pair(lw0, lw1),
+        tolerance, chebyshev
+    );
+    error = full->error();
+  };
+  if (lb_empty > lb_full) {
+    cut = std::make_shared<Chebyshev1d>(
+        [&](double lb) -> double {
+          return crossing(
+              [&](double lw) -> bool { return above(lb, lw); }, lw0, lw1
+          );
+        },
+        std::make_pair(lb_full, lb_empty),
+        1e-6,
+        chebyshev
+    );
+    partial = std::make_shared<Chebyshev2d>(
+        [&](double lb, double s) -> double {
+          return log_n(lb, lw0 + s * ((*cut)(lb) - lw0));
+        },
+        std::make_pair(lb_full, lb_empty), std::make_pair(0., 1.),
+        tolerance, chebyshev
+    );
+    error = std::max(error, partial->error());
+  };
+  if (keys.error) *keys.error = expm1(error);
+
+  return [=, n = std::move(n)](double b, double w) -> double {
+    EPA_TRY
+      if (
+          b < b_range.first || b > b_range.second
+       || w < w_range.first || w > w_range.second
+      )
+        return n(b, w);
+      double lb = log(b), lw = log(w);
+      if (full && lb <= lb_full) return exp((*full)(lb, lw));
+      if (!partial || lb > lb_empty) return 0;
+      double lc = (*cut)(lb);
+      if (lw > lc) return 0;
+      return exp((*partial)(lb, lc > lw0 ? (lw - lw0) / (lc - lw0) : 0));
+    EPA_BACKTRACE(
+        "lambda (b, w) %e, %e\n  defined in epa::tabulate_spectrum_b", b, w
+    );
+  };
+};
+
+Luminosity_y luminosity_y(Spectrum nA, Spectrum nB) {
+  return compose::luminosity_y(std::move(nA), std::move(nB));
+};
+
 Luminosity_y luminosity_y(Spectrum n) {
-  return luminosity_y(n, n);
+  return compose::luminosity_y(std::move(n));
 };
 
 Luminosity_fid luminosity_fid(Spectrum nA, Spectrum nB, Integrator integrate) {
-  auto E = std::make_shared<double>();
+  return compose::luminosity_fid(
+      std::move(nA), std::move(nB), std::move(integrate)
+  );
+};
 
-  auto fx = [E, nA = std::move(nA), nB = std::move(nB)](double x) -> double {
-    EPA_TRY
-      double rx = sqrt(x);
-      return nA(*E * rx) * nB(*E / rx) / x;
-    EPA_BACKTRACE("lambda (x) %e; y = %e", x, 0.5 * log(x));
+Luminosity_fid luminosity_fid(Spectrum n, Integrator integrate) {
+  return compose::luminosity_fid(std::move(n), std::move(integrate));
+};
+
+Luminosity luminosity(Spectrum nA, Spectrum nB, Integrator integrate) {
+  return compose::luminosity(
+      std::move(nA), std::move(nB), std::move(integrate)
+  );
+};
+
+Luminosity luminosity(Spectrum n, Integrator integrate) {
+  return compose::luminosity(std::move(n), std::move(integrate));
+};
+
+// Integral over the angle between b1 and b2 of the survival probability
+// weighted by the photons polarizations:
+//   \int_0^{2 pi} dphi upc(b) (parallel cos^2 phi + perpendicular sin^2 phi),
+//   b^2 = b1^2 + b2^2 - 2 b1 b2 cos phi
+typedef std::function<
+  double (double /* b1 */, double /* b2 */, const Polarization&)
+> AngularIntegral;
+
+static AngularIntegral
+angular_integral(std::function<double (double)> upc, Integrator integrate) {
+  return compose::angular_integral(std::move(upc), std::move(integrate));
+};
+
+static AngularIntegral angular_integral(UPCProbability_Gaussians upc) {
+  return compose::angular_integral(std::move(upc));
+};
+
+std::function<double (double)>
+upc_probability(UPCProbability_Gaussians upc) {
+  return [upc = std::move(upc)](double b) -> double {
+    double result = 0;
+    for (auto& g: upc) result += g.c * exp(-g.a * sqr(b));
+    return result;
   };
+};
 
-  return [E, fx = std::move(fx), integrate = std::move(integrate)](
-      double rs, double y_min, double y_max
+static AngularIntegral angular_integral(UPCProbability_Angular upc) {
+  return [upc = std::move(upc)](
+      double b1, double b2, const Polarization& polarization
   ) -> double {
+    auto k = upc(b1, b2);
+    return polarization.parallel      * k.parallel
+         + polarization.perpendicular * k.perpendicular;
+  };
+};
+
+UPCProbability_Angular
+tabulate_upc_probability(
+    std::function<double (double)> upc,
+    std::pair<double, double> b_range,
+    double tolerance,
+    const tabulate_upc_probability_keys& keys
+) {
+  // The kernels are divided by pi to make them tend to 1 at large b1 or b2
+  auto angular = angular_integral(std::move(upc), keys.integrator);
+  chebyshev_keys chebyshev = {
+    .degree = keys.degree, .max_depth = keys.max_depth, .threads = keys.threads
+  };
+  std::pair<double, double> range = {
+    log(b_range.first), log(b_range.second)
+  };
+  auto table = [&](Polarization polarization) -> Chebyshev2d {
+    return Chebyshev2d(
+        [&](double lb1, double lb2) -> double {
+          EPA_TRY
+            return angular(exp(lb1), exp(lb2), polarization) / pi;
+          EPA_BACKTRACE("lambda (log(b1), log(b2)) %e, %e", lb1, lb2);
+        },
+        range,
+        range,
+        tolerance,
+        chebyshev
+    );
+  };
+  Chebyshev2d parallel      = table({ 1, 0 });
+  Chebyshev2d perpendicular = table({ 0, 1 });
+  if (keys.error)
+    *keys.error = pi * std::max(parallel.error(), perpendicular.error());
+
+  return [
+    =,
+    angular       = std::move(angular),
+    parallel      = std::move(parallel),
+    perpendicular = std::move(perpendicular)
+  ](double b1, double b2) -> Polarization {
     EPA_TRY
-      *E  = 0.5 * rs;
-      return 0.25 * rs * integrate(fx, exp(2 * y_min), exp(2 * y_max));
+      if (
+          b1 < b_range.first || b1 > b_range.second
+       || b2 < b_range.first || b2 > b_range.second
+      )
+        return { angular(b1, b2, { 1, 0 }), angular(b1, b2, { 0, 1 }) };
+      double lb1 = log(b1);
+      double lb2 = log(b2);
+      return { pi * parallel(lb1, lb2), pi * perpendicular(lb1, lb2) };
     EPA_BACKTRACE(
-        "lambda (rs, y_min, y_max) %e, %e, %e\n  defined in epa::luminosity_fid",
-        rs, y_min, y_max
+        "lambda (b1, b2) %e, %e\n  defined in epa::tabulate_upc_probability",
+        b1, b2
     );
   };
 };
 
-Luminosity_fid luminosity_fid(Spectrum n, Integrator integrate) {
-  return [l = luminosity_fid(n, n, std::move(integrate))](
-      double rs, double y_min, double y_max
-  ) -> double {
-    return y_min == -y_max ? 2 * l(rs, y_min, 0) : l(rs, y_min, y_max);
+static UPCProbability_Angular angular_kernel(AngularIntegral angular) {
+  return [angular = std::move(angular)](double b1, double b2) -> Polarization {
+    return { angular(b1, b2, { 1, 0 }), angular(b1, b2, { 0, 1 }) };
   };
 };
 
-Luminosity luminosity(Spectrum nA, Spectrum nB, Integrator integrate) {
-  return [l = luminosity_fid(nA, nB, std::move(integrate))](
-      double rs
-  ) -> double {
-    return l(rs, -infinity, infinity);
-  };
+UPCProbability_Angular
+upc_probability_angular(
+    std::function<double (double)> upc, Integrator integrate
+) {
+  return angular_kernel(angular_integral(std::move(upc), std::move(integrate)));
 };
 
-Luminosity luminosity(Spectrum n, Integrator integrate) {
-  return [l = luminosity_fid(n, n, std::move(integrate))](double rs) -> double {
-    return 2 * l(rs, -infinity, 0);
+UPCProbability_Angular upc_probability_angular(UPCProbability_Gaussians upc) {
+  return angular_kernel(angular_integral(std::move(upc)));
+};
+
+static Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    AngularIntegral angular,
+    const std::function<Integrator (unsigned)>& integrator,
+    unsigned level
+) {
+  return compose::luminosity_y_b(
+      std::move(nA),
+      std::move(nB),
+      std::move(angular),
+      integrator(level),
+      integrator(level + 1)
+  );
+};
+
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    std::function<double (double)> upc,
+    const std::function<Integrator (unsigned)>& integrator,
+    unsigned level
+) {
+  return luminosity_y_b(
+      std::move(nA),
+      std::move(nB),
+      angular_integral(std::move(upc), integrator(level + 2)),
+      integrator,
+      level
+  );
+};
+
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b n,
+    std::function<double (double)> upc,
+    const std::function<Integrator (unsigned)>& integrator,
+    unsigned level
+) {
+  return luminosity_y_b(n, n, std::move(upc), integrator);
+};
+
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    UPCProbability_Gaussians upc,
+    const std::function<Integrator (unsigned)>& integrator,
+    unsigned level
+) {
+  return luminosity_y_b(
+      std::move(nA),
+      std::move(nB),
+      angular_integral(std::move(upc)),
+      integrator,
+      level
+  );
+};
+
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b n,
+    UPCProbability_Gaussians upc,
+    const std::function<Integrator (unsigned)>& integrator,
+    unsigned level
+) {
+  return luminosity_y_b(n, n, std::move(upc), integrator, level);
+};
+
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    UPCProbability_Angular upc,
+    const std::function<Integrator (unsigned)>& integrator,
+    unsigned level
+) {
+  return luminosity_y_b(
+      std::move(nA),
+      std::move(nB),
+      angular_integral(std::move(upc)),
+      integrator,
+      level
+  );
+};
+
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b n,
+    UPCProbability_Angular upc,
+    const std::function<Integrator (unsigned)>& integrator,
+    unsigned level
+) {
+  return luminosity_y_b(n, n, std::move(upc), integrator, level);
+};
+
+// n(b[i], w) for i = 0 .. size - 1
+static void spectrum_b_batch(
+    const Spectrum_b_batch& n,
+    size_t size,
+    const double* b,
+    double w,
+    double* result
+) {
+  std::array<double, 64> ws;
+  ws.fill(w);
+  for (size_t i = 0; i < size; i += ws.size())
+    n(std::min(ws.size(), size - i), b + i, ws.data(), result + i);
+};
+
+static Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b_batch nA,
+    Spectrum_b_batch nB,
+    AngularIntegral angular,
+    const std::function<Integrator_batch (unsigned)>& integrator,
+    unsigned level
+) {
+  // Same as compose::luminosity_y_b with nA evaluated once per node of the
+  // rule over b1 rather than once per node of the rule over b2
+  return [
+    nA           = std::move(nA),
+    nB           = std::move(nB),
+    angular      = std::move(angular),
+    integrate_b1 = integrator(level),
+    integrate_b2 = integrator(level + 1)
+  ](double rs, double y, Polarization polarization) -> double {
+    EPA_TRY
+      double E  = 0.5 * rs;
+      double rx = exp(y);
+      auto fb1 = [&](size_t n, const double* b1, double* f) {
+        spectrum_b_batch(nA, n, b1, E * rx, f);
+        for (size_t i = 0; i < n; ++i) {
+          if (f[i] == 0) continue;
+          auto fb2 = [&](size_t m, const double* b2, double* g) {
+            spectrum_b_batch(nB, m, b2, E / rx, g);
+            for (size_t j = 0; j < m; ++j)
+              g[j] *= b2[j] * angular(b1[i], b2[j], polarization);
+          };
+          IntegrationSite site("fb2");
+          f[i] *= b1[i] * integrate_b2(fb2, 0, infinity);
+        };
+      };
+      IntegrationSite site("fb1");
+      return E * pi / sqr(rx) * integrate_b1(fb1, 0, infinity);
+    EPA_BACKTRACE(
+        "lambda (rs, y, polarization) %e, %e, {%e, %e}\n"
+        "  defined in luminosity_y_b",
+        rs, y, polarization.parallel, polarization.perpendicular
+    );
   };
 };
 
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b_batch nA,
+    Spectrum_b_batch nB,
+    UPCProbability_Gaussians upc,
+    const std::function<Integrator_batch (unsigned)>& integrator,
+    unsigned level
+) {
+  return luminosity_y_b(
+      std::move(nA),
+      std::move(nB),
+      angular_integral(std::move(upc)),
+      integrator,
+      level
+  );
+};
+
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b_batch n,
+    UPCProbability_Gaussians upc,
+    const std::function<Integrator_batch (unsigned)>& integrator,
+    unsigned level
+) {
+  return luminosity_y_b(n, n, std::move(upc), integrator, level);
+};
+
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b_batch nA,
+    Spectrum_b_batch nB,
+    UPCProbability_Angular upc,
+    const std::function<Integrator_batch (unsigned)>& integrator,
+    unsigned level
+) {
+  return luminosity_y_b(
+      std::move(nA),
+      std::move(nB),
+      angular_integral(std::move(upc)),
+      integrator,
+      level
+  );
+};
+
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b_batch n,
+    UPCProbability_Angular upc,
+    const std::function<Integrator_batch (unsigned)>& integrator,
+    unsigned level
+) {
+  return luminosity_y_b(n, n, std::move(upc), integrator, level);
+};
+
 Luminosity_y_b
 luminosity_y_b(
     Spectrum_b nA,
     Spectrum_b nB,
     std::function<double (double)> upc,
+    Cubature integrate
+) {
+  // The integrand is symmetric with respect to phi -> 2 pi - phi, so phi is
+  // integrated from 0 to pi
+  return [
+    nA        = std::move(nA),
+    nB        = std::move(nB),
+    upc       = std::move(upc),
+    integrate = std::move(integrate)
+  ](double rs, double y, Polarization polarization) -> double {
+    EPA_TRY
+      double E  = 0.5 * rs;
+      double rx = exp(y);
+      auto f = [&](const double* x) -> double {
+        EPA_TRY
+          double b1 = x[0];
+          double b2 = x[1];
+          double c  = cos(x[2]);
+          return b1 * b2
+               * nA(b1, E * rx)
+               * nB(b2, E / rx)
+               * upc(sqrt(sqr(b1) + sqr(b2) - 2 * b1 * b2 * c))
+               * (
+                   polarization.parallel * sqr(c)
+                 + polarization.perpendicular * (1 - sqr(c))
+                 );
+        EPA_BACKTRACE("lambda (b1, b2, phi) %e, %e, %e", x[0], x[1], x[2]);
+      };
+      return 2 * E * pi / sqr(rx) * integrate(
+          f, { 0, 0, 0 }, { infinity, infinity, pi }
+      );
+    EPA_BACKTRACE(
+        "lambda (rs, y, polarization) %e, %e, {%e, %e}\n"
+        "  defined in luminosity_y_b",
+        rs, y, polarization.parallel, polarization.perpendicular
+    );
+  };
+};
+
+Luminosity_y_b
+luminosity_y_b(
+    Spectrum_b n,
+    std::function<double (double)> upc,
+    Cubature integrate
+) {
+  return luminosity_y_b(n, n, std::move(upc), std::move(integrate));
+};
+
+static Luminosity_fid_b
+luminosity_fid_b(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    AngularIntegral angular,
     const std::function<Integrator (unsigned)>& integrator,
     unsigned level
 ) {
+  // luminosity_y_b is not used here because it would result in an unoptimal
+  // order of integration
+  //
+  // The integration variables are kept in Env which lives on the stack of the
+  // outermost call and is copied at each integration level, so that the
+  // luminosity and each of the integrands below can be evaluated concurrently
   struct Env {
     double E;
-    double rx;
+    double x_min;
+    double x_max;
     double b1;
     double b2;
     Polarization polarization;
   };
 
-  auto env = std::make_shared<Env>();
-
-  auto fphi = [env, upc = std::move(upc)](double phi) -> double {
+  auto fx = [nA = std::move(nA), nB = std::move(nB)](const Env& env, double x)
+            -> double {
     EPA_TRY
-      double c = cos(phi);
-      double s = sin(phi);
-      return upc(sqrt(sqr(env->b1) + sqr(env->b2) - 2 * env->b1 * env->b2 * c))
-           * (
-               env->polarization.parallel * sqr(c)
-             + env->polarization.perpendicular * sqr(s)
-             );
-    EPA_BACKTRACE("lambda (phi) %e", phi);
+      double rx = sqrt(x);
+      return nA(env.b1, env.E * rx) * nB(env.b2, env.E / rx) / x;
+    EPA_BACKTRACE("lambda (x) %e; y = %e", x, 0.5 * log(x));
   };
 
   auto fb2 = [
-    env,
-    nA   = std::move(nA),
-    nB   = std::move(nB),
-    fphi = std::move(fphi),
+    fx        = std::move(fx),
+    angular   = std::move(angular),
     integrate = integrator(level + 2)
-  ](double b2) -> double {
+  ](Env env, double b2) -> double {
     EPA_TRY
-      env->b2 = b2;
+      env.b2 = b2;
+      IntegrationSite site("fx");
       return b2
-             * nA(env->b1, env->E * env->rx)
-             * nB(b2, env->E / env->rx)
-             * integrate(fphi, 0, 2 * pi);
+           * integrate(
+               [&](double x) -> double { return fx(env, x); },
+               env.x_min,
+               env.x_max
+             )
+           * angular(env.b1, b2, env.polarization);
     EPA_BACKTRACE("lambda (b2) %e", b2);
   };
 
-  auto fb1 = [env, fb2 = std::move(fb2), integrate = integrator(level + 1)](
-      double b1
+  auto fb1 = [fb2 = std::move(fb2), integrate = integrator(level + 1)](
+      Env env, double b1
   ) -> double {
     EPA_TRY
-      env->b1 = b1;
-      return b1 * integrate(fb2, 0, infinity);
+      env.b1 = b1;
+      IntegrationSite site("fb2");
+      return b1 * integrate(
+          [&](double b2) -> double { return fb2(env, b2); }, 0, infinity
+      );
     EPA_BACKTRACE("lambda (b1) %e", b1);
   };
 
-  return [env, fb1 = std::move(fb1), integrate = integrator(level)](
-      double rs, double y, Polarization polarization
+  return [fb1 = std::move(fb1), integrate = integrator(level)](
+        double rs,
+        Polarization polarization,
+        double y_min,
+        double y_max
   ) -> double {
     EPA_TRY
-      env->E = 0.5 * rs;
-      env->rx = exp(y);
-      env->polarization = polarization;
-      return env->E * pi / sqr(env->rx) * integrate(fb1, 0, infinity);
+      Env env;
+      env.E             = 0.5 * rs;
+      env.x_min         = exp(2 * y_min);
+      env.x_max         = exp(2 * y_max);
+      env.polarization  = polarization;
+      IntegrationSite site("fb1");
+      return env.E * pi * integrate(
+          [&](double b1) -> double { return fb1(env, b1); }, 0, infinity
+      );
     EPA_BACKTRACE(
-        "lambda (rs, y, polarization) %e, %e, {%e, %e}\n"
-        "  defined in luminosity_y_b",
-        rs, y, polarization.parallel, polarization.perpendicular
+        "lambda (rs, polarization, y_min, y_max) %e, {%e, %e}, %e, %e\n"
+        "  defined in luminosity_fid_b",
+        rs, polarization.parallel, polarization.perpendicular, y_min, y_max
     );
   };
 };
 
-Luminosity_y_b
-luminosity_y_b(
+Luminosity_fid_b
+luminosity_fid_b(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    std::function<double (double)> upc,
+    const std::function<Integrator (unsigned)>& integrator,
+    unsigned level
+) {
+  return luminosity_fid_b(
+      std::move(nA),
+      std::move(nB),
+      angular_integral(std::move(upc), integrator(level + 2)),
+      integrator,
+      level
+  );
+};
+
+Luminosity_fid_b
+luminosity_fid_b(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    UPCProbability_Gaussians upc,
+    const std::function<Integrator (unsigned)>& integrator,
+    unsigned level
+) {
+  return luminosity_fid_b(
+      std::move(nA),
+      std::move(nB),
+      angular_integral(std::move(upc)),
+      integrator,
+      level
+  );
+};
+
+Luminosity_fid_b
+luminosity_fid_b(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    UPCProbability_Angular upc,
+    const std::function<Integrator (unsigned)>& integrator,
+    unsigned level
+) {
+  return luminosity_fid_b(
+      std::move(nA),
+      std::move(nB),
+      angular_integral(std::move(upc)),
+      integrator,
+      level
+  );
+};
+
+Luminosity_fid_b
+luminosity_fid_b(
+    Spectrum_b n,
+    std::function<double (double)> upc,
+    const std::function<Integrator (unsigned)>& integrator,
+    unsigned level
+) {
+  return [l = luminosity_fid_b(n, n, std::move(upc), integrator, level)](
+      double rs,
+      Polarization polarization,
+      double y_min,
+      double y_max
+  ) -> double {
+    return y_min == -y_max
+         ? 2 * l(rs, polarization, y_min, 0)
+         : l(rs, polarization, y_min, y_max);
+  };
+};
+
+Luminosity_fid_b
+luminosity_fid_b(
+    Spectrum_b n,
+    UPCProbability_Gaussians upc,
+    const std::function<Integrator (unsigned)>& integrator,
+    unsigned level
+) {
+  return [l = luminosity_fid_b(n, n, std::move(upc), integrator, level)](
+      double rs,
+      Polarization polarization,
+      double y_min,
+      double y_max
+  ) -> double {
+    return y_min == -y_max
+         ? 2 * l(rs, polarization, y_min, 0)
+         : l(rs, polarization, y_min, y_max);
+  };
+};
+
+Luminosity_fid_b
+luminosity_fid_b(
     Spectrum_b n,
-    std::function<double (double)> upc,
+    UPCProbability_Angular upc,
     const std::function<Integrator (unsigned)>& integrator,
     unsigned level
 ) {
-  return luminosity_y_b(n, n, std::move(upc), integrator);
+  return [l = luminosity_fid_b(n, n, std::move(upc), integrator, level)](
+      double rs,
+      Polarization polarization,
+      double y_min,
+      double y_max
+  ) -> double {
+    return y_min == -y_max
+         ? 2 * l(rs, polarization, y_min, 0)
+         : l(rs, polarization, y_min, y_max);
+  };
 };
 
 Luminosity_fid_b
@@ -689,74 +2013,45 @@ luminosity_fid_b(
     Spectrum_b nA,
     Spectrum_b nB,
     std::function<double (double)> upc,
-    const std::function<Integrator (unsigned)>& integrator,
-    unsigned level
+    Cubature integrate
 ) {
-  // luminosity_y_b is not used here because it would result in an unoptimal
-  // order of integration
-  struct Env {
-    double E;
-    double x_min;
-    double x_max;
-    double b1;
-    double b2;
-    Polarization polarization;
-  };
-
-  auto env = std::make_shared<Env>();
-
-  auto fx = [env, nA = std::move(nA), nB = std::move(nB)](double x) -> double {
-    EPA_TRY
-      double rx = sqrt(x);
-      return nA(env->b1, env->E * rx) * nB(env->b2, env->E / rx) / x;
-    EPA_BACKTRACE("lambda (x) %e; y = %e", x, 0.5 * log(x));
-  };
-
-  auto fphi = [env, upc = std::move(upc)](double phi) -> double {
-    EPA_TRY
-      double c = cos(phi);
-      double s = sin(phi);
-      return upc(sqrt(sqr(env->b1) + sqr(env->b2) - 2 * env->b1 * env->b2 * c))
-           * (
-               env->polarization.parallel * sqr(c)
-             + env->polarization.perpendicular * sqr(s)
-             );
-    EPA_BACKTRACE("lambda (phi) %e", phi);
-  };
-
-  auto fb2 = [
-    env,
-    fx        = std::move(fx),
-    fphi      = std::move(fphi),
-    integrate = integrator(level + 2)
-  ](double b2) -> double {
-    EPA_TRY
-      env->b2 = b2;
-      return b2 * integrate(fx, env->x_min, env->x_max) * integrate(fphi, 0, 2 * pi);
-    EPA_BACKTRACE("lambda (b2) %e", b2);
-  };
-
-  auto fb1 = [env, fb2 = std::move(fb2), integrate = integrator(level + 1)](
-      double b1
-  ) -> double {
-    EPA_TRY
-      env->b1 = b1;
-      return b1 * integrate(fb2, 0, infinity);
-    EPA_BACKTRACE("lambda (b1) %e", b1);
-  };
-
-  return [env, fb1 = std::move(fb1), integrate = integrator(level)](
-        double rs,
-        Polarization polarization,
-        double y_min,
-        double y_max
+  // as in luminosity_y_b, phi is integrated from 0 to pi
+  return [
+    nA        = std::move(nA),
+    nB        = std::move(nB),
+    upc       = std::move(upc),
+    integrate = std::move(integrate)
+  ](
+      double rs,
+      Polarization polarization,
+      double y_min,
+      double y_max
   ) -> double {
     EPA_TRY
-      env->E             = 0.5 * rs;
-      env->x_min         = exp(2 * y_min);
-      env->x_max         = exp(2 * y_max);
-      env->polarization  = polarization;
-      return env->E * pi * integrate(fb1, 0, infinity);
+      double E = 0.5 * rs;
+      auto f = [&](const double* x) -> double {
+        EPA_TRY
+          double b1 = x[0];
+          double b2 = x[1];
+          double c  = cos(x[2]);
+          double rx = sqrt(x[3]);
+          return b1 * b2
+               * nA(b1, E * rx)
+               * nB(b2, E / rx) / x[3]
+               * upc(sqrt(sqr(b1) + sqr(b2) - 2 * b1 * b2 * c))
+               * (
+                   polarization.parallel * sqr(c)
+                 + polarization.perpendicular * (1 - sqr(c))
+                 );
+        EPA_BACKTRACE(
+            "lambda (b1, b2, phi, x) %e, %e, %e, %e", x[0], x[1], x[2], x[3]
+        );
+      };
+      return 2 * E * pi * integrate(
+          f,
+          { 0, 0, 0, exp(2 * y_min) },
+          { infinity, infinity, pi, exp(2 * y_max) }
+      );
     EPA_BACKTRACE(
         "lambda (rs, polarization, y_min, y_max) %e, {%e, %e}, %e, %e\n"
         "  defined in luminosity_fid_b",
@@ -769,10 +2064,11 @@ Luminosity_fid_b
 luminosity_fid_b(
     Spectrum_b n,
     std::function<double (double)> upc,
-    const std::function<Integrator (unsigned)>& integrator,
-    unsigned level
+    Cubature integrate
 ) {
-  return [l = luminosity_fid_b(n, n, std::move(upc), integrator, level)](
+  return [
+    l = luminosity_fid_b(n, n, std::move(upc), std::move(integrate))
+  ](
       double rs,
       Polarization polarization,
       double y_min,
@@ -815,6 +2111,250 @@ luminosity_b(
   };
 };
 
+Luminosity_b
+luminosity_b(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    UPCProbability_Gaussians upc,
+    const std::function<Integrator (unsigned)>& integrator,
+    unsigned level
+) {
+  return [
+    l = luminosity_fid_b(
+            std::move(nA), std::move(nB), std::move(upc), integrator, level
+        )
+  ](double rs, Polarization polarization) -> double {
+    return l(rs, polarization, -infinity, infinity);
+  };
+};
+
+Luminosity_b
+luminosity_b(
+    Spectrum_b n,
+    UPCProbability_Gaussians upc,
+    const std::function<Integrator (unsigned)>& integrator,
+    unsigned level
+) {
+  return [l = luminosity_fid_b(n, n, std::move(upc), integrator, level)](
+      double rs, Polarization polarization
+  ) -> double {
+    return 2 * l(rs, polarization, -infinity, 0);
+  };
+};
+
+Luminosity_b
+luminosity_b(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    UPCProbability_Angular upc,
+    const std::function<Integrator (unsigned)>& integrator,
+    unsigned level
+) {
+  return [
+    l = luminosity_fid_b(
+            std::move(nA), std::move(nB), std::move(upc), integrator, level
+        )
+  ](double rs, Polarization polarization) -> double {
+    return l(rs, polarization, -infinity, infinity);
+  };
+};
+
+Luminosity_b
+luminosity_b(
+    Spectrum_b n,
+    UPCProbability_Angular upc,
+    const std::function<Integrator (unsigned)>& integrator,
+    unsigned level
+) {
+  return [l = luminosity_fid_b(n, n, std::move(upc), integrator, level)](
+      double rs, Polarization polarization
+  ) -> double {
+    return 2 * l(rs, polarization, -infinity, 0);
+  };
+};
+
+// Integral of the piecewise linear interpolant between the integer points
+// over [alpha, beta]: the weight of the point j
+static double hat_integral(double j, double alpha, double beta) {
+  double result = 0;
+  double a = std::max(alpha, j - 1);
+  double b = std::min(beta, j);
+  if (a < b) result += 0.5 * (sqr(b - j + 1) - sqr(a - j + 1));
+  a = std::max(alpha, j);
+  b = std::min(beta, j + 1);
+  if (a < b) result += 0.5 * (sqr(j + 1 - a) - sqr(j + 1 - b));
+  return result;
+};
+
+// Cubic Lagrange interpolation of f(-1), f(0), f(1), f(2) at 0 <= s <= 1
+static double cubic_interpolation(const double* f, double s) {
+  return - s * (s - 1) * (s - 2) / 6 * f[0]
+         + (s + 1) * (s - 1) * (s - 2) / 2 * f[1]
+         - (s + 1) * s * (s - 2) / 2 * f[2]
+         + (s + 1) * s * (s - 1) / 6 * f[3];
+};
+
+std::vector<integration::Result>
+luminosity_b_scan(
+    Spectrum_b nA,
+    Spectrum_b nB,
+    UPCProbability_Angular upc,
+    const std::vector<double>& rs_grid,
+    Polarization polarization,
+    double y_min,
+    double y_max,
+    const luminosity_b_scan_keys& keys
+) {
+  // In the variables log(b1), log(b2), u = log(w1) the luminosity is
+  //   L(rs) = E pi \int dlog(b1) dlog(b2) b1^2 b2^2 K(b1, b2)
+  //           2 \int du nA(b1, e^u) nB(b2, E^2 e^{-u}),
+  // E = rs / 2, u - log(E) = y in [y_min, y_max], where K is the angular
+  // integral of the survival probability. The integral over u is a
+  // convolution of the two spectra in log(w) evaluated at t = 2 log(E). With
+  // a fixed quadrature in log(b) and a uniform grid in u the spectra and the
+  // kernel are computed once for all the points; the convolution is reduced
+  // to the sums along the antidiagonals of the matrix
+  //   Q = A^T M B, A_ij = nA(b_i, e^{u_j}), B_ij = nB(b_i, e^{u_j}),
+  //   M_ij = w_i w_j b_i^2 b_j^2 K(b_i, b_j),
+  // and then interpolated to t.
+  if (rs_grid.empty()) return {};
+  if (!(std::isfinite(y_min) && std::isfinite(y_max) && y_min < y_max))
+    throw std::invalid_argument(
+        "epa::luminosity_b_scan: the rapidity range must be finite and not "
+        "empty"
+    );
+  auto rs_range = std::minmax_element(rs_grid.begin(), rs_grid.end());
+  if (!(*rs_range.first > 0))
+    throw std::invalid_argument(
+        "epa::luminosity_b_scan: the points of rs_grid must be positive"
+    );
+  if (!(
+        keys.b_range.first > 0 && keys.b_range.first < keys.b_range.second
+     && keys.b_panels > 0 && keys.log_w_step > 0
+  ))
+    throw std::invalid_argument("epa::luminosity_b_scan: invalid keys");
+
+  // Gauss-Kronrod rule on each panel in log(b). The Gauss weights of the
+  // nodes of the Kronrod extension are zero.
+  auto& rule = integration::gauss_kronrod(keys.method);
+  size_t nk = rule.x.size();
+  size_t nb = keys.b_panels * nk;
+  std::vector<double> b(nb), wk(nb), wg(nb);
+  {
+    double lb = log(keys.b_range.first);
+    double hb = (log(keys.b_range.second) - lb) / keys.b_panels;
+    for (unsigned p = 0; p < keys.b_panels; ++p)
+      for (size_t k = 0; k < nk; ++k) {
+        size_t i = p * nk + k;
+        b[i] = exp(lb + (p + 0.5 * (1 + rule.x[k])) * hb);
+        double jacobian = 0.5 * hb * sqr(b[i]);
+        wk[i] = jacobian * rule.wk[k];
+        wg[i] = jacobian * rule.wg[k];
+      };
+  };
+
+  // The grid in u covers both photons energies w = E exp(+-y) at all the
+  // points, with a margin for the interpolation and for the coarse grid
+  double h  = keys.log_w_step;
+  double lE_min = log(0.5 * *rs_range.first);
+  double lE_max = log(0.5 * *rs_range.second);
+  double u0 = std::min(lE_min + y_min, lE_min - y_max) - 8 * h;
+  size_t nw = ceil(
+      (std::max(lE_max + y_max, lE_max - y_min) + 8 * h - u0) / h
+  ) + 1;
+
+  std::vector<double> A(nb * nw), B(nb * nw);
+  parallel_for(nb, keys.threads, [&](size_t i) -> void {
+    EPA_TRY
+      for (size_t j = 0; j < nw; ++j) {
+        double w = exp(u0 + j * h);
+        A[i * nw + j] = nA(b[i], w);
+        B[i * nw + j] = nB(b[i], w);
+      };
+    EPA_BACKTRACE("lambda (i) %zu; b = %e", i, b[i]);
+  });
+
+  // Mk and Mg: M with the Kronrod and the Gauss weights
+  std::vector<double> Mk(nb * nb), Mg(nb * nb);
+  parallel_for(nb, keys.threads, [&](size_t i) -> void {
+    EPA_TRY
+      for (size_t j = 0; j < nb; ++j) {
+        auto k = upc(b[i], b[j]);
+        double K = polarization.parallel      * k.parallel
+                 + polarization.perpendicular * k.perpendicular;
+        Mk[i * nb + j] = wk[i] * wk[j] * K;
+        Mg[i * nb + j] = wg[i] * wg[j] * K;
+      };
+    EPA_BACKTRACE("lambda (i) %zu; b1 = %e", i, b[i]);
+  });
+
+  // Q = A^T (M B)
+  auto product = [&](const std::vector<double>& M) -> std::vector<double> {
+    std::vector<double> P(nb * nw, 0);
+    parallel_for(nb, keys.threads, [&](size_t i) -> void {
+      double* p = &P[i * nw];
+      for (size_t k = 0; k < nb; ++k) {
+        double m = M[i * nb + k];
+        if (m == 0) continue;
+        const double* q = &B[k * nw];
+        for (size_t j = 0; j < nw; ++j) p[j] += m * q[j];
+      };
+    });
+    std::vector<double> Q(nw * nw, 0);
+    parallel_for(nw, keys.threads, [&](size_t j) -> void {
+      double* q = &Q[j * nw];
+      for (size_t i = 0; i < nb; ++i) {
+        double a = A[i * nw + j];
+        if (a == 0) continue;
+        const double* p = &P[i * nw];
+        for (size_t l = 0; l < nw; ++l) q[l] += a * p[l];
+      };
+    });
+    return Q;
+  };
+  std::vector<double> Qk = product(Mk);
+  std::vector<double> Qg = product(Mg);
+
+  // The convolution at t = 2 u0 + m h with the rapidity window
+  // y_min <= u_j - t / 2 <= y_max, that is m / 2 + y_min / h <= j <= m / 2 +
+  // y_max / h. `step' = 2 takes every other point of the grid (m must be even).
+  auto convolution = [&](
+      const std::vector<double>& Q, size_t m, size_t step
+  ) -> double {
+    double alpha = (0.5 * m + y_min / h) / step;
+    double beta  = (0.5 * m + y_max / h) / step;
+    double result = 0;
+    for (size_t j = std::max(0., ceil(alpha - 1)); j <= beta + 1; ++j) {
+      size_t l = m - j * step;
+      if (j * step >= nw || l >= nw) continue;
+      double weight = hat_integral(j, alpha, beta);
+      if (weight != 0) result += weight * Q[j * step * nw + l];
+    };
+    return step * h * result;
+  };
+
+  std::vector<integration::Result> result(rs_grid.size());
+  for (size_t n = 0; n < rs_grid.size(); ++n) {
+    double E = 0.5 * rs_grid[n];
+    double s = (2 * (log(E) - u0)) / h;
+    size_t m = floor(s);
+    double fk[4], fg[4], f2[4];
+    for (int k = 0; k < 4; ++k) {
+      fk[k] = convolution(Qk, m + k - 1, 1);
+      fg[k] = convolution(Qg, m + k - 1, 1);
+    };
+    size_t m2 = 2 * size_t(floor(0.5 * s));
+    for (int k = 0; k < 4; ++k) f2[k] = convolution(Qk, m2 + 2 * k - 2, 2);
+
+    double factor = 2 * E * pi;
+    double lk = factor * cubic_interpolation(fk, s - m);
+    double lg = factor * cubic_interpolation(fg, s - m);
+    double l2 = factor * cubic_interpolation(f2, 0.5 * (s - m2));
+    result[n] = { lk, std::abs(lk - lg) + std::abs(lk - l2), 2 * nb * nw };
+  };
+  return result;
+};
+
 XSection
 xsection(XSection xsection, Luminosity luminosity) {
   return [
@@ -838,6 +2378,121 @@ xsection_b(
   };
 };
 
+// Fiducial constraints on the phase space of a pair of charged particles (see
+// xsection_fid)
+class Fiducial {
+  public:
+    Fiducial(
+        double mass,
+        double pT_min,
+        double eta_max,
+        double w1_min,
+        double w1_max,
+        double w2_min,
+        double w2_max
+    ):
+      m2(sqr(mass)),
+      pT_min(pT_min),
+      eta_max(eta_max),
+      sinh_eta(sinh(eta_max)),
+      cosh_eta(cosh(eta_max)),
+      cosh2_eta(sqr(cosh_eta)),
+      E_min(sqrt(w1_min * w2_min)),
+      E_max(sqrt(w1_max * w2_max)),
+      w1_min(w1_min),
+      w1_max(w1_max),
+      w2_min(w2_min),
+      w2_max(w2_max)
+    {};
+
+    struct Range {
+      double energy; // half of the invariant mass
+      double y_min;  // rapidity bounds due to the constraints on w1 and w2
+      double y_max;
+      double pT_min;
+      double pT_max;
+    };
+
+    // Rapidity and transverse momentum bounds for the invariant mass rs.
+    // Returns false if the fiducial region is empty.
+    bool range(double rs, Range& range) const {
+      double E = 0.5 * rs;
+      if (E <= E_min || E >= E_max) return false;
+
+      // Transverse momentum integration limits (u <= pT <= v)
+      double v = sqrt(sqr(E) - m2);
+      // when pT < v / cosh_eta, the integration limit y computed in
+      // rapidity_range below is negative, and the integration domain is empty
+      double u = std::max(pT_min, v / cosh_eta);
+      if (u >= v) return false;
+
+      range.energy = E;
+      range.y_min = log(std::max(w1_min / E, E / w2_max));
+      range.y_max = log(std::min(w1_max / E, E / w2_min));
+
+      double y = std::max(range.y_min, -range.y_max);
+      if (y > 0) {
+        // when y > eta_max, the integration limit y computed in
+        // rapidity_range below is negative, and the integration domain is
+        // empty
+        if (y >= eta_max) return false;
+
+        double r = 1 - m2 / sqr(E) * (1 + sqr(sinh(y) / cosh_eta));
+        if (r > 0) {
+          r = sqrt(r);
+          double u1 = 0.5 * E * (
+              (1 + r) / cosh(y - eta_max) - (1 - r) / cosh(y + eta_max)
+          );
+          if (u1 > u) {
+            u = u1;
+            if (u >= v) return false;
+          };
+        };
+      };
+      // when y < 0, u1 < E / cosh(eta_max) <= u
+
+      range.pT_min = u;
+      range.pT_max = v;
+      return true;
+    };
+
+    // Rapidity bounds of the pair for the transverse momentum pT. Returns
+    // false if the bounds are empty. y_max is infinite if pT is beyond the
+    // kinematic limit.
+    bool rapidity_range(
+        const Range& range, double pT, double& y_min, double& y_max
+    ) const {
+      double pT2 = sqr(pT);
+      double r = 1 - (pT2 + m2) / sqr(range.energy);
+      if (r <= 0) {
+        y_min = -infinity;
+        y_max = infinity;
+        return true;
+      };
+      double y = log(
+            pT / range.energy
+          * (sinh_eta + sqrt(cosh2_eta + m2 / pT2)) / (1 + sqrt(r))
+      );
+      y_min = std::max(-y, range.y_min);
+      y_max = std::min( y, range.y_max);
+      return y_min < y_max;
+    };
+
+  private:
+    double m2;
+    double pT_min;
+    double eta_max;
+    double sinh_eta;
+    double cosh_eta;
+    double cosh2_eta;
+    double E_min;
+    double E_max;
+    double w1_min;
+    double w1_max;
+    double w2_min;
+    double w2_max;
+};
+
 static
 XSection
 xsection_fid_x(
@@ -858,74 +2513,29 @@ xsection_fid_x(
     double           w2_max,
     Integrator       integrate
 ) {
-  struct Env {
-    double energy;
-    double y_min;
-    double y_max;
-  };
-
-  auto env = std::make_shared<Env>();
+  Fiducial fiducial(mass, pT_min, eta_max, w1_min, w1_max, w2_min, w2_max);
 
-  double m2 = sqr(mass);
-  double sinh_eta = sinh(eta_max);
-  double cosh_eta = cosh(eta_max);
-  double cosh2_eta = sqr(cosh_eta);
-  double E_min = sqrt(w1_min * w2_min);
-  double E_max = sqrt(w1_max * w2_max);
-
-  auto fpT = [=, xl = std::move(xl)](double pT) -> double {
+  auto fpT = [fiducial, xl = std::move(xl)](
+      const Fiducial::Range& range, double pT
+  ) -> double {
     EPA_TRY
-      double pT2 = sqr(pT);
-      double r = 1 - (pT2 + m2) / sqr(env->energy);
-      if (r <= 0) return infinity;
-      double y = log(
-            pT / env->energy
-          * (sinh_eta + sqrt(cosh2_eta + m2 / pT2)) / (1 + sqrt(r))
-      );
-      double y_min = std::max(-y, env->y_min);
-      double y_max = std::min( y, env->y_max);
-      if (y_min >= y_max) return 0;
-      return xl(2 * env->energy, pT, y_min, y_max);
+      double y_min, y_max;
+      if (!fiducial.rapidity_range(range, pT, y_min, y_max)) return 0;
+      if (y_max == infinity) return infinity;
+      return xl(2 * range.energy, pT, y_min, y_max);
     EPA_BACKTRACE("lambda (pT) %e", pT);
    };
 
   return [=, fpT = std::move(fpT)](double rs) -> double {
     EPA_TRY
-      double E = 0.5 * rs;
-      if (E <= E_min || E >= E_max) return 0;
-
-      // Transverse momentum integration limits (u <= pT <= v)
-      double v = sqrt(sqr(E) - m2);
-      // when pT < v / cosh_eta, the integration limit y computed in fpT above
-      // is negative, and the integration domain is empty
-      double u = std::max(pT_min, v / cosh_eta);
-      if (u >= v) return 0;
-
-      env->energy = E;
-      env->y_min = log(std::max(w1_min / E, E / w2_max));
-      env->y_max = log(std::min(w1_max / E, E / w2_min));
-
-      double y = std::max(env->y_min, -env->y_max);
-      if (y > 0) {
-        // when y > eta_max, the integration limit y computed in fpT above is
-        // negative, and the integration domain is empty
-        if (y >= eta_max) return 0;
-
-        double r = 1 - m2 / sqr(E) * (1 + sqr(sinh(y) / cosh_eta));
-        if (r > 0) {
-          r = sqrt(r);
-          double u1 = 0.5 * E * (
-              (1 + r) / cosh(y - eta_max) - (1 - r) / cosh(y + eta_max)
-          );
-          if (u1 > u) {
-            u = u1;
-            if (u >= v) return 0;
-          };
-        };
-      };
-      // when y < 0, u1 < E / cosh(eta_max) <= u
-
-      return integrate(fpT, u, v);
+      Fiducial::Range range;
+      if (!fiducial.range(rs, range)) return 0;
+      IntegrationSite site("fpT");
+      return integrate(
+          [&](double pT) -> double { return fpT(range, pT); },
+          range.pT_min,
+          range.pT_max
+      );
     EPA_BACKTRACE("lambda (rs) %e\n  defined in xsection_fid_x", rs);
   };
 };
@@ -987,6 +2597,73 @@ xsection_fid_b(
   );
 };
 
+XSection
+xsection_fid_b(
+    std::function<Polarization (double, double)> xsection,
+    Spectrum_b nA,
+    Spectrum_b nB,
+    std::function<double (double)> upc,
+    double mass,
+    double pT_min,
+    double eta_max,
+    double w1_min,
+    double w1_max,
+    double w2_min,
+    double w2_max,
+    Cubature integrate
+) {
+  Fiducial fiducial(mass, pT_min, eta_max, w1_min, w1_max, w2_min, w2_max);
+
+  // The variables are pT, the position of the rapidity y of the pair within
+  // its bounds for this pT (from 0 to 1), b1, b2 and the angle phi between
+  // them. x = exp(2 y) as in luminosity_fid_b, and dx / x = 2 dy. The
+  // integrand is symmetric with respect to phi -> 2 pi - phi.
+  auto f = [
+    fiducial,
+    xsection = std::move(xsection),
+    nA       = std::move(nA),
+    nB       = std::move(nB),
+    upc      = std::move(upc)
+  ](const Fiducial::Range& range, const double* x) -> double {
+    EPA_TRY
+      double pT = x[0];
+      double y_min, y_max;
+      if (!fiducial.rapidity_range(range, pT, y_min, y_max)) return 0;
+      if (y_max == infinity) return infinity;
+      double E  = range.energy;
+      double y  = y_min + (y_max - y_min) * x[1];
+      double rx = exp(y);
+      double b1 = x[2];
+      double b2 = x[3];
+      double c  = cos(x[4]);
+      Polarization p = xsection(2 * E, pT);
+      return 4 * E * pi * (y_max - y_min)
+           * b1 * b2
+           * nA(b1, E * rx)
+           * nB(b2, E / rx)
+           * upc(sqrt(sqr(b1) + sqr(b2) - 2 * b1 * b2 * c))
+           * (p.parallel * sqr(c) + p.perpendicular * (1 - sqr(c)));
+    EPA_BACKTRACE(
+        "lambda (pT, t, b1, b2, phi) %e, %e, %e, %e, %e",
+        x[0], x[1], x[2], x[3], x[4]
+    );
+  };
+
+  return [fiducial, f = std::move(f), integrate = std::move(integrate)](
+      double rs
+  ) -> double {
+    EPA_TRY
+      Fiducial::Range range;
+      if (!fiducial.range(rs, range)) return 0;
+      return integrate(
+          [&](const double* x) -> double { return f(range, x); },
+          { range.pT_min, 0, 0, 0, 0 },
+          { range.pT_max, 1, infinity, infinity, pi }
+      );
+    EPA_BACKTRACE("lambda (rs) %e\n  defined in xsection_fid_b", rs);
+  };
+};
+
 std::function<double (double)>
 photons_to_fermions(double mass, double charge) {
   double c = 4 * pi * sqr(sqr(charge) * alpha) * barn;
@@ -1,4 +1,6 @@
 #include <gsl/gsl_errno.h>
+#include <gsl/gsl_fft_complex.h>
+#include <gsl/gsl_sf_gamma.h>
 
 #include <epa/gsl.hpp>
 
@@ -8,6 +10,40 @@ const char* Error::what() const throw() {
   return gsl_strerror(err_);
 };
 
+std::complex<double> lngamma(std::complex<double> z) {
+  gsl_sf_result lnr, arg;
+  gsl_sf_lngamma_complex_e(z.real(), z.imag(), &lnr, &arg);
+  return { lnr.val, arg.val };
+};
+
+void fft(std::vector<std::complex<double>>& x) {
+  gsl_fft_complex_radix2_forward(
+      reinterpret_cast<double*>(x.data()), 1, x.size()
+  );
+};
+
+namespace sum {
+
+LevinResult levin_u(const std::vector<double>& terms) {
+  std::unique_ptr<gsl_sum_levin_u_workspace, void (*)(gsl_sum_levin_u_workspace*)>
+  workspace(gsl_sum_levin_u_alloc(terms.size()), gsl_sum_levin_u_free);
+  if (!workspace)
+    throw std::runtime_error("gsl_sum_levin_u_alloc: out of memory");
+
+  LevinResult result;
+  gsl_sum_levin_u_accel(
+      terms.data(),
+      terms.size(),
+      workspace.get(),
+      &result.sum,
+      &result.abserr
+  );
+  result.terms_used = workspace->terms_used;
+  return result;
+};
+
+}; // namespace sum
+
 void init() {
   gsl_set_error_handler(
       [](const char* reason, const char* file, int line, int gsl_errno) {
@@ -41,6 +77,33 @@ QAGWorkspace::~QAGWorkspace() {
   if (workspace) gsl_integration_workspace_free(workspace);
 };
 
+QKResult qk(
+    const std::function<double (double)>& f,
+    double a,
+    double b,
+    QAGMethod method
+) {
+  gsl_function F;
+  F.function = closure_trampoline;
+  F.params = const_cast<std::function<double (double)>*>(&f);
+
+  decltype(&gsl_integration_qk15) rule;
+  switch (method) {
+    case GAUSS15: rule = gsl_integration_qk15; break;
+    case GAUSS21: rule = gsl_integration_qk21; break;
+    case GAUSS31: rule = gsl_integration_qk31; break;
+    case GAUSS41: rule = gsl_integration_qk41; break;
+    case GAUSS51: rule = gsl_integration_qk51; break;
+    case GAUSS61: rule = gsl_integration_qk61; break;
+    default:
+      throw std::invalid_argument("gsl::integration::qk: invalid method");
+  };
+
+  QKResult result;
+  rule(&F, a, b, &result.result, &result.abserr, &result.resabs, &result.resasc);
+  return result;
+};
+
 QAGResult qag(
     const std::function<double (double)>& f,
     double from,
@@ -54,7 +117,33 @@ QAGResult qag(
   gsl_function F;
   F.function = closure_trampoline;
   F.params = const_cast<std::function<double (double)>*>(&f);
+  return qag(F, from, to, epsabs, epsrel, limit, method, workspace);
+};
 
+QAGResult qag(
+    const std::function<double (double)>& f,
+    double from,
+    double to,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    QAGMethod method
+) {
+  PooledWorkspace<QAGWorkspace> workspace(limit);
+  return qag(f, from, to, epsabs, epsrel, limit, method, *workspace);
+};
+
+QAGResult qag(
+    const gsl_function& f,
+    double from,
+    double to,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    QAGMethod method,
+    const QAGWorkspace& workspace
+) {
+  gsl_function F = f;
   QAGResult result;
   if (from == -infinity)
     if (to == infinity)
@@ -106,6 +195,125 @@ QAGResult qag(
   return result;
 };
 
+QAGResult qag(
+    const gsl_function& f,
+    double from,
+    double to,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    QAGMethod method
+) {
+  PooledWorkspace<QAGWorkspace> workspace(limit);
+  return qag(f, from, to, epsabs, epsrel, limit, method, *workspace);
+};
+
+QAWOTable::QAWOTable(double omega, double L, QAWOWeight weight, size_t n):
+  table(
+      gsl_integration_qawo_table_alloc(
+        omega, L, static_cast<gsl_integration_qawo_enum>(weight), n
+      )
+  )
+{
+  if (!table)
+    throw std::runtime_error("gsl_integration_qawo_table_alloc: out of memory");
+};
+
+QAWOTable::QAWOTable(QAWOTable&& t) {
+  table = t.table;
+  t.table = nullptr;
+};
+
+QAWOTable::~QAWOTable() {
+  if (table) gsl_integration_qawo_table_free(table);
+};
+
+void QAWOTable::set(double omega, double L, QAWOWeight weight) {
+  gsl_integration_qawo_table_set(
+      table, omega, L, static_cast<gsl_integration_qawo_enum>(weight)
+  );
+};
+
+QAGResult qawo(
+    const std::function<double (double)>& f,
+    double a,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    const QAWOTable& table,
+    const QAGWorkspace& workspace
+) {
+  gsl_function F;
+  F.function = closure_trampoline;
+  F.params = const_cast<std::function<double (double)>*>(&f);
+
+  QAGResult result;
+  gsl_integration_qawo(
+      &F,
+      a,
+      epsabs,
+      epsrel,
+      limit,
+      workspace.get(),
+      table.get(),
+      &result.result,
+      &result.abserr
+  );
+  return result;
+};
+
+QAGResult qawo(
+    const std::function<double (double)>& f,
+    double a,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    const QAWOTable& table
+) {
+  PooledWorkspace<QAGWorkspace> workspace(limit);
+  return qawo(f, a, epsabs, epsrel, limit, table, *workspace);
+};
+
+QAGResult qawf(
+    const std::function<double (double)>& f,
+    double a,
+    double epsabs,
+    size_t limit,
+    const QAWOTable& table,
+    const QAGWorkspace& workspace,
+    const QAGWorkspace& cycle_workspace
+) {
+  gsl_function F;
+  F.function = closure_trampoline;
+  F.params = const_cast<std::function<double (double)>*>(&f);
+
+  QAGResult result;
+  gsl_integration_qawf(
+      &F,
+      a,
+      epsabs,
+      limit,
+      workspace.get(),
+      cycle_workspace.get(),
+      table.get(),
+      &result.result,
+      &result.abserr
+  );
+  return result;
+};
+
+QAGResult qawf(
+    const std::function<double (double)>& f,
+    double a,
+    double epsabs,
+    size_t limit,
+    const QAWOTable& table
+) {
+  PooledWorkspace<QAGWorkspace> workspace(limit);
+  PooledWorkspace<QAGWorkspace> cycle_workspace(limit);
+  return qawf(f, a, epsabs, limit, table, *workspace, *cycle_workspace);
+};
+
 CQuadWorkspace::CQuadWorkspace(size_t limit):
   limit_(limit),
   workspace(gsl_integration_cquad_workspace_alloc(limit))
@@ -151,6 +359,17 @@ CQuadResult cquad(
   return result;
 };
 
+CQuadResult cquad(
+    const std::function<double (double)>& f,
+    double a,
+    double b,
+    double epsabs,
+    double epsrel,
+    size_t limit
+) {
+  PooledWorkspace<CQuadWorkspace> workspace(limit);
+  return cquad(f, a, b, epsabs, epsrel, *workspace);
+};
 
 }; // namespace integration
 
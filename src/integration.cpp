@@ -0,0 +1,1464 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <complex>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <gsl/gsl_errno.h>
+
+#include <epa/algorithms.hpp>
+#include <epa/integration.hpp>
+#include <epa/quadpack.hpp>
+
+namespace epa {
+
+namespace integration {
+
+// the largest number of nodes of a Gauss-Kronrod rule (GAUSS61)
+static const size_t max_nodes = 61;
+
+// The rule with m Gauss nodes from the QUADPACK tables
+template <unsigned m>
+static GaussKronrod make_gauss_kronrod() {
+  typedef quadpack::QK<m> QK;
+  GaussKronrod rule;
+  rule.n = m;
+  rule.x.resize(2 * m + 1);
+  rule.wk.resize(2 * m + 1);
+  rule.wg.assign(2 * m + 1, 0);
+  for (unsigned k = 0; k <= m; ++k) {
+    rule.x[k]         = -QK::xgk[k];
+    rule.x[2 * m - k] =  QK::xgk[k];
+    rule.wk[k] = rule.wk[2 * m - k] = QK::wgk[k];
+    if (k % 2) rule.wg[k] = rule.wg[2 * m - k] = QK::wg[(k - 1) / 2];
+  };
+  return rule;
+};
+
+const GaussKronrod& gauss_kronrod(gsl::integration::QAGMethod method) {
+  static const GaussKronrod rules[] = {
+    make_gauss_kronrod<7>(),
+    make_gauss_kronrod<10>(),
+    make_gauss_kronrod<15>(),
+    make_gauss_kronrod<20>(),
+    make_gauss_kronrod<25>(),
+    make_gauss_kronrod<30>()
+  };
+  switch (method) {
+    case gsl::integration::GAUSS15: return rules[0];
+    case gsl::integration::GAUSS21: return rules[1];
+    case gsl::integration::GAUSS31: return rules[2];
+    case gsl::integration::GAUSS41: return rules[3];
+    case gsl::integration::GAUSS51: return rules[4];
+    case gsl::integration::GAUSS61: return rules[5];
+    default:
+      throw std::invalid_argument(
+          "epa::integration::gauss_kronrod: invalid method"
+      );
+  };
+};
+
+gsl::integration::QKResult qk(
+    const Batch_function& f,
+    double a,
+    double b,
+    gsl::integration::QAGMethod method
+) {
+  return quadpack::qk_batch(f, a, b, method);
+};
+
+Result qag(
+    const Batch_function& f,
+    double a,
+    double b,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    gsl::integration::QAGMethod method
+) {
+  auto integrate = [&](
+      const Batch_function& g, double from, double to, bool extrapolate
+  ) -> Result {
+    auto rule = extrapolate ? gsl::integration::GAUSS15 : method;
+    size_t npoints = gauss_kronrod(rule).x.size();
+    auto qk = [&g, rule](double x0, double x1) {
+      return quadpack::qk_batch(g, x0, x1, rule);
+    };
+    if (extrapolate)
+      return quadpack::detail::qags(
+          qk, npoints, from, to, epsabs, epsrel, limit
+      );
+    return quadpack::detail::qag(
+        qk, npoints, from, to, epsabs, epsrel, limit
+    );
+  };
+
+  if (a == -gsl::infinity)
+    if (b == gsl::infinity)
+      return integrate(
+          [&f](size_t n, const double* t, double* ft) {
+            std::array<double, 2 * max_nodes> x, fx;
+            for (size_t i = 0; i < n; ++i) {
+              x[i]     = (1 - t[i]) / t[i];
+              x[n + i] = -x[i];
+            };
+            f(2 * n, x.data(), fx.data());
+            for (size_t i = 0; i < n; ++i)
+              ft[i] = (fx[i] + fx[n + i]) / t[i] / t[i];
+          },
+          0, 1, true
+      );
+    else
+      return integrate(
+          [&f, b](size_t n, const double* t, double* ft) {
+            std::array<double, max_nodes> x;
+            for (size_t i = 0; i < n; ++i) x[i] = b - (1 - t[i]) / t[i];
+            f(n, x.data(), ft);
+            for (size_t i = 0; i < n; ++i) ft[i] = ft[i] / t[i] / t[i];
+          },
+          0, 1, true
+      );
+  if (b == gsl::infinity)
+    return integrate(
+        [&f, a](size_t n, const double* t, double* ft) {
+          std::array<double, max_nodes> x;
+          for (size_t i = 0; i < n; ++i) x[i] = a + (1 - t[i]) / t[i];
+          f(n, x.data(), ft);
+          for (size_t i = 0; i < n; ++i) ft[i] = ft[i] / t[i] / t[i];
+        },
+        0, 1, true
+    );
+  return integrate(f, a, b, false);
+};
+
+// Threads that run the rounds of parallel_qag: job(0) ... job(n - 1) are
+// shared between the calling thread and the workers as in parallel_for, but
+// the workers are started once and wait for the next round between the calls
+class Workers {
+  public:
+    explicit Workers(unsigned threads);
+    ~Workers();
+
+    Workers(const Workers&) = delete;
+    Workers& operator=(const Workers&) = delete;
+
+    void operator()(size_t n, const std::function<void (size_t)>& job);
+
+  private:
+    std::mutex               mutex;
+    std::condition_variable  start;
+    std::condition_variable  done;
+    std::vector<std::thread> threads;
+
+    // the current round; written under the mutex before round is incremented
+    const std::function<void (size_t)>* job = nullptr;
+    size_t              n     = 0;
+    size_t              round = 0;
+    unsigned            busy  = 0; // workers still in the round
+    bool                stop  = false;
+    std::atomic<size_t> next{0};
+    std::atomic<bool>   failed{false};
+    std::exception_ptr  error;
+
+    void work();
+    void run();
+    void join();
+};
+
+Workers::Workers(unsigned nthreads) {
+  try {
+    for (unsigned t = 1; t < nthreads; ++t)
+      threads.emplace_back([this]() { work(); });
+  } catch (...) {
+    join();
+    throw;
+  };
+};
+
+Workers::~Workers() {
+  join();
+};
+
+void Workers::join() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  };
+  start.notify_all();
+  for (auto& thread: threads) thread.join();
+};
+
+void Workers::operator()(size_t n, const std::function<void (size_t)>& job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->job = &job;
+    this->n   = n;
+    next      = 0;
+    failed    = false;
+    error     = nullptr;
+    busy      = threads.size();
+    ++round;
+  };
+  start.notify_all();
+  run();
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [this]() { return busy == 0; });
+  this->job = nullptr;
+  if (error) std::rethrow_exception(error);
+};
+
+void Workers::work() {
+  size_t seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      start.wait(lock, [&]() { return stop || round != seen; });
+      if (stop) return;
+      seen = round;
+    };
+    run();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--busy == 0) done.notify_one();
+  };
+};
+
+void Workers::run() {
+  while (!failed.load(std::memory_order_relaxed)) {
+    size_t i = next.fetch_add(1, std::memory_order_relaxed);
+    if (i >= n) break;
+    try {
+      (*job)(i);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error) error = std::current_exception();
+      failed = true;
+    };
+  };
+};
+
+Result parallel_qag(
+    const std::function<double (double)>& f,
+    double a,
+    double b,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    gsl::integration::QAGMethod method,
+    unsigned threads
+) {
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+  if (threads == 0) threads = 1;
+
+  size_t npoints = gauss_kronrod(method).x.size();
+  Workers workers(threads);
+  auto integrate = [&](const auto& g, double from, double to) -> Result {
+    return quadpack::detail::qag(
+        [&g, method](double x0, double x1) {
+          return quadpack::qk(g, x0, x1, method);
+        },
+        npoints, from, to, epsabs, epsrel, limit, threads,
+        [&workers](size_t n, const std::function<void (size_t)>& job) {
+          workers(n, job);
+        }
+    );
+  };
+
+  if (a == -gsl::infinity)
+    if (b == gsl::infinity)
+      return integrate(
+          [&f](double t) -> double {
+            double x = (1 - t) / t;
+            return (f(x) + f(-x)) / t / t;
+          },
+          0, 1
+      );
+    else
+      return integrate(
+          [&f, b](double t) -> double {
+            return f(b - (1 - t) / t) / t / t;
+          },
+          0, 1
+      );
+  if (b == gsl::infinity)
+    return integrate(
+        [&f, a](double t) -> double {
+          return f(a + (1 - t) / t) / t / t;
+        },
+        0, 1
+    );
+  return integrate(f, a, b);
+};
+
+// Ogata's rule
+
+static const double ogata_step = 0.1;
+
+// k-th positive zero of J1: McMahon's expansion refined by Newton's method
+static double bessel_J1_zero(size_t k) {
+  double beta = (k + 0.25) * M_PI;
+  double j = beta - 0.375 / beta + 0.0234375 / (beta * beta * beta);
+  for (int l = 0; l < 3; ++l) {
+    double J1 = gsl::bessel_J1(j);
+    j -= J1 / (gsl::bessel_J0(j) - J1 / j);
+  };
+  return j;
+};
+
+// For h xi > ogata_t_max the nodes coincide with the zeros of J1 in double
+// precision, and the weights vanish
+static const double ogata_t_max = 4;
+
+// Terms of the sum smaller than ogata_tail * epsrel * result are negligible
+static const double ogata_tail = 1e-3;
+
+// Most integrands need only the first few hundred nodes of a level, so the
+// nodes are computed in chunks as the sums reach them. Completed chunks are
+// published through atomic pointers and are read without locking.
+class OgataRule {
+  public:
+    static const size_t chunk_size = 256;
+
+    struct Chunk {
+      size_t n; // less than chunk_size in the last chunk
+      double x[chunk_size];
+      double w[chunk_size];
+    };
+
+    OgataRule(unsigned level):
+      h(ldexp(ogata_step, -static_cast<int>(level))),
+      nchunks(static_cast<size_t>(ogata_t_max / h) / chunk_size + 1),
+      chunks(new std::atomic<const Chunk*>[nchunks])
+    {
+      for (size_t i = 0; i < nchunks; ++i) chunks[i] = nullptr;
+    };
+
+    // The chunk with the nodes i * chunk_size + 1 ... The chunk after the last
+    // one is empty.
+    const Chunk& chunk(size_t i) {
+      static const Chunk empty = { 0, {}, {} };
+      if (i >= nchunks) return empty;
+      const Chunk* c = chunks[i].load(std::memory_order_acquire);
+      if (c) return *c;
+      std::lock_guard<std::mutex> lock(mutex);
+      c = chunks[i].load(std::memory_order_relaxed);
+      if (!c) {
+        storage.emplace_back(make_chunk(i));
+        c = storage.back().get();
+        chunks[i].store(c, std::memory_order_release);
+      };
+      return *c;
+    };
+
+  private:
+    double h;
+    size_t nchunks;
+    std::unique_ptr<std::atomic<const Chunk*>[]> chunks;
+    std::mutex mutex; // guards storage
+    std::vector<std::unique_ptr<Chunk>> storage;
+
+    std::unique_ptr<Chunk> make_chunk(size_t i) const {
+      std::unique_ptr<Chunk> c(new Chunk);
+      c->n = 0;
+      for (size_t k = i * chunk_size + 1; k <= (i + 1) * chunk_size; ++k) {
+        double j = bessel_J1_zero(k);
+
+        // t = h xi with xi = j / pi
+        double t = h * j / M_PI;
+        if (t > ogata_t_max) break;
+
+        // x = pi psi(t) / h with psi(t) = t tanh(pi/2 sinh(t)). x - j is
+        // computed separately to preserve the accuracy of J1(x) near the zero.
+        double s     = M_PI * sinh(t);
+        double delta = -2 * j / (exp(s) + 1);
+
+        // J1'(j) = J0(j), J1''(j) = -J0(j) / j
+        double J0 = gsl::bessel_J0(j);
+        double J1 = std::abs(delta) < 1e-5
+                  ? J0 * delta * (1 - 0.5 * delta / j)
+                  : gsl::bessel_J1(j + delta);
+
+        // psi'(t)
+        double dpsi = (M_PI * t * cosh(t) + sinh(s)) / (1 + cosh(s));
+
+        // pi Y1(j) / J2(j) = 2 / (j J0(j)^2) at the zeros of J1
+        c->x[c->n] = j + delta;
+        c->w[c->n] = 2 * J1 * dpsi / (j * J0 * J0);
+        ++c->n;
+      };
+      return c;
+    };
+};
+
+static OgataRule& ogata_rule(unsigned level) {
+  struct Rules {
+    std::vector<std::unique_ptr<OgataRule>> rules;
+
+    Rules() {
+      for (unsigned l = 0; l <= ogata_max_level; ++l)
+        rules.emplace_back(new OgataRule(l));
+    };
+  };
+  static Rules rules;
+  return *rules.rules[level];
+};
+
+Result hankel(
+    const std::function<double (double)>& f,
+    double b,
+    double epsabs,
+    double epsrel,
+    unsigned max_level
+) {
+  if (!(b > 0))
+    throw std::invalid_argument("epa::integration::hankel: b must be positive");
+  if (max_level > ogata_max_level) max_level = ogata_max_level;
+
+  Result result { 0, 0, 0 };
+  for (unsigned level = 0; level <= max_level; ++level) {
+    OgataRule& rule = ogata_rule(level);
+    double sum    = 0;
+    double sumabs = 0;
+    size_t nterms = 0;
+    unsigned small = 0; // number of successive negligible terms
+    for (size_t i = 0; small < 3; ++i) {
+      const auto& chunk = rule.chunk(i);
+      for (size_t k = 0; k < chunk.n; ++k) {
+        double term = chunk.w[k] * f(chunk.x[k] / b);
+        ++nterms;
+        sum    += term;
+        sumabs += std::abs(term);
+        if (std::abs(term) > ogata_tail * epsrel * std::abs(sum))
+          small = 0;
+        else if (++small == 3)
+          break;
+      };
+      if (chunk.n < OgataRule::chunk_size) break;
+    };
+    result.nevals += nterms;
+    sum    /= b;
+    sumabs /= b;
+
+    if (level > 0) {
+      result.abserr = std::abs(sum - result.result);
+      result.result = sum;
+      if (
+          result.abserr <= std::max(epsabs, epsrel * std::abs(sum))
+       || result.abserr
+          <= 50 * std::numeric_limits<double>::epsilon() * sqrt(nterms) * sumabs
+      )
+        return result;
+    };
+    result.result = sum;
+  };
+  throw gsl::Error(GSL_EMAXITER);
+};
+
+// Double exponential rules. At level 0 the nodes are t = 0, +-1, +-2, ...,
+// and at level k > 0 they are t = +-(2 i + 1) / 2^k. For each node the rule
+// stores a parameter u from which the integration routine computes x(t) (see
+// DERule::make) and the weight dx/dt.
+class DERule {
+  public:
+    struct Nodes {
+      std::vector<double> u;
+      std::vector<double> w;
+    };
+
+    enum Type { tanh_sinh, exp_sinh, sinh_sinh };
+
+    double u0; // t = 0
+    double w0;
+
+    // levels[k][0] are the nodes with t > 0 and levels[k][1] with t < 0, in
+    // the order of increasing |t|
+    std::vector<std::array<Nodes, 2>> levels;
+
+    DERule(Type type): type(type) {
+      node(0, u0, w0);
+      levels.resize(de_max_level + 1);
+      for (unsigned level = 0; level <= de_max_level; ++level) {
+        double h = ldexp(1, -static_cast<int>(level));
+        for (int side = 0; side < 2; ++side) {
+          Nodes& nodes = levels[level][side];
+          for (size_t i = 0;; ++i) {
+            double t = level == 0 ? i + 1 : (2 * i + 1) * h;
+            double u, w;
+            if (!node(side ? -t : t, u, w)) break;
+            nodes.u.push_back(u);
+            nodes.w.push_back(w);
+          };
+        };
+      };
+    };
+
+  private:
+    Type type;
+
+    // u and w at t; false if the node is beyond the range of double
+    bool node(double t, double& u, double& w) const {
+      double s = M_PI_2 * sinh(t);
+      double c = M_PI_2 * cosh(t);
+      switch (type) {
+        case tanh_sinh:
+          // u = 1 - |x| on [-1, 1]
+          u = 2 / (exp(2 * std::abs(s)) + 1);
+          w = c / cosh(s) / cosh(s);
+          return u > 0 && w > 0;
+        case exp_sinh:
+          // x - a
+          u = exp(s);
+          w = c * u;
+          return u > 0 && std::isfinite(w);
+        case sinh_sinh:
+          // x
+          u = sinh(s);
+          w = c * cosh(s);
+          return std::isfinite(w);
+      };
+      return false;
+    };
+};
+
+static const DERule& de_rule(DERule::Type type) {
+  static const DERule rules[] = {
+    DERule(DERule::tanh_sinh),
+    DERule(DERule::exp_sinh),
+    DERule(DERule::sinh_sinh)
+  };
+  return rules[type];
+};
+
+// The trapezoidal sums of a double exponential rule. point(side, u, x) sets x
+// for the node u on the given side and returns false if the node must be
+// skipped because x coincides with an endpoint. The sums are multiplied by
+// scale.
+template <typename Point>
+static Result double_exponential(
+    const DERule& rule,
+    const std::function<double (double)>& f,
+    const Point& point,
+    double scale,
+    double epsabs,
+    double epsrel,
+    unsigned max_level
+) {
+  if (max_level > de_max_level) max_level = de_max_level;
+  const double eps = std::numeric_limits<double>::epsilon();
+
+  Result result { 0, 0, 0 };
+  double x;
+  double sum    = 0; // sum of w f over all the nodes so far
+  double sumabs = 0;
+  if (point(0, rule.u0, x)) {
+    sum    = rule.w0 * f(x);
+    sumabs = std::abs(sum);
+    ++result.nevals;
+  };
+
+  // Level 0. The nodes beyond t_cut give negligible contributions. The range
+  // of t also ends at the first node where w f is not finite: far in the
+  // tails of exp_sinh and sinh_sinh x reaches 1e304 and w f may be inf * 0.
+  std::array<std::vector<double>, 2> terms;
+  for (int side = 0; side < 2; ++side) {
+    const auto& nodes = rule.levels[0][side];
+    for (size_t i = 0; i < nodes.u.size(); ++i) {
+      double term = 0;
+      if (point(side, nodes.u[i], x)) {
+        term = nodes.w[i] * f(x);
+        ++result.nevals;
+        if (!std::isfinite(term)) break;
+      };
+      terms[side].push_back(term);
+      sum    += term;
+      sumabs += std::abs(term);
+    };
+  };
+  std::array<double, 2> t_cut;
+  for (int side = 0; side < 2; ++side) {
+    size_t n = terms[side].size();
+    while (n > 0 && std::abs(terms[side][n - 1]) <= eps * sumabs) --n;
+    t_cut[side] = n + 1;
+  };
+
+  double integral = sum;
+  for (unsigned level = 1; level <= max_level; ++level) {
+    double h = ldexp(1, -static_cast<int>(level));
+    double new_sum = 0; // sum over the new nodes
+    for (int side = 0; side < 2; ++side) {
+      const auto& nodes = rule.levels[level][side];
+      size_t n = std::min<size_t>(nodes.u.size(), (t_cut[side] / h + 1) / 2);
+      for (size_t i = 0; i < n; ++i)
+        if (point(side, nodes.u[i], x)) {
+          double term = nodes.w[i] * f(x);
+          ++result.nevals;
+          if (!std::isfinite(term)) continue;
+          new_sum += term;
+          sumabs  += std::abs(term);
+        };
+    };
+    double previous = integral;
+    integral = 0.5 * integral + h * new_sum;
+
+    result.result = scale * integral;
+    result.abserr = std::abs(scale * (integral - previous));
+    if (
+        result.abserr <= std::max(epsabs, epsrel * std::abs(result.result))
+     || result.abserr <= 100 * eps * std::abs(scale) * h * sumabs
+    )
+      return result;
+  };
+  throw gsl::Error(GSL_EMAXITER);
+};
+
+Result tanh_sinh(
+    const std::function<double (double)>& f,
+    double a,
+    double b,
+    double epsabs,
+    double epsrel,
+    unsigned max_level
+) {
+  if (!std::isfinite(a) || !std::isfinite(b))
+    throw std::invalid_argument(
+        "epa::integration::tanh_sinh: the range must be finite"
+    );
+  double half = 0.5 * (b - a);
+  return double_exponential(
+      de_rule(DERule::tanh_sinh),
+      f,
+      [a, b, half](int side, double u, double& x) -> bool {
+        x = side == 0 ? b - half * u : a + half * u;
+        return x != a && x != b;
+      },
+      half,
+      epsabs,
+      epsrel,
+      max_level
+  );
+};
+
+Result exp_sinh(
+    const std::function<double (double)>& f,
+    double a,
+    double epsabs,
+    double epsrel,
+    unsigned max_level
+) {
+  if (!std::isfinite(a))
+    throw std::invalid_argument(
+        "epa::integration::exp_sinh: a must be finite"
+    );
+  return double_exponential(
+      de_rule(DERule::exp_sinh),
+      f,
+      [a](int, double u, double& x) -> bool {
+        x = a + u;
+        return x != a;
+      },
+      1,
+      epsabs,
+      epsrel,
+      max_level
+  );
+};
+
+Result sinh_sinh(
+    const std::function<double (double)>& f,
+    double epsabs,
+    double epsrel,
+    unsigned max_level
+) {
+  return double_exponential(
+      de_rule(DERule::sinh_sinh),
+      f,
+      [](int, double u, double& x) -> bool {
+        x = u;
+        return true;
+      },
+      1,
+      epsabs,
+      epsrel,
+      max_level
+  );
+};
+
+Result double_exponential(
+    const std::function<double (double)>& f,
+    double a,
+    double b,
+    double epsabs,
+    double epsrel,
+    unsigned max_level
+) {
+  if (a == b) return { 0, 0, 0 };
+  if (a > b) {
+    Result result = double_exponential(f, b, a, epsabs, epsrel, max_level);
+    result.result = -result.result;
+    return result;
+  };
+  if (a == -gsl::infinity) {
+    if (b == gsl::infinity) return sinh_sinh(f, epsabs, epsrel, max_level);
+    return exp_sinh(
+        [&f](double x) -> double { return f(-x); },
+        -b,
+        epsabs,
+        epsrel,
+        max_level
+    );
+  };
+  if (b == gsl::infinity) return exp_sinh(f, a, epsabs, epsrel, max_level);
+  return tanh_sinh(f, a, b, epsabs, epsrel, max_level);
+};
+
+// Nodes of the Genz-Malik rule relative to the half-widths of the box
+static const double genz_malik_lambda2 = sqrt(9. / 70);
+static const double genz_malik_lambda4 = sqrt(9. / 10);
+static const double genz_malik_lambda5 = sqrt(9. / 19);
+
+size_t genz_malik_points(unsigned dim) {
+  return (size_t(1) << dim) + 2 * dim * dim + 2 * dim + 1;
+};
+
+// Infinite ranges of integration over the box [a_1, b_1] x ... x [a_n, b_n]
+// are mapped onto (0, 1] or (-1, 1) as in QAGI, QAGIU and QAGIL. Fills the
+// ranges of the new variables and returns true if any range is infinite.
+static bool finite_range(
+    const std::vector<double>& a,
+    const std::vector<double>& b,
+    std::vector<double>& from,
+    std::vector<double>& to
+) {
+  size_t n = a.size();
+  from.resize(n);
+  to.resize(n);
+  bool mapped = false;
+  for (size_t i = 0; i < n; ++i) {
+    bool lower = a[i] == -gsl::infinity;
+    bool upper = b[i] == gsl::infinity;
+    from[i] = lower ? upper ? -1 : 0 : upper ? 0 : a[i];
+    to[i]   = lower || upper ? 1 : b[i];
+    mapped = mapped || lower || upper;
+  };
+  return mapped;
+};
+
+// Maps the point t in the ranges of finite_range to x in the original box and
+// returns the Jacobian of the change of variables. A semi-infinite range is
+// mapped by |x - a| = ((1 - t) / t)^power: log|x - a| = power logit(1 - t),
+// so with power > 1 more decades of x fit into the bulk of t.
+static double map_to_range(
+    const std::vector<double>& a,
+    const std::vector<double>& b,
+    const double* t,
+    double* x,
+    unsigned power = 1
+) {
+  double jacobian = 1;
+  for (size_t i = 0; i < a.size(); ++i) {
+    bool lower = a[i] == -gsl::infinity;
+    bool upper = b[i] == gsl::infinity;
+    if (lower && upper) {
+      double t2 = sqr(t[i]);
+      x[i] = t[i] / (1 - t2);
+      jacobian *= (1 + t2) / sqr(1 - t2);
+    } else if (power > 1 && (lower || upper)) {
+      double r = pow((1 - t[i]) / t[i], power);
+      x[i] = upper ? a[i] + r : b[i] - r;
+      jacobian *= power * r / (t[i] * (1 - t[i]));
+    } else if (upper) {
+      x[i] = a[i] + (1 - t[i]) / t[i];
+      jacobian /= sqr(t[i]);
+    } else if (lower) {
+      x[i] = b[i] - (1 - t[i]) / t[i];
+      jacobian /= sqr(t[i]);
+    } else
+      x[i] = t[i];
+  };
+  return jacobian;
+};
+
+namespace {
+
+struct Box {
+  std::vector<double> center;
+  std::vector<double> half_width;
+  double result;
+  double error;
+  unsigned split; // the axis to bisect the box along
+
+  bool operator<(const Box& box) const {
+    return error < box.error;
+  };
+};
+
+};
+
+// Applies the Genz-Malik rule to the box, filling its result, error and split
+static void genz_malik(const Function_nd& f, Box& box, std::vector<double>& x) {
+  unsigned n = box.center.size();
+  const auto& c = box.center;
+  const auto& h = box.half_width;
+
+  double volume = 1;
+  for (unsigned i = 0; i < n; ++i) volume *= 2 * h[i];
+
+  x = c;
+  double f0 = f(x.data());
+
+  // points on the axes, and the fourth differences along them
+  double sum2 = 0, sum3 = 0;
+  double max_diff = -1;
+  box.split = 0;
+  for (unsigned i = 0; i < n; ++i) {
+    x[i] = c[i] - genz_malik_lambda2 * h[i];
+    double f2 = f(x.data());
+    x[i] = c[i] + genz_malik_lambda2 * h[i];
+    f2 += f(x.data());
+    x[i] = c[i] - genz_malik_lambda4 * h[i];
+    double f3 = f(x.data());
+    x[i] = c[i] + genz_malik_lambda4 * h[i];
+    f3 += f(x.data());
+    x[i] = c[i];
+    sum2 += f2;
+    sum3 += f3;
+
+    double diff = std::abs(
+        f2 - 2 * f0
+      - sqr(genz_malik_lambda2 / genz_malik_lambda4) * (f3 - 2 * f0)
+    );
+    if (
+        diff > max_diff * (1 + 1e-10)
+     || (diff >= max_diff * (1 - 1e-10) && h[i] > h[box.split])
+    ) {
+      max_diff  = std::max(diff, max_diff);
+      box.split = i;
+    };
+  };
+
+  // points in the coordinate planes
+  double sum4 = 0;
+  for (unsigned i = 0; i < n; ++i)
+    for (unsigned j = i + 1; j < n; ++j)
+      for (int si = -1; si <= 1; si += 2)
+        for (int sj = -1; sj <= 1; sj += 2) {
+          x[i] = c[i] + si * genz_malik_lambda4 * h[i];
+          x[j] = c[j] + sj * genz_malik_lambda4 * h[j];
+          sum4 += f(x.data());
+          x[i] = c[i];
+          x[j] = c[j];
+        };
+
+  // vertices of the box scaled by lambda5
+  double sum5 = 0;
+  for (size_t k = 0; k < (size_t(1) << n); ++k) {
+    for (unsigned i = 0; i < n; ++i)
+      x[i] = c[i] + (k >> i & 1 ? 1 : -1) * genz_malik_lambda5 * h[i];
+    sum5 += f(x.data());
+  };
+
+  double weight1  = (12824. - 9120. * n + 400. * n * n) / 19683;
+  double weight2  = 980. / 6561;
+  double weight3  = (1820. - 400. * n) / 19683;
+  double weight4  = 200. / 19683;
+  double weight5  = 6859. / 19683 / (size_t(1) << n);
+  double weightE1 = (729. - 950. * n + 50. * n * n) / 729;
+  double weightE2 = 245. / 486;
+  double weightE3 = (265. - 100. * n) / 1458;
+  double weightE4 = 25. / 729;
+
+  box.result = volume * (
+      weight1 * f0 + weight2 * sum2 + weight3 * sum3 + weight4 * sum4
+    + weight5 * sum5
+  );
+  double result5 = volume * (
+      weightE1 * f0 + weightE2 * sum2 + weightE3 * sum3 + weightE4 * sum4
+  );
+  box.error = std::abs(box.result - result5);
+};
+
+Result cubature(
+    const Function_nd& f,
+    const std::vector<double>& a,
+    const std::vector<double>& b,
+    double epsabs,
+    double epsrel,
+    size_t max_evals
+) {
+  unsigned n = a.size();
+  if (n < 2 || b.size() != n)
+    throw std::invalid_argument(
+        "epa::integration::cubature: the bounds must have the same dimension"
+        " of at least 2"
+    );
+
+  std::vector<double> from, to;
+  bool mapped = finite_range(a, b, from, to);
+  std::vector<double> y(n);
+  Function_nd g = [&](const double* t) -> double {
+    double jacobian = map_to_range(a, b, t, y.data());
+    return f(y.data()) * jacobian;
+  };
+
+  size_t points = genz_malik_points(n);
+  Result result { 0, 0, 0 };
+  std::vector<Box> heap(1);
+  std::vector<double> x(n);
+  Box& box = heap.front();
+  box.center.resize(n);
+  box.half_width.resize(n);
+  for (unsigned i = 0; i < n; ++i) {
+    box.center[i]     = 0.5 * (from[i] + to[i]);
+    box.half_width[i] = 0.5 * (to[i] - from[i]);
+  };
+  genz_malik(mapped ? g : f, box, x);
+  result.nevals = points;
+  result.result = box.result;
+  result.abserr = box.error;
+
+  while (result.abserr > std::max(epsabs, epsrel * std::abs(result.result))) {
+    if (result.nevals + 2 * points > max_evals) {
+      // the running sums may have drifted: recompute them before giving up
+      result.result = result.abserr = 0;
+      for (const auto& box: heap) {
+        result.result += box.result;
+        result.abserr += box.error;
+      };
+      if (result.abserr <= std::max(epsabs, epsrel * std::abs(result.result)))
+        break;
+      throw gsl::Error(GSL_EMAXITER);
+    };
+
+    std::pop_heap(heap.begin(), heap.end());
+    Box left = std::move(heap.back());
+    heap.pop_back();
+    result.result -= left.result;
+    result.abserr -= left.error;
+
+    Box right = left;
+    unsigned i = left.split;
+    left.half_width[i] *= 0.5;
+    right.half_width[i] = left.half_width[i];
+    left.center[i]  -= left.half_width[i];
+    right.center[i] += right.half_width[i];
+
+    for (Box* half: { &left, &right }) {
+      genz_malik(mapped ? g : f, *half, x);
+      result.result += half->result;
+      result.abserr += half->error;
+      heap.push_back(std::move(*half));
+      std::push_heap(heap.begin(), heap.end());
+    };
+    result.nevals += 2 * points;
+  };
+  return result;
+};
+
+// Number of bins of the VEGAS grid in each dimension
+static const unsigned vegas_bins = 50;
+
+// Damping of the VEGAS grid refinement
+static const double vegas_alpha = 1.5;
+
+// Upper bound on the number of chunks the hypercubes are sampled in. The
+// chunks are summed in a fixed order, so the result does not depend on how
+// they are distributed between threads.
+static const size_t vegas_chunks = 256;
+
+// Moves the edges of the bins of one dimension of the VEGAS grid so that each
+// bin gets the same share of the smoothed sum of f^2 (d)
+static void vegas_refine(double* edges, std::vector<double>& d) {
+  unsigned n = vegas_bins;
+
+  // smoothing
+  double prev = d[0];
+  double cur  = d[0];
+  d[0] = (d[0] + d[1]) / 2;
+  for (unsigned i = 1; i < n - 1; ++i) {
+    prev = cur;
+    cur  = d[i];
+    d[i] = (prev + cur + d[i + 1]) / 3;
+  };
+  d[n - 1] = (cur + d[n - 1]) / 2;
+
+  double sum = 0;
+  for (unsigned i = 0; i < n; ++i) sum += d[i];
+  if (!(sum > 0)) return;
+
+  std::vector<double> weight(n);
+  double total = 0;
+  for (unsigned i = 0; i < n; ++i) {
+    double r = d[i] / sum;
+    weight[i] = r > 0 && r < 1 ? pow((r - 1) / log(r), vegas_alpha) : 0;
+    total += weight[i];
+  };
+  if (!(total > 0)) return;
+
+  double per_bin = total / n;
+  std::vector<double> fresh(n + 1);
+  fresh[0] = 0;
+  fresh[n] = 1;
+  double xold, xnew = edges[0], dw = 0;
+  unsigned j = 1;
+  for (unsigned k = 0; k < n; ++k) {
+    dw += weight[k];
+    xold = xnew;
+    xnew = edges[k + 1];
+    for (; dw > per_bin && j < n; ++j) {
+      dw -= per_bin;
+      fresh[j] = xnew - (xnew - xold) * dw / weight[k];
+    };
+  };
+  std::copy(fresh.begin(), fresh.end(), edges);
+};
+
+MonteCarloResult vegas(
+    const Function_nd& f,
+    const std::vector<double>& a,
+    const std::vector<double>& b,
+    double epsabs,
+    double epsrel,
+    size_t calls,
+    unsigned max_iterations,
+    uint64_t seed,
+    unsigned threads
+) {
+  unsigned n = a.size();
+  if (n == 0 || b.size() != n)
+    throw std::invalid_argument(
+        "epa::integration::vegas: the bounds must have the same dimension"
+    );
+
+  // the Philox counter is (cube, call, iteration, dimension / 2) packed into
+  // 64 + 32 + 16 + 16 bits
+  if (n > 1u << 17 || max_iterations > 1u << 16 || calls >> 32)
+    throw std::invalid_argument(
+        "epa::integration::vegas: at most 2^17 dimensions, 2^16 iterations"
+        " and 2^32 calls are supported"
+    );
+
+  std::vector<double> from, to;
+  finite_range(a, b, from, to);
+
+  // stratification: strata^n hypercubes with at least 2 points in each
+  unsigned strata = std::max(1., floor(pow(0.5 * calls, 1. / n)));
+  size_t cubes = 1;
+  for (unsigned i = 0; i < n; ++i) cubes *= strata;
+  size_t cube_calls = std::max<size_t>(2, calls / cubes);
+  size_t chunks = std::min(cubes, vegas_chunks);
+
+  // grid[i * (vegas_bins + 1) + k] is the k-th edge in the i-th dimension
+  std::vector<double> grid(n * (vegas_bins + 1));
+  for (unsigned i = 0; i < n; ++i)
+    for (unsigned k = 0; k <= vegas_bins; ++k)
+      grid[i * (vegas_bins + 1) + k] = double(k) / vegas_bins;
+
+  struct Chunk {
+    double result;
+    double variance;
+    std::vector<double> d; // sums of f^2 in the bins of the grid
+  };
+  std::vector<Chunk> partial(chunks);
+  for (auto& chunk: partial) chunk.d.resize(n * vegas_bins);
+
+  std::array<uint32_t, 2> key = { uint32_t(seed), uint32_t(seed >> 32) };
+  MonteCarloResult result { 0, 0, 0, 0, 0 };
+  double sum_w = 0, sum_wi = 0, sum_wi2 = 0;
+  for (unsigned iteration = 0; iteration < max_iterations; ++iteration) {
+    parallel_for(
+        chunks,
+        threads,
+        [&]() -> std::function<void (size_t)> {
+          std::vector<double> u(n + 1), t(n), x(n);
+          std::vector<unsigned> bins(n);
+          return [&, u, t, x, bins](size_t c) mutable {
+            Chunk& chunk = partial[c];
+            chunk.result = chunk.variance = 0;
+            std::fill(chunk.d.begin(), chunk.d.end(), 0);
+            for (
+                size_t cube = c * cubes / chunks;
+                cube < (c + 1) * cubes / chunks;
+                ++cube
+            ) {
+              double s1 = 0, s2 = 0;
+              for (size_t call = 0; call < cube_calls; ++call) {
+                for (unsigned i = 0; i < n; i += 2) {
+                  auto r = philox(
+                      {
+                        uint32_t(cube),
+                        uint32_t(cube >> 32),
+                        uint32_t(call),
+                        iteration << 16 | i / 2
+                      },
+                      key
+                  );
+                  u[i]     = uniform(r[0], r[1]);
+                  u[i + 1] = uniform(r[2], r[3]);
+                };
+
+                double jacobian = 1;
+                size_t index = cube;
+                for (unsigned i = 0; i < n; ++i) {
+                  double y = (index % strata + u[i]) / strata;
+                  index /= strata;
+                  double pos = y * vegas_bins;
+                  unsigned k = std::min<unsigned>(pos, vegas_bins - 1);
+                  const double* edge = &grid[i * (vegas_bins + 1) + k];
+                  double width = edge[1] - edge[0];
+                  double z = edge[0] + width * (pos - k);
+                  jacobian *= vegas_bins * width * (to[i] - from[i]);
+                  t[i] = from[i] + (to[i] - from[i]) * z;
+                  bins[i] = k;
+                };
+                jacobian *= map_to_range(a, b, t.data(), x.data());
+
+                double fx = f(x.data()) * jacobian;
+                s1 += fx;
+                s2 += sqr(fx);
+                for (unsigned i = 0; i < n; ++i)
+                  chunk.d[i * vegas_bins + bins[i]] += sqr(fx);
+              };
+              double mean = s1 / cube_calls;
+              chunk.result   += mean;
+              chunk.variance += std::max(
+                  0., (s2 / cube_calls - sqr(mean)) / (cube_calls - 1)
+              );
+            };
+          };
+        }
+    );
+
+    double I = 0, variance = 0;
+    std::vector<double> d(vegas_bins);
+    for (const auto& chunk: partial) {
+      I        += chunk.result;
+      variance += chunk.variance;
+    };
+    I        /= cubes;
+    variance /= sqr(double(cubes));
+    result.nevals += cubes * cube_calls;
+    ++result.iterations;
+
+    if (variance == 0) {
+      // the integrand is constant on each hypercube
+      result.result = I;
+      result.abserr = 0;
+      result.chi2   = 0;
+      return result;
+    };
+
+    double w = 1 / variance;
+    sum_w   += w;
+    sum_wi  += w * I;
+    sum_wi2 += w * sqr(I);
+    result.result = sum_wi / sum_w;
+    result.abserr = 1 / sqrt(sum_w);
+    result.chi2   = result.iterations > 1
+                  ? std::max(0., sum_wi2 - sqr(sum_wi) / sum_w)
+                    / (result.iterations - 1)
+                  : 0;
+    if (
+        result.iterations > 1
+     && result.abserr <= std::max(epsabs, epsrel * std::abs(result.result))
+    )
+      return result;
+
+    for (unsigned i = 0; i < n; ++i) {
+      std::fill(d.begin(), d.end(), 0);
+      for (const auto& chunk: partial)
+        for (unsigned k = 0; k < vegas_bins; ++k)
+          d[k] += chunk.d[i * vegas_bins + k];
+      vegas_refine(&grid[i * (vegas_bins + 1)], d);
+    };
+  };
+  throw gsl::Error(GSL_EMAXITER);
+};
+
+// Primitive polynomials and initial direction numbers of the Sobol sequence
+// for the dimensions 2 ... sobol_max_dim (new-joe-kuo-6.21201). The first
+// dimension is the van der Corput sequence.
+static const struct {
+  unsigned s;        // degree of the polynomial
+  unsigned a;        // its coefficients except the highest and the lowest
+  unsigned m[6];     // initial direction numbers
+} sobol_polynomials[sobol_max_dim - 1] = {
+  { 1,  0, { 1 } },
+  { 2,  1, { 1, 3 } },
+  { 3,  1, { 1, 3, 1 } },
+  { 3,  2, { 1, 1, 1 } },
+  { 4,  1, { 1, 1, 3, 3 } },
+  { 4,  4, { 1, 3, 5, 13 } },
+  { 5,  2, { 1, 1, 5, 5, 17 } },
+  { 5,  4, { 1, 1, 5, 5, 5 } },
+  { 5,  7, { 1, 1, 7, 11, 19 } },
+  { 5, 11, { 1, 1, 5, 1, 1 } },
+  { 5, 13, { 1, 1, 1, 3, 11 } },
+  { 5, 14, { 1, 3, 5, 5, 31 } },
+  { 6,  1, { 1, 3, 3, 9, 7, 49 } },
+  { 6, 13, { 1, 1, 1, 15, 21, 21 } },
+  { 6, 16, { 1, 3, 1, 13, 27, 49 } }
+};
+
+// Direction numbers v[k] of the dimension d of the Sobol sequence, aligned to
+// the highest bit
+static std::array<uint32_t, 32> sobol_directions(unsigned d) {
+  std::array<uint32_t, 32> v;
+  if (d == 0) {
+    for (unsigned k = 0; k < 32; ++k) v[k] = uint32_t(1) << (31 - k);
+    return v;
+  };
+  const auto& p = sobol_polynomials[d - 1];
+  for (unsigned k = 0; k < 32; ++k)
+    if (k < p.s)
+      v[k] = p.m[k] << (31 - k);
+    else {
+      v[k] = v[k - p.s] ^ (v[k - p.s] >> p.s);
+      for (unsigned l = 1; l < p.s; ++l)
+        if (p.a >> (p.s - 1 - l) & 1) v[k] ^= v[k - l];
+    };
+  return v;
+};
+
+// Number of points of the Sobol sequence per chunk in qmc
+static const size_t qmc_chunk = 1024;
+
+// Power of the mapping of the semi-infinite ranges in qmc (see map_to_range).
+// The b integrands of the luminosities fall as 1 / b over two to three
+// decades; with power 2 qmc needs 4 times fewer points for them than with the
+// mapping of cubature; 3 gives no further gain and 4 needs more points.
+static const unsigned qmc_power = 2;
+
+Result qmc(
+    const Function_nd& f,
+    const std::vector<double>& a,
+    const std::vector<double>& b,
+    double epsabs,
+    double epsrel,
+    size_t points,
+    unsigned replicas,
+    size_t max_evals,
+    uint64_t seed,
+    unsigned threads
+) {
+  unsigned n = a.size();
+  if (n == 0 || n > sobol_max_dim || b.size() != n)
+    throw std::invalid_argument(
+        "epa::integration::qmc: the bounds must have the same dimension"
+        " from 1 to sobol_max_dim"
+    );
+  if (replicas < 2) replicas = 2;
+
+  std::vector<double> from, to;
+  finite_range(a, b, from, to);
+
+  // v[k * n + d]: direction numbers by bit, so that the update of a point
+  // touches consecutive memory
+  std::vector<uint32_t> v(32 * n);
+  for (unsigned d = 0; d < n; ++d) {
+    auto vd = sobol_directions(d);
+    for (unsigned k = 0; k < 32; ++k) v[k * n + d] = vd[k];
+  };
+
+  // shift[r * n + d]: random digital shift of the replica r
+  std::vector<uint32_t> shift(replicas * n);
+  std::array<uint32_t, 2> key = { uint32_t(seed), uint32_t(seed >> 32) };
+  for (unsigned r = 0; r < replicas; ++r)
+    for (unsigned d = 0; d < n; d += 4) {
+      auto bits = philox({ r, d, 0, 0 }, key);
+      for (unsigned i = 0; i < 4 && d + i < n; ++i)
+        shift[r * n + d + i] = bits[i];
+    };
+
+  size_t N = qmc_chunk;
+  while (N < points && N < (size_t(1) << 32)) N *= 2;
+
+  std::vector<double> sums(replicas, 0);
+  Result result { 0, 0, 0 };
+  size_t done = 0; // points of the sequence already summed
+  while (true) {
+    // sum f over the points done ... N - 1 for each replica in chunks
+    size_t chunks = (N - done) / qmc_chunk;
+    std::vector<double> partial(chunks * replicas);
+    parallel_for(
+        chunks * replicas,
+        threads,
+        [&]() -> std::function<void (size_t)> {
+          std::vector<uint32_t> x(n);
+          std::vector<double> t(n), y(n);
+          return [&, x, t, y](size_t job) mutable {
+            size_t chunk = job / replicas;
+            unsigned r   = job % replicas;
+            size_t first = done + chunk * qmc_chunk;
+
+            // the point with the index first in the Gray code order
+            size_t gray = first ^ first >> 1;
+            for (unsigned d = 0; d < n; ++d) x[d] = shift[r * n + d];
+            for (unsigned k = 0; gray >> k; ++k)
+              if (gray >> k & 1)
+                for (unsigned d = 0; d < n; ++d) x[d] ^= v[k * n + d];
+
+            double sum = 0;
+            for (size_t i = first; i < first + qmc_chunk; ++i) {
+              double jacobian = 1;
+              for (unsigned d = 0; d < n; ++d) {
+                double u = (x[d] + 0.5) * 0x1p-32;
+                t[d] = from[d] + (to[d] - from[d]) * u;
+                jacobian *= to[d] - from[d];
+              };
+              jacobian *= map_to_range(a, b, t.data(), y.data(), qmc_power);
+              sum += f(y.data()) * jacobian;
+
+              // the next point differs by the direction number of the lowest
+              // zero bit of i
+              unsigned k = 0;
+              while (i >> k & 1) ++k;
+              if (k < 32)
+                for (unsigned d = 0; d < n; ++d) x[d] ^= v[k * n + d];
+            };
+            partial[job] = sum;
+          };
+        }
+    );
+    for (size_t job = 0; job < partial.size(); ++job)
+      sums[job % replicas] += partial[job];
+    result.nevals += (N - done) * replicas;
+    done = N;
+
+    double mean = 0;
+    for (double s: sums) mean += s / N;
+    mean /= replicas;
+    double variance = 0;
+    for (double s: sums) variance += sqr(s / N - mean);
+    variance /= replicas * (replicas - 1);
+
+    result.result = mean;
+    result.abserr = sqrt(variance);
+    if (result.abserr <= std::max(epsabs, epsrel * std::abs(mean)))
+      return result;
+    if (result.nevals + N * replicas > max_evals || N >= size_t(1) << 32)
+      throw gsl::Error(GSL_EMAXITER);
+    N *= 2;
+  };
+};
+
+// Number of partial integrals summed before the series acceleration is tried
+static const size_t hankel_tail_min_terms = 4;
+
+Result hankel_tail(
+    const std::function<double (double)>& f,
+    double b,
+    double a,
+    double epsabs,
+    double epsrel,
+    size_t limit,
+    gsl::integration::QAGMethod method,
+    size_t max_terms
+) {
+  if (!(b > 0))
+    throw std::invalid_argument(
+        "epa::integration::hankel_tail: b must be positive"
+    );
+  if (a < 0) a = 0;
+
+  Result result { 0, 0, 0 };
+  auto g = [&f, b, &result](double q) -> double {
+    ++result.nevals;
+    return f(q) * gsl::bessel_J1(b * q);
+  };
+
+  // the first zero of J1(b q) above a
+  size_t k = std::max(1.0, floor(a * b / M_PI));
+  double z = bessel_J1_zero(k) / b;
+  while (z <= a) z = bessel_J1_zero(++k) / b;
+
+  std::vector<double> terms;
+  double sum  = 0; // plain sum of the terms
+  double prev = 0; // previous accelerated sum
+  double from = a;
+  while (terms.size() < max_terms) {
+    double term = gsl::integration::qag(
+        g, from, z, 0.1 * epsabs, epsrel, limit, method
+    ).result;
+    terms.push_back(term);
+    sum += term;
+    from = z;
+    z = bessel_J1_zero(++k) / b;
+
+    // f has decayed: the rest of the series is negligible
+    double tolerance = std::max(epsabs, epsrel * std::abs(sum));
+    if (std::abs(term) <= 1e-3 * tolerance) {
+      result.result = sum;
+      result.abserr = std::abs(term);
+      return result;
+    };
+
+    if (terms.size() < hankel_tail_min_terms) continue;
+
+    double accel = gsl::sum::levin_u(terms).sum;
+    if (terms.size() > hankel_tail_min_terms) {
+      result.abserr = std::abs(accel - prev);
+      if (result.abserr <= std::max(epsabs, epsrel * std::abs(accel))) {
+        result.result = accel;
+        return result;
+      };
+    };
+    prev = accel;
+  };
+  throw gsl::Error(GSL_EMAXITER);
+};
+
+FFTLog fftlog(const std::vector<double>& f, double q0, double dln) {
+  size_t n = f.size();
+  if (n < 2 || (n & (n - 1)))
+    throw std::invalid_argument(
+        "epa::integration::fftlog: the number of points must be a power of 2"
+    );
+  if (!(q0 > 0 && dln > 0))
+    throw std::invalid_argument(
+        "epa::integration::fftlog: the grid must be positive and increasing"
+    );
+
+  // log(U(i eta)), where U(x) = integral of t^x J1(t) dt from 0 to infinity
+  //                           = 2^x Gamma(1 + x/2) / Gamma(1 - x/2)
+  auto lnU = [](double eta) -> std::complex<double> {
+    std::complex<double> x(0, eta);
+    return x * M_LN2 + gsl::lngamma(1. + 0.5 * x) - gsl::lngamma(1. - 0.5 * x);
+  };
+
+  // log(b_{n-1-j} q_j) such that the coefficient of the Nyquist frequency is
+  // real
+  double eta_nyquist = M_PI / dln;
+  double theta = lnU(eta_nyquist).imag();
+  double lnbq  = (theta - M_PI * std::round(theta / M_PI)) / eta_nyquist;
+
+  // log(b0 q0)
+  double lnbq0 = lnbq - (n - 1) * dln;
+
+  std::vector<std::complex<double>> c(f.begin(), f.end());
+  gsl::fft(c);
+  for (size_t k = 0; k < n; ++k) {
+    double m = k <= n / 2 ? double(k) : double(k) - double(n);
+    double eta = 2 * M_PI * m / (n * dln);
+    std::complex<double> u = exp(lnU(eta) - std::complex<double>(0, eta * lnbq0));
+    if (2 * k == n) u = u.real();
+    c[k] *= u / double(n);
+  };
+  gsl::fft(c);
+
+  FFTLog result;
+  result.b0 = exp(lnbq0) / q0;
+  result.result.resize(n);
+  for (size_t j = 0; j < n; ++j)
+    result.result[j] = c[j].real() / (result.b0 * exp(j * dln));
+  return result;
+};
+
+}; // namespace integration
+
+}; // namespace epa
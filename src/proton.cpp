@@ -1,3 +1,6 @@
+#include <algorithm>
+
+#include <epa/compose.hpp>
 #include <epa/proton.hpp>
 
 namespace epa {
@@ -12,66 +15,43 @@ FormFactor proton_dipole_form_factor(double lambda2) {
 
 Spectrum
 proton_dipole_spectrum(double energy, double lambda2) {
-  const double mu2m1 = sqr(proton_magnetic_moment) - 1;
-  double b = sqr(2 * proton_mass) / lambda2;
-
-  double b1 = b - 1;
-  double x  = mu2m1 / (b1 * b1 * b1);
-
-  double l0 = 4 - mu2m1 / b;
-  double l1 = x / b1;
-  double c0 = x * (11 + b * (-7   + 2   * b)) / 6 - 17. / 6;
-  double c1 = x * (5  + b * (-4.5 + 1.5 * b)) - 7;
-  double c2 = x * (3  + b * (-3   + b)) - 4;
-
-  double lg2 = lambda2 * sqr(energy / proton_mass);
-  return [=](double w) -> double {
-    double a = sqr(w) / lg2;
-    return (alpha / pi) / w * (
-          (1 + l0 * a) * log(1 + 1. / a)
-        - l1 * (1 + a / b) * log((a + b) / (a + 1))
-        + (c0 + a * (c1 + c2 * a)) / sqr(a + 1)
-    );
-  };
+  return compose::proton_dipole_spectrum(energy, lambda2);
 };
 
 Spectrum
 proton_dipole_spectrum_Dirac(double energy, double lambda2) {
-  double c = alpha / pi;
-  double b = sqr(2 * proton_mass) / lambda2;
-  const double mu = proton_magnetic_moment;
-  double l01 = 4 - 2 * (mu - 1) / b;
-  double l10;
-  double l11;
-  {
-    double c1 = (mu - 1) / pow(b - 1, 4);
-    double c2 = (mu - 1) / (b - 1);
-    l10 = c1 * (c2 * (1 + 3 * b) - 2);
-    l11 = c1 * (c2 * 4 - 2 / b);
+  return compose::proton_dipole_spectrum_Dirac(energy, lambda2);
+};
+
+Spectrum_batch
+proton_dipole_spectrum_batch(double energy, double lambda2) {
+  return [n = compose::proton_dipole_spectrum(energy, lambda2)](
+      size_t size, const double* w, double* result
+  ) {
+#pragma omp simd
+    for (size_t i = 0; i < size; ++i) result[i] = n(w[i]);
   };
-  double a0 = -17. / 6
-            + (mu - 1) * (2 * b * b - 7 * b + 11) / (3 * pow(b - 1, 3))
-            + sqr(mu - 1) * (b * b - 8 * b - 17) / (6 * pow(b - 1, 4));
-  double a1 = -7
-            + (mu - 1) * (3 * b * b - 9 * b + 10) / pow(b - 1, 3)
-            - sqr(mu - 1) * (b + 7) / pow(b - 1, 4);
-  double a2 = -4
-            + (mu - 1) * 2 * (b * b - 3 * b + 3) / pow(b - 1, 3)
-            - 4 * sqr(mu - 1) / pow(b - 1, 4);
-  double lg2 = lambda2 * sqr(energy / proton_mass);
-  return [=](double w) -> double {
-    double a = sqr(w) / lg2;
-    double n1 = (1 + l01 * a) * log(1 + 1. / a)
-              + (l10 + l11 * a) * log((a + b) / (a + 1));
-    double n2 = (a0 + a1 * a + a2 * a * a) / sqr(a + 1);
-    double n = n1 + n2;
-//    if (abs(n / n1) < 1e3 * a * std::numeric_limits<double>().epsilon()) return 0;
-    return c / w * n;
+};
+
+Spectrum_batch
+proton_dipole_spectrum_Dirac_batch(double energy, double lambda2) {
+  return [n = compose::proton_dipole_spectrum_Dirac(energy, lambda2)](
+      size_t size, const double* w, double* result
+  ) {
+#pragma omp simd
+    for (size_t i = 0; i < size; ++i) result[i] = n(w[i]);
   };
 };
 
 Spectrum_b
 proton_dipole_spectrum_b_Dirac(double energy, double lambda2) {
+  return compose::proton_dipole_spectrum_b_Dirac(energy, lambda2);
+};
+
+Spectrum_b_batch
+proton_dipole_spectrum_b_Dirac_batch(double energy, double lambda2) {
+  // see spectrum_b_dipole_batch
+  const size_t block = 64;
   double c = alpha / sqr(pi);
   double m2 = sqr(2 * proton_mass);
   double gamma = energy / proton_mass;
@@ -80,22 +60,43 @@ proton_dipole_spectrum_b_Dirac(double energy, double lambda2) {
   double k12 = (mu - 1) * sqr(x / (1 - x));
   double k11 = 1 + k12;
   double k00 = (1 - mu * x) / (1 - x) * lambda2 / 2;
-  return [=](double b, double w) -> double {
-    EPA_TRY
-      double wg = w / gamma;
-      double wg2 = sqr(wg);
-      double rl = sqrt(lambda2 + wg2);
-      double rm = sqrt(m2      + wg2);
-      return c / w * sqr(
-            wg * gsl::bessel_K1(b * wg)
-          - k11 * rl * gsl::bessel_K1(b * rl)
-          + k12 * rm * gsl::bessel_K1(b * rm)
-          - k00 * b  * gsl::bessel_K0(b * rl)
-      );
-    EPA_BACKTRACE(
-        "lambda (b, w) %e, %e\n  defined in proton_dipole_spectrum_b(%e, %e)",
-        b, w, energy, lambda2
-    );
+  return [=](size_t size, const double* b, const double* w, double* result) {
+    double rl[block];
+    double rm[block];
+    double u[block];
+    double v[block];
+    double z[block];
+    double k1u[block];
+    double k0v[block];
+    double k1v[block];
+    double k1z[block];
+    for (size_t start = 0; start < size; start += block) {
+      size_t m = std::min(block, size - start);
+      const double* bs = b + start;
+      const double* ws = w + start;
+      double* n = result + start;
+#pragma omp simd
+      for (size_t i = 0; i < m; ++i) {
+        double wg = ws[i] / gamma;
+        double wg2 = sqr(wg);
+        rl[i] = sqrt(lambda2 + wg2);
+        rm[i] = sqrt(m2      + wg2);
+        u[i] = bs[i] * wg;
+        v[i] = bs[i] * rl[i];
+        z[i] = bs[i] * rm[i];
+      };
+      bessel_K1(m, u, k1u);
+      bessel_K01(m, v, k0v, k1v);
+      bessel_K1(m, z, k1z);
+#pragma omp simd
+      for (size_t i = 0; i < m; ++i)
+        n[i] = c / ws[i] * sqr(
+              ws[i] / gamma * k1u[i]
+            - k11 * rl[i] * k1v[i]
+            + k12 * rm[i] * k1z[i]
+            - k00 * bs[i] * k0v[i]
+        );
+    };
   };
 };
 
@@ -109,11 +110,13 @@ double pp_elastic_slope(double collision_energy) {
 
 std::function<double (double)>
 pp_upc_probability(double collision_energy) {
-  // see hep-ph/0608271
+  return compose::pp_upc_probability(collision_energy);
+};
+
+UPCProbability_Gaussians pp_upc_probability_Gaussians(double collision_energy) {
+  // (1 - exp(-b^2 / B))^2 expanded
   double B = 2 * pp_elastic_slope(collision_energy);
-  return [B](double b) -> double {
-    return sqr(1 - exp(-sqr(b) / B));
-  };
+  return { { 1, 0 }, { -2, 1 / B }, { 1, 2 / B } };
 };
 
 Luminosity_y
@@ -138,16 +141,11 @@ static double ppx_luminosity_internal(
 ) {
   double e = exp(-0.5 * sqr(b1 - b2) / B);
   double z = b1 * b2 / B;
-  double i01 = psum * gsl::bessel_I0_scaled(z);
-  double i02 = psum * gsl::bessel_I0_scaled(2 * z);
-  double i21, i22;
-  if (pdifference != 0) {
-    i21 = pdifference * gsl::bessel_In_scaled(2, z);
-    i22 = pdifference * gsl::bessel_In_scaled(2, 2 * z);
-  } else {
-    i21 = 0;
-    i22 = 0;
-  };
+  auto i = bessel_I012_scaled_2x(z);
+  double i01 = psum * i.first.I0;
+  double i02 = psum * i.second.I0;
+  double i21 = pdifference * i.first.I2;
+  double i22 = pdifference * i.second.I2;
   return -2 * e * (i01 + i21) + e * e * (i02 + i22);
 };
 
@@ -166,38 +164,43 @@ ppx_luminosity_y_b(
     double pdifference;
   };
 
-  auto env = std::make_shared<Env>();
-
-  auto fb2 = [env, B, n = std::move(n)](double b2) -> double {
+  auto fb2 = [B, n = std::move(n)](const Env& env, double b2) -> double {
     EPA_TRY
-      return b2 * n(env->b1, env->w1) * n(b2, env->w2)
-           * (env->psum
+      return b2 * n(env.b1, env.w1) * n(b2, env.w2)
+           * (env.psum
               + ppx_luminosity_internal(
-                  env->b1, b2, B, env->psum, env->pdifference
+                  env.b1, b2, B, env.psum, env.pdifference
                 )
              );
     EPA_BACKTRACE("lambda (b2) %e", b2);
   };
 
-  auto fb1 = [env, fb2 = std::move(fb2), integrate = integrator(level + 1)](
-      double b1
+  auto fb1 = [fb2 = std::move(fb2), integrate = integrator(level + 1)](
+      Env env, double b1
   ) -> double {
     EPA_TRY
-      env->b1 = b1;
-      return b1 * integrate(fb2, 0, infinity);
+      env.b1 = b1;
+      IntegrationSite site("fb2");
+      return b1 * integrate(
+          [&](double b2) -> double { return fb2(env, b2); }, 0, infinity
+      );
     EPA_BACKTRACE("lambda (b1) %e", b1);
   };
 
-  return [env, fb1 = std::move(fb1), integrate = integrator(level)](
+  return [fb1 = std::move(fb1), integrate = integrator(level)](
       double rs, double y, Polarization polarization
   ) -> double {
     EPA_TRY
+      Env env;
       double rx = exp(y);
-      env->w1          = rs * rx;
-      env->w2          = rs / rx;
-      env->psum        = polarization.parallel + polarization.perpendicular;
-      env->pdifference = polarization.parallel - polarization.perpendicular;
-      return sqr(pi) * rs * integrate(fb1, 0, infinity);
+      env.w1          = rs * rx;
+      env.w2          = rs / rx;
+      env.psum        = polarization.parallel + polarization.perpendicular;
+      env.pdifference = polarization.parallel - polarization.perpendicular;
+      IntegrationSite site("fb1");
+      return sqr(pi) * rs * integrate(
+          [&](double b1) -> double { return fb1(env, b1); }, 0, infinity
+      );
     EPA_BACKTRACE(
         "lambda (rs, y, polarization) %e, %e, {%e, %e}\n"
         "  defined in ppx_luminosity_y",
@@ -224,44 +227,49 @@ ppx_luminosity_fid_b(
     double pdifference;
   };
 
-  auto env = std::make_shared<Env>();
-
-  auto fx = [env, n_b = std::move(n_b)](double x) -> double {
+  auto fx = [n_b = std::move(n_b)](const Env& env, double x) -> double {
     EPA_TRY
       double rx = sqrt(x);
-      return n_b(env->b1, env->rs * rx) * n_b(env->b2, env->rs / rx) / x;
+      return n_b(env.b1, env.rs * rx) * n_b(env.b2, env.rs / rx) / x;
     EPA_BACKTRACE("lambda (x) %e; y = %e", x, 0.5 * log(x));
   };
 
   auto fb2 = [
-    env,
     B,
     fx        = std::move(fx),
     integrate = integrator(level + 2),
     one       = n ? 0 : 1
-  ](double b2) -> double {
+  ](Env env, double b2) -> double {
     EPA_TRY
-      env->b2 = b2;
-      return b2 * integrate(fx, env->x_min, env->x_max)
-           * (one * env->psum
+      env.b2 = b2;
+      IntegrationSite site("fx");
+      return b2
+           * integrate(
+               [&](double x) -> double { return fx(env, x); },
+               env.x_min,
+               env.x_max
+             )
+           * (one * env.psum
               + ppx_luminosity_internal(
-                 env->b1, b2, B, env->psum, env->pdifference
+                 env.b1, b2, B, env.psum, env.pdifference
                 )
              );
     EPA_BACKTRACE("lambda (b2) %e", b2);
   };
 
-  auto fb1 = [env, fb2 = std::move(fb2), integrate = integrator(level + 1)](
-      double b1
+  auto fb1 = [fb2 = std::move(fb2), integrate = integrator(level + 1)](
+      Env env, double b1
   ) -> double {
     EPA_TRY
-      env->b1 = b1;
-      return b1 * integrate(fb2, 0, infinity);
+      env.b1 = b1;
+      IntegrationSite site("fb2");
+      return b1 * integrate(
+          [&](double b2) -> double { return fb2(env, b2); }, 0, infinity
+      );
     EPA_BACKTRACE("lambda (b1) %e", b1);
   };
 
   return [
-    env,
     l   = n ? luminosity_fid(std::move(n), integrator(0)) : Luminosity_fid(),
     fb1 = std::move(fb1),
     integrate = integrator(level)
@@ -269,13 +277,17 @@ ppx_luminosity_fid_b(
       double rs, Polarization polarization, double y_min, double y_max
   ) -> double {
     EPA_TRY
-      env->rs          = 0.5 * rs;
-      env->x_min       = exp(2 * y_min);
-      env->x_max       = exp(2 * y_max);
-      env->psum        = polarization.parallel + polarization.perpendicular;
-      env->pdifference = polarization.parallel - polarization.perpendicular;
-      return (l ? 0.5 * env->psum * l(rs, y_min, y_max) : 0)
-             + sqr(pi) * env->rs * integrate(fb1, 0, infinity);
+      Env env;
+      env.rs          = 0.5 * rs;
+      env.x_min       = exp(2 * y_min);
+      env.x_max       = exp(2 * y_max);
+      env.psum        = polarization.parallel + polarization.perpendicular;
+      env.pdifference = polarization.parallel - polarization.perpendicular;
+      IntegrationSite site("fb1");
+      return (l ? 0.5 * env.psum * l(rs, y_min, y_max) : 0)
+             + sqr(pi) * env.rs * integrate(
+                 [&](double b1) -> double { return fb1(env, b1); }, 0, infinity
+               );
     EPA_BACKTRACE(
         "lambda (rs, polarization, y_min, y_max) %e, {%e, %e}, %e, %e\n"
         "  defined in ppx_luminosity_fid",
@@ -0,0 +1,668 @@
+// Benchmarks of the hot paths of libepa. Run with `make bench'; see
+// test/README.md for the options.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <sstream>
+
+#include <getopt.h>
+#include <string.h>
+
+#include <epa/proton.hpp>
+#include "a1.cpp"
+
+extern "C" {
+#include "../ffi/c/epa.h"
+};
+
+namespace epa {
+
+namespace bench {
+
+// Benchmark case: `run' is timed as a whole; `items' is the number of
+// operations it performs, the times are reported per operation
+struct Case {
+  std::string           name;
+  size_t                items;
+  std::function<void ()> run;
+};
+
+struct Result {
+  std::string name;
+  size_t      items;
+  size_t      iterations; // calls of Case::run per sample
+  size_t      samples;
+  double      median;     // s per item
+  double      min;        // s per item
+  double      mad;        // median absolute deviation, s per item
+};
+
+// Results are accumulated here so that the compiler can't discard the
+// computations
+static volatile double sink;
+
+// Where the human-readable results go
+static FILE* table = stdout;
+
+static double median(std::vector<double> x) {
+  std::sort(x.begin(), x.end());
+  size_t n = x.size();
+  return n % 2 ? x[n / 2] : 0.5 * (x[n / 2 - 1] + x[n / 2]);
+};
+
+static double seconds(std::function<void ()>& run, size_t iterations) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; ++i) run();
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start
+  ).count();
+};
+
+// Warms up by growing the number of iterations until a sample takes at least
+// sample_time seconds, then collects up to max_samples samples, stopping early
+// (but not before 3 samples) when case_time seconds are spent
+static Result measure(
+    Case& c, size_t max_samples, double sample_time, double case_time
+) {
+  size_t iterations = 1;
+  double t;
+  while ((t = seconds(c.run, iterations)) < sample_time)
+    iterations *= t > 0 ? std::clamp(1.2 * sample_time / t, 2., 10.) : 10;
+  size_t samples = std::clamp<double>(
+      case_time / t, std::min<size_t>(3, max_samples), max_samples
+  );
+
+  std::vector<double> x(samples);
+  for (auto& xi: x) xi = seconds(c.run, iterations) / (iterations * c.items);
+
+  Result result;
+  result.name       = c.name;
+  result.items      = c.items;
+  result.iterations = iterations;
+  result.samples    = samples;
+  result.median     = median(x);
+  result.min        = *std::min_element(x.begin(), x.end());
+  std::vector<double> deviations(samples);
+  for (size_t i = 0; i < samples; ++i)
+    deviations[i] = fabs(x[i] - result.median);
+  result.mad = median(std::move(deviations));
+  return result;
+};
+
+static std::vector<double> log_grid(double from, double to, size_t n) {
+  std::vector<double> x(n);
+  for (size_t i = 0; i < n; ++i) x[i] = from * pow(to / from, i / (n - 1.));
+  return x;
+};
+
+// Scalar spectrum on a grid of photon energies
+static Case spectrum_case(const std::string& name, Spectrum n) {
+  auto w = std::make_shared<std::vector<double>>(log_grid(1e-2, 1e3, 1000));
+  return { name, w->size(), [=]() {
+    double s = 0;
+    for (double wi: *w) s += n(wi);
+    sink = s;
+  }};
+};
+
+static Case spectrum_batch_case(const std::string& name, Spectrum_batch n) {
+  auto w = std::make_shared<std::vector<double>>(log_grid(1e-2, 1e3, 1000));
+  auto y = std::make_shared<std::vector<double>>(w->size());
+  return { name, w->size(), [=]() {
+    n(w->size(), w->data(), y->data());
+    sink = (*y)[0];
+  }};
+};
+
+// Spectrum in the impact parameter space on a grid of (b, w)
+struct Grid_b {
+  std::vector<double> b;
+  std::vector<double> w;
+};
+
+static std::shared_ptr<Grid_b> make_grid_b() {
+  auto grid = std::make_shared<Grid_b>();
+  for (double b: log_grid(0.1 * fm, 100 * fm, 40))
+    for (double w: log_grid(1e-1, 1e3, 25)) {
+      grid->b.push_back(b);
+      grid->w.push_back(w);
+    };
+  return grid;
+};
+
+static Case spectrum_b_case(const std::string& name, Spectrum_b n) {
+  auto grid = make_grid_b();
+  return { name, grid->b.size(), [=]() {
+    double s = 0;
+    for (size_t i = 0; i < grid->b.size(); ++i) s += n(grid->b[i], grid->w[i]);
+    sink = s;
+  }};
+};
+
+static Case spectrum_b_batch_case(const std::string& name, Spectrum_b_batch n) {
+  auto grid = make_grid_b();
+  auto y = std::make_shared<std::vector<double>>(grid->b.size());
+  return { name, grid->b.size(), [=]() {
+    n(grid->b.size(), grid->b.data(), grid->w.data(), y->data());
+    sink = (*y)[0];
+  }};
+};
+
+static Case bessel_case(const std::string& name, double (*f)(double)) {
+  auto x = std::make_shared<std::vector<double>>(log_grid(1e-3, 50, 1000));
+  return { name, x->size(), [=]() {
+    double s = 0;
+    for (double xi: *x) s += f(xi);
+    sink = s;
+  }};
+};
+
+static Case single_case(const std::string& name, std::function<double ()> f) {
+  return { name, 1, [f = std::move(f)]() { sink = f(); } };
+};
+
+static std::shared_ptr<Function1d> a1_form_factor() {
+  size_t npoints = sizeof(A1_FORM_FACTOR) / sizeof(double) / 3;
+  auto form_factor = std::make_shared<Function1d>();
+  form_factor->points->reserve(npoints);
+  double m2 = sqr(2 * proton_mass);
+  const double* a1 = A1_FORM_FACTOR;
+  for (size_t i = 0; i < npoints; ++i) {
+    double q2       = *a1++;
+    double electric = *a1++;
+    double magnetic = *a1++;
+    double tau = q2 / m2;
+    form_factor->points->push_back({
+        q2,
+        (electric + tau * proton_magnetic_moment * magnetic) / (1 + tau)
+    });
+  };
+  return form_factor;
+};
+
+static double c_dipole_form_factor(double q2, void*) {
+  return 1 / sqr(1 + q2 / proton_dipole_form_factor_lambda2);
+};
+
+static std::vector<Case> cases() {
+  const double E     = 13e3 / 2;
+  const double gamma = E / proton_mass;
+  const double L2    = proton_dipole_form_factor_lambda2;
+  const double mu    = 0.1056583755; // muon mass, GeV
+
+  std::vector<Case> result;
+
+  // closed-form spectra, per evaluation
+  result.push_back(spectrum_case(
+        "spectrum/monopole", spectrum_monopole(1, gamma, L2)
+  ));
+  result.push_back(spectrum_case(
+        "spectrum/dipole", spectrum_dipole(1, gamma, L2)
+  ));
+  result.push_back(spectrum_case(
+        "spectrum/proton_dipole", proton_dipole_spectrum(E)
+  ));
+  result.push_back(spectrum_batch_case(
+        "spectrum/dipole_batch", spectrum_dipole_batch(1, gamma, L2)
+  ));
+  result.push_back(spectrum_batch_case(
+        "spectrum/proton_dipole_batch", proton_dipole_spectrum_batch(E)
+  ));
+  result.push_back(spectrum_b_case(
+        "spectrum_b/point", spectrum_b_point(1, gamma)
+  ));
+  result.push_back(spectrum_b_case(
+        "spectrum_b/dipole", spectrum_b_dipole(1, gamma, L2)
+  ));
+  result.push_back(spectrum_b_case(
+        "spectrum_b/proton_dipole_Dirac", proton_dipole_spectrum_b_Dirac(E)
+  ));
+  result.push_back(spectrum_b_batch_case(
+        "spectrum_b/dipole_batch", spectrum_b_dipole_batch(1, gamma, L2)
+  ));
+  result.push_back(spectrum_b_batch_case(
+        "spectrum_b/proton_dipole_Dirac_batch",
+        proton_dipole_spectrum_b_Dirac_batch(E)
+  ));
+
+  // Bessel functions, per evaluation
+  result.push_back(bessel_case(
+        "bessel/K0", static_cast<double (*)(double)>(bessel_K0)
+  ));
+  result.push_back(bessel_case(
+        "bessel/K1", static_cast<double (*)(double)>(bessel_K1)
+  ));
+  result.push_back(bessel_case("bessel/gsl_K1", gsl::bessel_K1));
+  {
+    auto x  = std::make_shared<std::vector<double>>(log_grid(1e-3, 50, 1000));
+    auto k0 = std::make_shared<std::vector<double>>(x->size());
+    auto k1 = std::make_shared<std::vector<double>>(x->size());
+    result.push_back({ "bessel/K01_batch", x->size(), [=]() {
+      bessel_K01(x->size(), x->data(), k0->data(), k1->data());
+      sink = (*k0)[0] + (*k1)[0];
+    }});
+  };
+
+  // luminosities at 13 TeV, per sqrt(s) point
+  {
+    auto l = luminosity(proton_dipole_spectrum(E));
+    result.push_back(single_case("luminosity/dipole", [=]() {
+      return l(100);
+    }));
+    auto lf = luminosity_fid(proton_dipole_spectrum(E));
+    result.push_back(single_case("luminosity_fid/dipole", [=]() {
+      return lf(100, -2.5, 2.5);
+    }));
+    auto pp = pp_luminosity(2 * E);
+    result.push_back(single_case("pp_luminosity", [=]() { return pp(100); }));
+  };
+
+  for (unsigned level: { 0, 1 }) {
+    auto l = pp_luminosity_b(2 * E, default_integrator, level);
+    result.push_back(single_case(
+          "pp_luminosity_b/" + std::to_string(level),
+          [=]() { return l(100, { 1, 1 }); }
+    ));
+  };
+
+  for (unsigned level: { 0, 1 }) {
+    auto l = pp_luminosity_fid_b(2 * E, default_integrator, level);
+    result.push_back(single_case(
+          "pp_luminosity_fid_b/" + std::to_string(level),
+          [=]() { return l(100, { 1, 1 }, -2.5, 2.5); }
+    ));
+  };
+
+  // the outermost integral split between threads (see parallel_integrator)
+  for (unsigned threads: { 1, 2, 4 }) {
+    auto l = pp_luminosity_fid_b(
+        2 * E, parallel_integrator_generator(0, threads)
+    );
+    result.push_back(single_case(
+          "pp_luminosity_fid_b/parallel_" + std::to_string(threads),
+          [=]() { return l(100, { 1, 1 }, -2.5, 2.5); }
+    ));
+  };
+
+  // the GSL integrator (the default) against its port in quadpack.hpp on the
+  // same luminosities
+  for (auto& [name, integrator]: {
+      std::make_pair("qag", qag_integrator_generator()),
+      std::make_pair("gk",  gk_integrator_generator())
+  }) {
+    auto l = luminosity(proton_dipole_spectrum(E), integrator(0));
+    result.push_back(single_case(std::string("luminosity/") + name, [=]() {
+      return l(100);
+    }));
+    auto pp = pp_luminosity(2 * E, integrator(0));
+    result.push_back(single_case(std::string("pp_luminosity/") + name, [=]() {
+      return pp(100);
+    }));
+    auto lf = luminosity_fid_b(
+        proton_dipole_spectrum_b_Dirac(E), pp_upc_probability(2 * E), integrator
+    );
+    result.push_back(single_case(
+          std::string("luminosity_fid_b/") + name,
+          [=]() { return lf(100, { 1, 1 }, -2.5, 2.5); }
+    ));
+  };
+
+  // luminosity_y_b with the batch spectrum and batch_integrator against the
+  // scalar spectrum and gk_integrator, which take the same steps
+  {
+    auto gaussians = pp_upc_probability_Gaussians(2 * E);
+    auto l = luminosity_y_b(
+        proton_dipole_spectrum_b_Dirac(E), gaussians, gk_integrator_generator()
+    );
+    result.push_back(single_case("luminosity_y_b/scalar", [=]() {
+      return l(100, 0, { 1, 1 });
+    }));
+    auto lb = luminosity_y_b(
+        proton_dipole_spectrum_b_Dirac_batch(E), gaussians
+    );
+    result.push_back(single_case("luminosity_y_b/batch", [=]() {
+      return lb(100, 0, { 1, 1 });
+    }));
+  };
+
+  // muon pairs with pT > 5 GeV, |eta| < 2.5; the accuracy is reduced to 1e-2
+  // at every level to keep a sample around 10 s
+  {
+    auto x = xsection_fid_b(
+        photons_to_fermions_pT_b(mu),
+        pp_luminosity_fid_b(2 * E, gk_integrator_generator(1e-2, 1)),
+        mu,
+        5,
+        2.5,
+        0,
+        infinity,
+        cquad_integrator(0, 1e-2)
+    );
+    result.push_back(single_case("xsection_fid_b", [=]() { return x(20); }));
+  };
+
+  // spectra for the form factor tabulated by the A1 collaboration
+  {
+    auto ff = a1_form_factor();
+    auto g = spectrum_b_function1d_g(1, gamma, ff);
+    result.push_back(single_case("spectrum_b_function1d_g/a1", [=]() {
+      return g(fm, 1e2);
+    }));
+    auto s = spectrum_b_function1d_s(1, gamma, ff);
+    result.push_back(single_case("spectrum_b_function1d_s/a1", [=]() {
+      return s(fm, 1e2);
+    }));
+  };
+
+  // FFI: a closure called through the C interface, and an integrated spectrum
+  // with the form factor supplied as a C callback (compare with
+  // spectrum/dipole and spectrum/integrated)
+  {
+    auto f = std::shared_ptr<epa_function1d>(
+        epa_spectrum_dipole(1, gamma, L2),
+        [](epa_function1d* f) { epa_destroy_function((epa_function*)f); }
+    );
+    auto w = std::make_shared<std::vector<double>>(log_grid(1e-2, 1e3, 1000));
+    result.push_back({ "ffi/spectrum_dipole", w->size(), [=]() {
+      double s = 0;
+      for (double wi: *w) s += f->function(wi, f->data);
+      sink = s;
+    }});
+
+    result.push_back(spectrum_case(
+          "spectrum/integrated", spectrum(1, gamma, form_factor_dipole(L2))
+    ));
+
+    // the spectrum keeps a pointer to the form factor, which has to outlive it
+    auto form_factor = std::shared_ptr<epa_function1d>(
+        (epa_function1d*)epa_make_function(
+          (void (*)())c_dipole_form_factor, nullptr, nullptr
+        ),
+        [](epa_function1d* f) { epa_destroy_function((epa_function*)f); }
+    );
+    auto n = std::shared_ptr<epa_function1d>(
+        epa_spectrum(1, gamma, form_factor.get(), nullptr),
+        [](epa_function1d* f) { epa_destroy_function((epa_function*)f); }
+    );
+    result.push_back({
+        "ffi/spectrum_c_form_factor",
+        w->size(),
+        [n, w, form_factor]() {
+          double s = 0;
+          for (double wi: *w) s += n->function(wi, n->data);
+          sink = s;
+        }
+    });
+  };
+
+  return result;
+};
+
+static void write_json(std::ostream& out, const std::vector<Result>& results) {
+  out.precision(6);
+  out << "{\n"
+         "  \"version\": \""
+      << EPA_VERSION_MAJOR << '.' << EPA_VERSION_MINOR << '.'
+      << EPA_VERSION_PATCH << "\",\n"
+         "  \"unit\": \"s\",\n"
+         "  \"cases\": [\n";
+  // one case per line: read_json relies on it
+  for (size_t i = 0; i < results.size(); ++i) {
+    auto& r = results[i];
+    out << "    { \"name\": \"" << r.name << "\""
+        << ", \"items\": "      << r.items
+        << ", \"iterations\": " << r.iterations
+        << ", \"samples\": "    << r.samples
+        << ", \"median\": "     << r.median
+        << ", \"min\": "        << r.min
+        << ", \"mad\": "        << r.mad
+        << " }" << (i + 1 < results.size() ? "," : "") << '\n';
+  };
+  out << "  ]\n}\n";
+};
+
+// Reads the results written by write_json
+static std::vector<Result> read_json(std::istream& in) {
+  std::vector<Result> results;
+  std::string line;
+  auto number = [&line](const char* key) -> double {
+    size_t i = line.find(std::string("\"") + key + "\": ");
+    if (i == std::string::npos) return 0;
+    return strtod(line.c_str() + i + strlen(key) + 4, nullptr);
+  };
+  while (std::getline(in, line)) {
+    size_t i = line.find("\"name\": \"");
+    if (i == std::string::npos) continue;
+    i += 9;
+    Result r;
+    r.name       = line.substr(i, line.find('"', i) - i);
+    r.items      = number("items");
+    r.iterations = number("iterations");
+    r.samples    = number("samples");
+    r.median     = number("median");
+    r.min        = number("min");
+    r.mad        = number("mad");
+    results.push_back(std::move(r));
+  };
+  return results;
+};
+
+static void print_result(const Result& r) {
+  fprintf(
+      table,
+      "%-38s %12.4e %12.4e %7.2f%% %10zu x %zu\n",
+      r.name.c_str(),
+      r.median,
+      r.min,
+      100 * r.mad / r.median,
+      r.iterations,
+      r.samples
+  );
+};
+
+// Compares the results with the baseline. A case has regressed if both its
+// median and its minimum time grew by more than threshold or three times the
+// combined relative spread of the two measurements, whichever is larger: the
+// minimum is the more stable of the two on a loaded machine, the median
+// guards against a single lucky sample. Improvements are detected the same
+// way. Returns the number of regressions.
+static size_t compare(
+    const std::vector<Result>& results,
+    const std::vector<Result>& baseline,
+    double threshold
+) {
+  size_t regressions = 0;
+  fprintf(
+      table,
+      "\n%-38s %12s %12s %8s %8s\n",
+      "case", "baseline, s", "current, s", "ratio", "min"
+  );
+  for (auto& r: results) {
+    auto b = std::find_if(
+        baseline.begin(),
+        baseline.end(),
+        [&r](const Result& b) -> bool { return b.name == r.name; }
+    );
+    if (b == baseline.end() || b->median <= 0 || b->min <= 0) {
+      fprintf(table, "%-38s %12s %12.4e\n", r.name.c_str(), "-", r.median);
+      continue;
+    };
+    double ratio     = r.median / b->median;
+    double min_ratio = r.min / b->min;
+    double noise = 3 * (r.mad / r.median + b->mad / b->median);
+    double limit = 1 + std::max(threshold, noise);
+    const char* verdict = "";
+    if (ratio > limit && min_ratio > limit) {
+      verdict = "  REGRESSION";
+      ++regressions;
+    } else if (ratio < 1 / limit && min_ratio < 1 / limit)
+      verdict = "  improvement";
+    fprintf(
+        table,
+        "%-38s %12.4e %12.4e %8.3f %8.3f%s\n",
+        r.name.c_str(), b->median, r.median, ratio, min_ratio, verdict
+    );
+  };
+  return regressions;
+};
+
+static void usage(const char* argv0) {
+  std::cout
+    << "Benchmarks of libepa. For every case prints the median and the minimum\n"
+       "time per operation, the relative median absolute deviation, and the\n"
+       "number of iterations per sample x the number of samples.\n"
+       "Usage: " << argv0 << " options...\n"
+       "Allowed options:\n"
+       "  -h or --help:         print this message and exit (no argument)\n"
+       "  -l or --list:         list the cases and exit (no argument)\n"
+       "  -f or --filter:       run only the cases matching this regular expression\n"
+       "  -n or --samples:      maximum number of samples per case (default: 10)\n"
+       "  -s or --sample-time:  minimum duration of a sample, s (default: 0.1)\n"
+       "  -c or --case-time:    time budget per case, s (default: 5)\n"
+       "  -j or --json:         write the results in JSON to this file (- for stdout)\n"
+       "  -b or --baseline:     compare the results with this file written by --json;\n"
+       "                        exit with status 2 if any case has regressed\n"
+       "  -t or --threshold:    relative slowdown that counts as a regression\n"
+       "                        (default: 0.1)\n"
+  ;
+};
+
+}; // namespace bench
+
+}; // namespace epa
+
+int main(int argc, char** argv) {
+  using namespace epa::bench;
+
+  option options[] = {
+    { "help",        0, nullptr, 'h' },
+    { "list",        0, nullptr, 'l' },
+    { "filter",      1, nullptr, 'f' },
+    { "samples",     1, nullptr, 'n' },
+    { "sample-time", 1, nullptr, 's' },
+    { "case-time",   1, nullptr, 'c' },
+    { "json",        1, nullptr, 'j' },
+    { "baseline",    1, nullptr, 'b' },
+    { "threshold",   1, nullptr, 't' },
+    { nullptr,       0,       0,   0 }
+  };
+
+  std::string optstring;
+  for (auto& o: options)
+    if (o.val > 0) {
+      optstring += static_cast<char>(o.val);
+      if (o.has_arg) optstring += ':';
+    };
+
+  bool        list        = false;
+  std::regex  filter(".*");
+  size_t      samples     = 10;
+  double      sample_time = 0.1;
+  double      case_time   = 5;
+  std::string json;
+  std::string baseline;
+  double      threshold   = 0.1;
+
+  while (true) {
+    int c = getopt_long(argc, argv, optstring.c_str(), options, nullptr);
+    if (c == -1) break;
+    switch (c) {
+      case 'h':
+        usage(argv[0]);
+        return 0;
+
+      case 'l':
+        list = true;
+        break;
+
+      case 'f':
+        try {
+          filter = std::regex(optarg);
+        } catch (std::regex_error& e) {
+          std::cerr << "Invalid filter: " << optarg << " (" << e.what() << ")\n";
+          return 1;
+        };
+        break;
+
+      case 'n':
+        samples = std::max(1, atoi(optarg));
+        break;
+
+      case 's':
+        sample_time = atof(optarg);
+        break;
+
+      case 'c':
+        case_time = atof(optarg);
+        break;
+
+      case 'j':
+        json = optarg;
+        break;
+
+      case 'b':
+        baseline = optarg;
+        break;
+
+      case 't':
+        threshold = atof(optarg);
+        break;
+
+      case '?':
+        return 1;
+    };
+  };
+
+  std::vector<Result> base;
+  if (!baseline.empty()) {
+    std::ifstream in(baseline);
+    if (!in) {
+      std::cerr << "Can't open " << baseline << ": " << strerror(errno) << '\n';
+      return 1;
+    };
+    base = read_json(in);
+  };
+
+  epa_init();
+
+  auto all = cases();
+  if (list) {
+    for (auto& c: all) std::cout << c.name << '\n';
+    return 0;
+  };
+
+  // with JSON on stdout, the table goes to stderr
+  if (json == "-") table = stderr;
+
+  fprintf(
+      table,
+      "%-38s %12s %12s %8s %10s\n",
+      "case", "median, s", "min, s", "mad", "iterations"
+  );
+  std::vector<Result> results;
+  for (auto& c: all) {
+    if (!std::regex_search(c.name, filter)) continue;
+    results.push_back(measure(c, samples, sample_time, case_time));
+    print_result(results.back());
+  };
+
+  size_t regressions = 0;
+  if (!base.empty()) regressions = compare(results, base, threshold);
+  fflush(table);
+
+  if (json == "-")
+    write_json(std::cout, results);
+  else if (!json.empty()) {
+    std::ofstream out(json);
+    write_json(out, results);
+    if (!out) {
+      std::cerr << "Can't write " << json << '\n';
+      return 1;
+    };
+  };
+
+  return regressions ? 2 : 0;
+};